@@ -4,6 +4,7 @@
 layout(location = 0) in vec3 normal;
 layout(location = 1) in vec2 uv;
 layout(location = 2) in vec3 worldPosition;
+layout(location = 3) flat in uint materialIndex;
 
 
 layout(location = 0) out vec4 fragColor;
@@ -15,13 +16,23 @@ layout(set = 1, binding = 3) uniform sampler2D normalSampler;
 layout(set = 1, binding = 4) uniform sampler2D occlusionSampler;
 layout(set = 1, binding = 5) uniform sampler2D emissiveSampler;
 
-layout(set = 1, binding = 6) uniform MaterialData {
+struct Material {
 	vec4 colorFactor;
+	vec4 emissiveFactor;
 	float metallicFactor;
 	float roughnessFactor;
-	vec4 emissiveFactor;
-	bool dubbleSided;
-} material;
+	uint colorTexture;
+	uint metallicRoughnessTexture;
+	uint normalTexture;
+	uint occlusionTexture;
+	uint emissiveTexture;
+	uint doubleSided;
+};
+
+// The material table, shared by all materials
+layout(set = 1, binding = 6) readonly buffer Materials {
+	Material materials[];
+};
 
 void main() {
 	vec3 dir = vec3(1, -1, -1);
@@ -29,9 +40,11 @@ void main() {
 
 	vec4 color = texture(colorSampler, uv);
 	vec2 metallicRoughness = texture(metallicRoughnessSampler, uv).rg;
-	vec3 normal = texture(normalSampler, uv).rgb;
+	// Normal maps may be stored with two channels (BC5), z is reconstructed
+	vec2 normalXY = texture(normalSampler, uv).rg * 2.0 - 1.0;
+	vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
 	float occlusion = texture(occlusionSampler, uv).r;
 	vec3 emissive = texture(emissiveSampler, uv).rgb;
 
-	fragColor = vec4(color.rgb * material.colorFactor.rgb * occlusion, color.a);
+	fragColor = vec4(color.rgb * materials[materialIndex].colorFactor.rgb * occlusion, color.a);
 }
@@ -1,5 +1,8 @@
 #version 460
 
+// Packed vertices store normals octahedral encoded in xy
+layout(constant_id = 0) const bool OCTAHEDRAL_NORMALS = false;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec2 inTextureCoordinate;
 layout(location = 2) in vec3 inNormal;
@@ -7,6 +10,7 @@ layout(location = 2) in vec3 inNormal;
 layout(location = 0) out vec3 normal;
 layout(location = 1) out vec2 uv;
 layout(location = 2) out vec3 worldPosition;
+layout(location = 3) flat out uint materialIndex; // Record in the material table
 
 
 layout(binding = 0) uniform UniformData {
@@ -14,13 +18,33 @@ layout(binding = 0) uniform UniformData {
 	mat4 proj;
 } ubo;
 
-layout(push_constant) uniform TransformData {
+struct Object {
 	mat4 matrix;
-} transform;
+	uint materialIndex;
+	uint padding[3];
+};
+
+// Every draw finds its object at its first instance
+layout(set = 2, binding = 0) readonly buffer Objects {
+	Object objects[];
+};
+
+
+vec3 decodeOctahedral(vec2 encoded) {
+	vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
 
 
 void main() {
-	gl_Position = ubo.proj * ubo.view * transform.matrix * vec4(inPosition, 1.0);
-	normal = mat3(transform.matrix) * inNormal;
+	vec3 vertexNormal = OCTAHEDRAL_NORMALS ? decodeOctahedral(inNormal.xy) : inNormal;
+	Object object = objects[gl_InstanceIndex];
+	mat4 matrix = object.matrix;
+
+	gl_Position = ubo.proj * ubo.view * matrix * vec4(inPosition, 1.0);
+	normal = normalize(mat3(matrix) * vertexNormal);
 	uv = inTextureCoordinate;
+	materialIndex = object.materialIndex;
 }
@@ -0,0 +1,49 @@
+#version 460
+#extension GL_KHR_vulkan_glsl: enable
+#extension GL_EXT_nonuniform_qualifier: require
+
+layout(location = 0) in vec3 normal;
+layout(location = 1) in vec2 uv;
+layout(location = 2) in vec3 worldPosition;
+layout(location = 3) flat in uint materialIndex;
+
+
+layout(location = 0) out vec4 fragColor;
+
+
+struct Material {
+	vec4 colorFactor;
+	vec4 emissiveFactor;
+	float metallicFactor;
+	float roughnessFactor;
+	uint colorTexture;
+	uint metallicRoughnessTexture;
+	uint normalTexture;
+	uint occlusionTexture;
+	uint emissiveTexture;
+	uint doubleSided;
+};
+
+layout(set = 1, binding = 0) readonly buffer Materials {
+	Material materials[];
+};
+
+// Every texture of every material, indexed through the material of the draw
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+void main() {
+	vec3 dir = vec3(1, -1, -1);
+	float x = dot(dir, normal);
+
+	// Instanced draws may mix materials, so indices are not uniform within a draw
+	Material material = materials[materialIndex];
+	vec4 color = texture(textures[nonuniformEXT(material.colorTexture)], uv);
+	vec2 metallicRoughness = texture(textures[nonuniformEXT(material.metallicRoughnessTexture)], uv).rg;
+	// Normal maps may be stored with two channels (BC5), z is reconstructed
+	vec2 normalXY = texture(textures[nonuniformEXT(material.normalTexture)], uv).rg * 2.0 - 1.0;
+	vec3 normal = vec3(normalXY, sqrt(max(1.0 - dot(normalXY, normalXY), 0.0)));
+	float occlusion = texture(textures[nonuniformEXT(material.occlusionTexture)], uv).r;
+	vec3 emissive = texture(textures[nonuniformEXT(material.emissiveTexture)], uv).rgb;
+
+	fragColor = vec4(color.rgb * material.colorFactor.rgb * occlusion, color.a);
+}
@@ -4,6 +4,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <stdexcept>
+#include <chrono>
 
 #include "data/scene.h"
 #include "data/asset_manager.h"
@@ -45,10 +46,10 @@ void App::start() {
 
 	AssetManager assetManager(&m_renderer);
 
-	std::shared_ptr<Model> model = assetManager.loadModel(assetManager.loadModelSource("assets/models/gltf/sponza.glb"));
+	std::shared_future<std::shared_ptr<Model>> model = assetManager.loadModelAsync("assets/models/gltf/sponza.glb");
+	bool modelAdded = false;
 
 	Entity entity1 = scene.createEntity();
-	entity1.addComponent<ModelComponent>(model);
 
 	float lastTime = glfwGetTime();
 	float frameTime = 0;
@@ -66,7 +67,11 @@ void App::start() {
 		frameTime += delta;
 		if (frameTime >= 1.0f) {
 			frameTime -= 1.0f;
-			LOG_INFO("FPS: {}", frameCounter);
+			const CullingStats &cullingStats = scene.getCullingStats();
+			const RenderQueueStats &queueStats = m_renderer.getRenderQueueStats();
+			LOG_INFO("FPS: {}, visible meshes: {}/{}, draws: {}, instances: {}, binds: {}, binds avoided: {}", frameCounter,
+				cullingStats.visibleMeshes, cullingStats.testedMeshes, queueStats.draws, queueStats.instances,
+				queueStats.getBinds(), queueStats.getBindsAvoided());
 			frameCounter = 0;
 		}
 
@@ -83,10 +88,21 @@ void App::start() {
 			100.0f);
 		viewData->proj[1][1] *= -1; // Invert Y clip coordinates (OpenGL artifact)
 
+		assetManager.update();
+		if (!modelAdded && model.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			try {
+				entity1.addComponent<ModelComponent>(model.get());
+			}
+			catch (const std::exception &e) {
+				LOG_ERROR("Failed to load model: {}", e.what());
+			}
+			modelAdded = true;
+		}
+
 		m_renderer.prepare();
 
-		entity1.getComponent<TransformComponent>().matrix = glm::rotate(glm::rotate(glm::mat4(1.0f), (float)glfwGetTime() * glm::radians(45.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-			glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+		entity1.setMatrix(glm::rotate(glm::rotate(glm::mat4(1.0f), (float)glfwGetTime() * glm::radians(45.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
+			glm::radians(0.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
 
 		scene.render(m_renderer);
 
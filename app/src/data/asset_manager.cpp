@@ -2,83 +2,33 @@
 
 #include <stb_image.h>
 
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+
 #include "graphics/renderer.h"
 #include "tools/convert_model.h"
+#include "tools/cooked_model.h"
+#include "tools/ktx2.h"
+#include "tools/texture_compression.h"
 #include "log.h"
 
 
-void transitionImageLayout(VkImage image, VkFormat format,
-	VkImageLayout sourceLayout, VkImageLayout targetLayout,
-	const Renderer &renderer) {
-
-	VkCommandBuffer commandBuffer = renderer.prepareSingleCommand();
-
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = sourceLayout;
-	barrier.newLayout = targetLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags sourceStage;
-	VkPipelineStageFlags destinationStage;
-
-	if (sourceLayout == VK_IMAGE_LAYOUT_UNDEFINED && targetLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	}
-	else if (sourceLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && targetLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-	else {
-		throw std::invalid_argument("unsupported layout transition!");
-	}
-
-	vkCmdPipelineBarrier(
-		commandBuffer,
-		sourceStage, destinationStage,
-		0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier
-	);
-
-	renderer.executeSingleCommand(commandBuffer);
-}
-
-VkBuffer createEmptyBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkDevice device) {
-	VkBufferCreateInfo bufferInfo{};
-	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferInfo.size = size;
-
-	bufferInfo.usage = usage;
-	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	bufferInfo.flags = 0; // Optional (spares buffer memory)
+// Decodes every level of a block compressed mip chain to 8 bit RGBA
+static std::vector<std::byte> decompressImageChain(const std::byte *data, ImageFormat format, uint32_t width, uint32_t height, uint32_t mipLevels) {
+	ImageFormat decodedFormat = isSrgb(format) ? ImageFormat::SRGB : ImageFormat::LINEAR;
+	std::vector<std::byte> decoded(imageChainSize(decodedFormat, width, height, mipLevels));
 
-	VkBuffer buffer;
-
-	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-		LOG_ERROR("Failed to create buffer");
-		throw std::runtime_error("Failed to create buffer");
+	size_t sourceOffset = 0;
+	size_t decodedOffset = 0;
+	for (uint32_t level = 0; level < mipLevels; ++level) {
+		decompressImage(data + sourceOffset, std::max(width >> level, 1u), std::max(height >> level, 1u), format, decoded.data() + decodedOffset);
+		sourceOffset += imageLevelSize(format, width, height, level);
+		decodedOffset += imageLevelSize(decodedFormat, width, height, level);
 	}
-
-	return buffer;
+	return decoded;
 }
 
-
 AssetManager::AssetManager(Renderer *renderer) : m_renderer(renderer) {
 	// Load default textures
 	m_defaultMetallicRoughnessImage = loadImage("assets/textures/defaultMetallicRoughness.png", ImageFormat::LINEAR);
@@ -98,6 +48,17 @@ AssetManager::AssetManager(Renderer *renderer) : m_renderer(renderer) {
 }
 
 void AssetManager::destroy() {
+	// Let in-flight loads finish so none of their resources outlive the device
+	for (auto &task : m_workerTasks) {
+		task.wait();
+	}
+	m_workerTasks.clear();
+
+	for (auto &load : m_submittedLoads) {
+		m_renderer->getUploadQueue().wait(load->uploadTicket);
+	}
+	update();
+
 	m_defaultMetallicRoughnessTexture.destroy(m_renderer->getDevice().getLogicalDevice());
 	m_defaultNormalTexture.destroy(m_renderer->getDevice().getLogicalDevice());
 	m_defaultOcclusionTexture.destroy(m_renderer->getDevice().getLogicalDevice());
@@ -109,7 +70,60 @@ void AssetManager::destroy() {
 	m_defaultEmissiveImage.destroy(m_renderer->getDevice().getLogicalDevice());
 }
 
+void AssetManager::update() {
+	std::vector<std::shared_ptr<PendingModelLoad>> completedLoads;
+	{
+		std::lock_guard<std::mutex> lock(m_loadMutex);
+		for (auto it = m_submittedLoads.begin(); it != m_submittedLoads.end();) {
+			if (m_renderer->getUploadQueue().isComplete((*it)->uploadTicket)) {
+				completedLoads.push_back(*it);
+				it = m_submittedLoads.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	for (auto &load : completedLoads) {
+		// Descriptor sets are allocated here since the descriptor allocator belongs to the render thread
+		try {
+			load->promise.set_value(finalizeModel(load->model));
+		}
+		catch (...) {
+			load->promise.set_exception(std::current_exception());
+		}
+	}
+
+	// Drop bookkeeping for workers that have finished
+	m_workerTasks.erase(std::remove_if(m_workerTasks.begin(), m_workerTasks.end(), [](const std::future<void> &task) {
+		return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}), m_workerTasks.end());
+}
+
 Image AssetManager::loadImage(const std::string &path, ImageFormat format) {
+	if (isKtx2Path(path)) {
+		std::optional<Ktx2Image> ktxImage = loadKtx2Image(path);
+		if (!ktxImage) {
+			LOG_ERROR("Failed to load image at: {}", path);
+			throw std::runtime_error("Failed to load image");
+		}
+
+		// Pre-compressed blocks and mips are uploaded as stored, or decoded when the device cannot sample them
+		if (!canSample(ktxImage->format)) {
+			ktxImage->data = decompressImageChain(ktxImage->data.data(), ktxImage->format, ktxImage->width, ktxImage->height, ktxImage->mipLevels);
+			ktxImage->format = isSrgb(ktxImage->format) ? ImageFormat::SRGB : ImageFormat::LINEAR;
+		}
+		Image image = createImage(ktxImage->width, ktxImage->height, ktxImage->format, ktxImage->mipLevels);
+
+		UploadQueue &uploadQueue = m_renderer->getUploadQueue();
+		uploadQueue.uploadImage(image.getImage(), ktxImage->format, ktxImage->width, ktxImage->height, ktxImage->mipLevels,
+			ktxImage->data.data(), ktxImage->data.size());
+		uploadQueue.wait(uploadQueue.flush());
+
+		return image;
+	}
+
 	int width, height, comp;
 	stbi_uc *data = stbi_load(path.c_str(), &width, &height, &comp, 4);
 
@@ -120,13 +134,23 @@ Image AssetManager::loadImage(const std::string &path, ImageFormat format) {
 }
 
 Image AssetManager::loadImage(void *data, size_t size, unsigned int width, unsigned int height, ImageFormat format) {
+	Image image = createImage(width, height, format);
+
+	UploadQueue &uploadQueue = m_renderer->getUploadQueue();
+	uploadQueue.uploadImage(image.getImage(), format, width, height, 1, data, size);
+	uploadQueue.wait(uploadQueue.flush());
+
+	return image;
+}
+
+Image AssetManager::createImage(unsigned int width, unsigned int height, ImageFormat format, uint32_t mipLevels) {
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	imageInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageInfo.extent.width = width;
 	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = mipLevels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.format = static_cast<VkFormat>(format);
 	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -140,174 +164,61 @@ Image AssetManager::loadImage(void *data, size_t size, unsigned int width, unsig
 		LOG_ERROR("Failed to create image");
 		throw std::runtime_error("Failed to create image");
 	}
-	
-
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(m_renderer->getDevice().getLogicalDevice(), image, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(
-		memRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_renderer->getDevice().getPhysicalDevice());
-
-	VkDeviceMemory imageMemory;
-	if (vkAllocateMemory(m_renderer->getDevice().getLogicalDevice(), &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		LOG_ERROR("Failed to allocate image memory");
-		throw std::runtime_error("Failed to allocate image memory");
-	}
-
-	vkBindImageMemory(m_renderer->getDevice().getLogicalDevice(), image, imageMemory, 0);
-
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	VkBufferCreateInfo stagingBufferInfo{};
-	stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferInfo.size = size;
-	stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	stagingBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	if (vkCreateBuffer(m_renderer->getDevice().getLogicalDevice(), &stagingBufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS) {
-		LOG_ERROR("Failed to create staging buffer for image creation");
-		throw std::runtime_error("Failed to create staging buffer during image creation");
-	}
-
-	VkMemoryRequirements stagingMemoryRequirements;
-	vkGetBufferMemoryRequirements(m_renderer->getDevice().getLogicalDevice(), stagingBuffer, &stagingMemoryRequirements);
-
-	VkMemoryAllocateInfo stagingAllocationInfo{};
-	stagingAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	stagingAllocationInfo.allocationSize = stagingMemoryRequirements.size;
-	stagingAllocationInfo.memoryTypeIndex = findMemoryType(
-		stagingMemoryRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		m_renderer->getDevice().getPhysicalDevice());
-
-	if (vkAllocateMemory(m_renderer->getDevice().getLogicalDevice(), &stagingAllocationInfo, nullptr, &stagingBufferMemory) != VK_SUCCESS) {
-		LOG_ERROR("Failed to allocate staging buffer memory during image creation");
-		throw std::runtime_error("Failed to allocate staging buffer memory during image creation");
-	}
 
-	vkBindBufferMemory(m_renderer->getDevice().getLogicalDevice(), stagingBuffer, stagingBufferMemory, 0);
 
-	void *stagingData;
-	vkMapMemory(m_renderer->getDevice().getLogicalDevice(), stagingBufferMemory, 0, size, 0, &stagingData);
-	memcpy(stagingData, data, size);
-	vkUnmapMemory(m_renderer->getDevice().getLogicalDevice(), stagingBufferMemory);
-
-
-	transitionImageLayout(image,
-		static_cast<VkFormat>(format),
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		*m_renderer);
-
-	VkCommandBuffer commandBuffer = m_renderer->prepareSingleCommand();
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = {
-		width,
-		height,
-		1
-	};
-
-	vkCmdCopyBufferToImage(
-		commandBuffer,
-		stagingBuffer,
-		image,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1,
-		&region
-	);
-	m_renderer->executeSingleCommand(commandBuffer);
-
-	transitionImageLayout(image,
-		static_cast<VkFormat>(format),
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		*m_renderer);
-
-	vkDestroyBuffer(m_renderer->getDevice().getLogicalDevice(), stagingBuffer, nullptr);
-	vkFreeMemory(m_renderer->getDevice().getLogicalDevice(), stagingBufferMemory, nullptr);
+	MemoryAllocation imageMemory = m_renderer->getDevice().getAllocator().allocateImage(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
 	return Image(
 		width,
 		height,
 		format,
 		image,
-		imageMemory
+		imageMemory,
+		mipLevels
 	);
 }
 
 Texture AssetManager::loadTexture(const Image &image, const TextureProperties &properties) {
-	VkImageViewCreateInfo viewInfo{};
-	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	viewInfo.image = image.getImage();
-	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	viewInfo.format = static_cast<VkFormat>(image.getFormat());
-	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
-	viewInfo.subresourceRange.baseArrayLayer = 0;
-	viewInfo.subresourceRange.layerCount = 1;
-
-	VkImageView imageView;
-	if (vkCreateImageView(m_renderer->getDevice().getLogicalDevice(), &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
-		LOG_ERROR("Failed to create texture image view");
-		throw std::runtime_error("Failed to create texture image view");
-	}
-
+	return m_renderer->getTextureCache().createTexture(image, properties);
+}
 
-	VkPhysicalDeviceProperties physicalProperties{};
-	vkGetPhysicalDeviceProperties(m_renderer->getDevice().getPhysicalDevice(), &physicalProperties);
-
-	VkSamplerCreateInfo samplerInfo{};
-	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerInfo.magFilter = properties.mag;
-	samplerInfo.minFilter = properties.min;
-	samplerInfo.addressModeU = properties.wrapU;
-	samplerInfo.addressModeV = properties.wrapV;
-	samplerInfo.addressModeW = properties.wrapW;
-	samplerInfo.anisotropyEnable = VK_TRUE;
-	samplerInfo.maxAnisotropy = physicalProperties.limits.maxSamplerAnisotropy;
-	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-	samplerInfo.unnormalizedCoordinates = VK_FALSE;
-	samplerInfo.compareEnable = VK_FALSE;
-	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-	// TODO: Implement below settings (requires changes to ModelSource and converter)
-	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	samplerInfo.mipLodBias = 0.0f;
-	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = 0.0f;
-
-	VkSampler imageSampler;
-	if (vkCreateSampler(m_renderer->getDevice().getLogicalDevice(), &samplerInfo, nullptr, &imageSampler) != VK_SUCCESS) {
-		LOG_ERROR("Failed to create texture sampler");
-		throw std::runtime_error("Failed to create texture sampler");
+// Any error reading either time counts as out of date, the source is converted again
+static bool isCookedModelCurrent(const std::string &cookedPath, const std::string &sourcePath) {
+	std::error_code error;
+	if (!std::filesystem::exists(cookedPath, error) || error) {
+		return false;
 	}
-
-	return Texture(
-		properties,
-		imageView,
-		imageSampler
-	);
+	std::filesystem::file_time_type cookedTime = std::filesystem::last_write_time(cookedPath, error);
+	if (error) {
+		return false;
+	}
+	std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(sourcePath, error);
+	if (error) {
+		return false;
+	}
+	return cookedTime >= sourceTime;
 }
 
 std::unique_ptr<ModelSource> AssetManager::loadModelSource(const std::string &path) {
-	return convertToModelSource(path);
+	if (isCookedModelPath(path)) {
+		return loadCookedModel(path);
+	}
+
+	// Reuse the cooked copy of the model as long as it is newer than the source
+	std::string cookedPath = path + COOKED_MODEL_EXTENSION;
+	if (isCookedModelCurrent(cookedPath, path)) {
+		std::unique_ptr<ModelSource> cookedSource = loadCookedModel(cookedPath);
+		if (cookedSource) {
+			return cookedSource;
+		}
+		LOG_WARN("Unable to use cooked model, reconverting: {}", path);
+	}
+
+	std::unique_ptr<ModelSource> modelSource = convertToModelSource(path);
+	if (modelSource) {
+		writeCookedModel(*modelSource, cookedPath);
+	}
+	return modelSource;
 }
 
 std::unique_ptr<Model> AssetManager::loadModel(const std::unique_ptr<ModelSource> &modelSource) {
@@ -315,124 +226,158 @@ std::unique_ptr<Model> AssetManager::loadModel(const std::unique_ptr<ModelSource
 }
 
 std::unique_ptr<Model> AssetManager::loadModel(const ModelSource &modelSource) {
-	VkDeviceMemory vertexStagingMemory, modelVertexMemory;
+	PreparedModel model = prepareModel(modelSource);
 
-	VkBuffer vertexStagingBuffer = createEmptyBuffer(
-		modelSource.getVertexData().size(),
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		m_renderer->getDevice().getLogicalDevice());
-
-	VkBuffer vertexBuffer = createEmptyBuffer(
-		modelSource.getVertexData().size(),
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		m_renderer->getDevice().getLogicalDevice());
+	UploadQueue &uploadQueue = m_renderer->getUploadQueue();
+	uploadQueue.wait(uploadQueue.flush());
 
+	return finalizeModel(model);
+}
 
-	VkMemoryRequirements stagingMemoryRequirements;
-	vkGetBufferMemoryRequirements(m_renderer->getDevice().getLogicalDevice(), vertexStagingBuffer, &stagingMemoryRequirements);
+std::shared_future<std::shared_ptr<Model>> AssetManager::loadModelAsync(const std::string &path) {
+	auto load = std::make_shared<PendingModelLoad>();
+	std::shared_future<std::shared_ptr<Model>> future = load->promise.get_future().share();
 
-	VkMemoryAllocateInfo vertexStagingAllocationInfo{};
-	vertexStagingAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	vertexStagingAllocationInfo.allocationSize = stagingMemoryRequirements.size;
-	vertexStagingAllocationInfo.memoryTypeIndex = findMemoryType(
-		stagingMemoryRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		m_renderer->getDevice().getPhysicalDevice());
+	m_workerTasks.push_back(m_workers.submit([this, path, load]() {
+		loadModelWorker(path, load);
+	}));
 
-	if (vkAllocateMemory(m_renderer->getDevice().getLogicalDevice(), &vertexStagingAllocationInfo, nullptr, &vertexStagingMemory) != VK_SUCCESS) {
-		LOG_ERROR("Failed to allocate staging buffer memory");
-		throw std::runtime_error("Failed to allocate staging buffer memory");
-	}
+	return future;
+}
 
-	vkBindBufferMemory(m_renderer->getDevice().getLogicalDevice(), vertexStagingBuffer, vertexStagingMemory, 0);
+void AssetManager::loadModelWorker(const std::string &path, std::shared_ptr<PendingModelLoad> load) {
+	try {
+		std::unique_ptr<ModelSource> modelSource = loadModelSource(path);
+		if (!modelSource) {
+			throw std::runtime_error("Failed to load model source: " + path);
+		}
 
+		load->model = prepareModel(*modelSource);
+		load->uploadTicket = m_renderer->getUploadQueue().flush();
+	}
+	catch (...) {
+		LOG_ERROR("Asynchronous model load failed: {}", path);
+		releasePreparedModel(load->model);
+		load->promise.set_exception(std::current_exception());
+		return;
+	}
 
-	VkMemoryRequirements vertexMemoryRequirements;
-	vkGetBufferMemoryRequirements(m_renderer->getDevice().getLogicalDevice(), vertexBuffer, &vertexMemoryRequirements);
+	std::lock_guard<std::mutex> lock(m_loadMutex);
+	m_submittedLoads.push_back(load);
+}
 
-	VkMemoryAllocateInfo veretxAllocationInfo{};
-	veretxAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	veretxAllocationInfo.allocationSize = vertexMemoryRequirements.size;
-	veretxAllocationInfo.memoryTypeIndex = findMemoryType(
-		vertexMemoryRequirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_renderer->getDevice().getPhysicalDevice());
+PreparedModel AssetManager::prepareModel(const ModelSource &modelSource) {
+	PreparedModel model;
+
+	try {
+		model.geometry = m_renderer->getGeometryArena().allocate(m_renderer->getUploadQueue(), modelSource.getGeometry(),
+			modelSource.getVertexData().data(), modelSource.getMeshlets());
+
+		// Textures shared between materials, or with other models, are uploaded once through the texture cache.
+		// Each texture is stored as soon as it is acquired so a failed load can give it back.
+		const std::vector<ModelTextureData> &textures = modelSource.getTextures();
+		for (const auto &source : modelSource.getMaterials()) {
+			Material &material = model.materials.emplace_back(
+				Texture(),
+				m_defaultMetallicRoughnessTexture,
+				m_defaultNormalTexture,
+				m_defaultOcclusionTexture,
+				m_defaultEmissiveTexture,
+				source.properties
+			);
+
+			material.colorTexture = loadTexture(textures[source.colorTexture], modelSource);
+			if (source.metallicRoughnessTexture != -1) {
+				material.metallicRoughnessTexture = loadTexture(textures[source.metallicRoughnessTexture], modelSource);
+			}
+			if (source.normalTexture != -1) {
+				material.normalTexture = loadTexture(textures[source.normalTexture], modelSource);
+			}
+			if (source.occlusionTexture != -1) {
+				material.occlusionTexture = loadTexture(textures[source.occlusionTexture], modelSource);
+			}
+			if (source.emissiveTexture != -1) {
+				material.emissiveTexture = loadTexture(textures[source.emissiveTexture], modelSource);
+			}
+		}
 
-	if (vkAllocateMemory(m_renderer->getDevice().getLogicalDevice(), &veretxAllocationInfo, nullptr, &modelVertexMemory) != VK_SUCCESS) {
-		LOG_ERROR("Failed to allocate buffer memory");
-		throw std::runtime_error("Failed to allocate buffer memory");
+		model.meshes = modelSource.getMeshes();
+		for (auto &[node, meshes] : model.meshes) {
+			for (auto &mesh : meshes) {
+				model.geometry.rebase(mesh);
+			}
+		}
+		model.meshMatrices = modelSource.getMeshMatricies();
+		model.instances = m_renderer->getInstanceCuller().registerModel(m_renderer->getUploadQueue(), model.meshes, model.meshMatrices);
+	}
+	catch (...) {
+		releasePreparedModel(model);
+		throw;
 	}
 
-	vkBindBufferMemory(m_renderer->getDevice().getLogicalDevice(), vertexBuffer, modelVertexMemory, 0);
+	return model;
+}
 
+void AssetManager::releasePreparedModel(PreparedModel &model) {
+	// Uploads already recorded into released ranges complete before any later upload that reuses them
+	for (auto &material : model.materials) {
+		material.destroy(m_renderer->getDevice().getLogicalDevice());
+	}
+	model.materials.clear();
 
-	void *data;
-	vkMapMemory(m_renderer->getDevice().getLogicalDevice(), vertexStagingMemory, 0, modelSource.getVertexData().size(), 0, &data);
-	memcpy(data, modelSource.getVertexData().data(), modelSource.getVertexData().size());
-	vkUnmapMemory(m_renderer->getDevice().getLogicalDevice(), vertexStagingMemory);
+	m_renderer->getInstanceCuller().unregisterModel(model.instances);
+	m_renderer->getGeometryArena().free(model.geometry);
+}
 
-	VkCommandBuffer commandBuffer = m_renderer->prepareSingleCommand();
-	VkBufferCopy copyRegion{};
-	copyRegion.size = modelSource.getVertexData().size();
-	vkCmdCopyBuffer(commandBuffer, vertexStagingBuffer, vertexBuffer, 1, &copyRegion);
-	m_renderer->executeSingleCommand(commandBuffer);
-	vkDestroyBuffer(m_renderer->getDevice().getLogicalDevice(), vertexStagingBuffer, nullptr);
-	vkFreeMemory(m_renderer->getDevice().getLogicalDevice(), vertexStagingMemory, nullptr);
+std::unique_ptr<Model> AssetManager::finalizeModel(PreparedModel &model) {
+	for (auto &material : model.materials) {
+		m_renderer->initializeMaterials(material);
+	}
 
+	m_renderer->getDevice().getAllocator().logStats();
+	m_renderer->getTextureCache().logStats();
 
-	std::vector<Image> images;
-	std::vector<Material> materials;
+	return std::make_unique<Model>(
+		&m_renderer->getGeometryArena(),
+		model.geometry,
+		&m_renderer->getInstanceCuller(),
+		std::move(model.instances),
+		&m_renderer->getMaterialTable(),
+		m_renderer->getDevice().getLogicalDevice(),
+		std::move(model.meshes),
+		std::move(model.meshMatrices),
+		std::move(model.materials));
+}
 
-	VkPhysicalDeviceProperties properties{};
-	vkGetPhysicalDeviceProperties(m_renderer->getDevice().getPhysicalDevice(), &properties);
+Texture AssetManager::loadTexture(const ModelTextureData &texture, const ModelSource &modelSource) {
+	const ModelImageData &imageSource = modelSource.getImages().at(texture.image);
 
-	for (const auto &material : modelSource.getMaterials()) {
-		Image colorImage, metallicRoughnessImage, normalImage, occlusionImage, emissiveImage;
+	// Compressed images were encoded for one color space, uncompressed ones follow the texture
+	ImageFormat format = isBlockCompressed(imageSource.format) ? imageSource.format : texture.format;
+	bool decompress = !canSample(format);
+	if (decompress) {
+		format = isSrgb(format) ? ImageFormat::SRGB : ImageFormat::LINEAR;
+	}
 
-		Texture colorTexture = loadTexture(modelSource.getTextures()[material.colorTexture], properties, modelSource, colorImage);
-		Texture metallicRoughnessTexture = material.metallicRoughnessTexture == -1 ? m_defaultMetallicRoughnessTexture : loadTexture(modelSource.getTextures()[material.metallicRoughnessTexture], properties, modelSource, metallicRoughnessImage);
-		Texture normalTexture = material.normalTexture == -1 ? m_defaultNormalTexture : loadTexture(modelSource.getTextures()[material.normalTexture], properties, modelSource, normalImage);
-		Texture occlusionTexture = material.occlusionTexture == -1 ? m_defaultOcclusionTexture : loadTexture(modelSource.getTextures()[material.occlusionTexture], properties, modelSource, occlusionImage);
-		Texture emissiveTexture = material.emissiveTexture == -1 ? m_defaultEmissiveTexture : loadTexture(modelSource.getTextures()[material.emissiveTexture], properties, modelSource, emissiveImage);
+	unsigned int width = static_cast<unsigned int>(imageSource.width);
+	unsigned int height = static_cast<unsigned int>(imageSource.height);
+	uint64_t imageKey = TextureCache::makeImageKey(imageSource.hash, format, width, height, imageSource.mipLevels);
 
-		images.push_back(colorImage);
-		images.push_back(metallicRoughnessImage);
-		images.push_back(normalImage);
-		images.push_back(occlusionImage);
-		images.push_back(emissiveImage);
+	return m_renderer->getTextureCache().acquire(imageKey, texture.properties, [&]() {
+		const std::byte *imageData = modelSource.getImageData().data() + imageSource.offset;
 
-		std::vector<UniformBuffer<MaterialProperties>> propertiesBuffers;
-		for (size_t i = 0; i < Renderer::MAX_FRAMES_IN_FLIGHT; ++i) {
-			propertiesBuffers.emplace_back(m_renderer->getDevice(), &material.properties);
+		Image image = createImage(width, height, format, imageSource.mipLevels);
+		if (decompress) {
+			std::vector<std::byte> decoded = decompressImageChain(imageData, imageSource.format, width, height, imageSource.mipLevels);
+			m_renderer->getUploadQueue().uploadImage(image.getImage(), format, width, height, imageSource.mipLevels, decoded.data(), decoded.size());
 		}
-
-		materials.emplace_back(
-			colorTexture,
-			metallicRoughnessTexture,
-			normalTexture,
-			occlusionTexture,
-			emissiveTexture,
-			propertiesBuffers
-		);
-
-		m_renderer->initializeMaterials(materials.back());
-	}
-
-
-	return std::make_unique<Model>(
-		modelVertexMemory,
-		vertexBuffer,
-		m_renderer->getDevice().getLogicalDevice(),
-		modelSource.getMeshes(),
-		modelSource.getMeshMatricies(),
-		images,
-		materials);
+		else {
+			m_renderer->getUploadQueue().uploadImage(image.getImage(), format, width, height, imageSource.mipLevels, imageData, imageSource.size);
+		}
+		return image;
+	});
 }
 
-Texture AssetManager::loadTexture(const ModelTextureData &texture, VkPhysicalDeviceProperties properties, const ModelSource &modelSource, Image &image) {
-	const ModelImageData &imageSource = modelSource.getImages().at(texture.image);
-	const std::byte *imageData = modelSource.getImageData().data() + imageSource.offset;
-
-	image = loadImage(const_cast<std::byte*>(imageData), imageSource.size, imageSource.width, imageSource.height, texture.format);
-	return loadTexture(image, texture.properties);
+bool AssetManager::canSample(ImageFormat format) const {
+	return !isBlockCompressed(format) || m_renderer->getDevice().supportsTextureCompressionBC();
 }
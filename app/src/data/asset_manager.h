@@ -1,21 +1,43 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <future>
+#include <mutex>
 
 #include "data/image.h"
 #include "data/texture.h"
 #include "data/model_source.h"
 #include "data/model.h"
+#include "thread_pool.h"
 
 
+#define ASSET_LOADER_THREAD_COUNT 2
+
 class Renderer;
 
+// GPU resources of a model whose uploads have been recorded but not necessarily completed
+struct PreparedModel {
+	GeometryAllocation geometry;
+	InstanceRegistration instances;
+
+	std::unordered_map<int, std::vector<Mesh>> meshes;
+	std::unordered_map<int, glm::mat4> meshMatrices;
+
+	std::vector<Material> materials;
+};
+
 class AssetManager {
 public:
 	AssetManager(Renderer *renderer);
 
 	void destroy();
 
+	// Publishes asynchronously loaded models whose uploads have completed. Call once per frame from the render thread.
+	void update();
+
+	// KTX2 files are uploaded in the format they were stored in, other files and block compressed KTX2 files the
+	// device cannot sample are decoded to 8 bit RGBA
 	Image loadImage(const std::string &path, ImageFormat format);
 	Image loadImage(void *data, size_t size, unsigned int width, unsigned int height, ImageFormat format);
 	Texture loadTexture(const Image &image, const TextureProperties &properties);
@@ -23,11 +45,40 @@ public:
 	std::unique_ptr<Model> loadModel(const std::unique_ptr<ModelSource> &modelSource);
 	std::unique_ptr<Model> loadModel(const ModelSource &modelSource);
 
+	// Converts and uploads the model on a worker thread. The future becomes ready during
+	// the first update() after the uploads have completed on the GPU.
+	std::shared_future<std::shared_ptr<Model>> loadModelAsync(const std::string &path);
+
 private:
-	Texture loadTexture(const ModelTextureData &texture, VkPhysicalDeviceProperties properties, const ModelSource &modelSource, Image &image);
+	struct PendingModelLoad {
+		std::promise<std::shared_ptr<Model>> promise;
+
+		uint64_t uploadTicket = 0;
+		PreparedModel model;
+	};
+
+	Image createImage(unsigned int width, unsigned int height, ImageFormat format, uint32_t mipLevels = 1);
+	// False for block compressed formats without device support, which are decoded before upload
+	bool canSample(ImageFormat format) const;
+
+	// Gives back everything acquired so far when it throws
+	PreparedModel prepareModel(const ModelSource &modelSource);
+	// For a model that will not be finalized
+	void releasePreparedModel(PreparedModel &model);
+	std::unique_ptr<Model> finalizeModel(PreparedModel &model);
+
+	void loadModelWorker(const std::string &path, std::shared_ptr<PendingModelLoad> load);
+
+	Texture loadTexture(const ModelTextureData &texture, const ModelSource &modelSource);
 
 	Renderer *m_renderer;
 
+	// Async loading
+	ThreadPool m_workers{ ASSET_LOADER_THREAD_COUNT };
+	std::vector<std::future<void>> m_workerTasks;
+	std::vector<std::shared_ptr<PendingModelLoad>> m_submittedLoads;
+	std::mutex m_loadMutex;
+
 	// Default textures
 	Image m_defaultMetallicRoughnessImage;
 	Image m_defaultNormalImage;
@@ -37,4 +88,4 @@ private:
 	Texture m_defaultNormalTexture;
 	Texture m_defaultOcclusionTexture;
 	Texture m_defaultEmissiveTexture;
-};
\ No newline at end of file
+};
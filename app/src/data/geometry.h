@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "data/vertex_layout.h"
+
+
+// Indices are 16 bit and relative to the vertexOffset of their mesh
+typedef uint16_t GeometryIndex;
+#define GEOMETRY_MAX_MESH_VERTICES 65536
+
+// Geometry is stored in streams. Separate vertices spread their attributes over the position, texture coordinate
+// and normal streams under one numbering, packed vertices and indices have a stream each.
+enum class GeometryStream : uint32_t {
+	POSITION,
+	TEXTURE_COORDINATE,
+	NORMAL,
+	PACKED,
+	INDEX,
+	COUNT
+};
+
+constexpr size_t geometryStreamStride(GeometryStream stream) {
+	switch (stream) {
+	case GeometryStream::POSITION: return VertexLayout<VertexFormat::SEPARATE>::bindings[0].stride;
+	case GeometryStream::TEXTURE_COORDINATE: return VertexLayout<VertexFormat::SEPARATE>::bindings[1].stride;
+	case GeometryStream::NORMAL: return VertexLayout<VertexFormat::SEPARATE>::bindings[2].stride;
+	case GeometryStream::PACKED: return VertexLayout<VertexFormat::PACKED>::bindings[0].stride;
+	case GeometryStream::INDEX: return sizeof(GeometryIndex);
+	default: return 0;
+	}
+}
+
+// Element counts of the streams of a model, which are stored back to back in enum order.
+// Meshes address them with vertexOffset and firstIndex, the same way they address the geometry arena once loaded.
+struct GeometryLayout {
+	uint32_t separateVertexCount = 0;
+	uint32_t packedVertexCount = 0;
+	uint32_t indexCount = 0;
+	uint32_t padding = 0;
+
+	uint32_t getElementCount(GeometryStream stream) const {
+		switch (stream) {
+		case GeometryStream::POSITION:
+		case GeometryStream::TEXTURE_COORDINATE:
+		case GeometryStream::NORMAL: return separateVertexCount;
+		case GeometryStream::PACKED: return packedVertexCount;
+		case GeometryStream::INDEX: return indexCount;
+		default: return 0;
+		}
+	}
+
+	size_t getStreamSize(GeometryStream stream) const { return getElementCount(stream) * geometryStreamStride(stream); }
+
+	size_t getStreamOffset(GeometryStream stream) const {
+		size_t offset = 0;
+		for (uint32_t i = 0; i < static_cast<uint32_t>(stream); ++i) {
+			offset += getStreamSize(static_cast<GeometryStream>(i));
+		}
+		return offset;
+	}
+
+	size_t getSize() const { return getStreamOffset(GeometryStream::COUNT); }
+};
@@ -1,6 +1,68 @@
 #include "image.h"
 
+#include <algorithm>
+
+
 void Image::destroy(VkDevice device) {
 	vkDestroyImage(device, m_image, nullptr);
-	vkFreeMemory(device, m_memory, nullptr);
+	if (m_memory) {
+		m_memory.allocator->free(m_memory);
+	}
+}
+
+bool isBlockCompressed(ImageFormat format) {
+	return imageBlockExtent(format) > 1;
+}
+
+bool isSrgb(ImageFormat format) {
+	return format == ImageFormat::SRGB || format == ImageFormat::BC1_SRGB || format == ImageFormat::BC7_SRGB;
+}
+
+uint32_t imageBlockExtent(ImageFormat format) {
+	switch (format) {
+	case ImageFormat::SRGB:
+	case ImageFormat::LINEAR:
+		return 1;
+	default:
+		return 4;
+	}
+}
+
+size_t imageBlockSize(ImageFormat format) {
+	switch (format) {
+	case ImageFormat::BC1_SRGB:
+	case ImageFormat::BC1_LINEAR:
+	case ImageFormat::BC4_LINEAR:
+		return 8;
+	case ImageFormat::BC5_LINEAR:
+	case ImageFormat::BC7_SRGB:
+	case ImageFormat::BC7_LINEAR:
+		return 16;
+	default:
+		return 4;
+	}
+}
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+		++levels;
+	}
+	return levels;
+}
+
+size_t imageLevelSize(ImageFormat format, uint32_t width, uint32_t height, uint32_t level) {
+	// Partial blocks at the edges are stored as whole blocks
+	uint32_t blockExtent = imageBlockExtent(format);
+	size_t blocksWide = (std::max(width >> level, 1u) + blockExtent - 1) / blockExtent;
+	size_t blocksHigh = (std::max(height >> level, 1u) + blockExtent - 1) / blockExtent;
+	return blocksWide * blocksHigh * imageBlockSize(format);
+}
+
+size_t imageChainSize(ImageFormat format, uint32_t width, uint32_t height, uint32_t levels) {
+	size_t size = 0;
+	for (uint32_t level = 0; level < levels; ++level) {
+		size += imageLevelSize(format, width, height, level);
+	}
+	return size;
 }
@@ -2,29 +2,57 @@
 
 #include <glad/vulkan.h>
 
+#include <cstdint>
+#include <cstddef>
+
+#include "graphics/memory.h"
+
 
 enum class ImageFormat {
 	SRGB = VK_FORMAT_R8G8B8A8_SRGB,
-	LINEAR = VK_FORMAT_R8G8B8A8_UNORM
+	LINEAR = VK_FORMAT_R8G8B8A8_UNORM,
+
+	// Block compressed, 4x4 texels per block
+	BC1_SRGB = VK_FORMAT_BC1_RGBA_SRGB_BLOCK,
+	BC1_LINEAR = VK_FORMAT_BC1_RGBA_UNORM_BLOCK,
+	BC4_LINEAR = VK_FORMAT_BC4_UNORM_BLOCK,
+	BC5_LINEAR = VK_FORMAT_BC5_UNORM_BLOCK,
+	BC7_SRGB = VK_FORMAT_BC7_SRGB_BLOCK,
+	BC7_LINEAR = VK_FORMAT_BC7_UNORM_BLOCK
 };
 
+bool isBlockCompressed(ImageFormat format);
+bool isSrgb(ImageFormat format);
+// Width and height of a block in texels, 1 for uncompressed formats
+uint32_t imageBlockExtent(ImageFormat format);
+// Bytes per block, or per texel for uncompressed formats
+size_t imageBlockSize(ImageFormat format);
+
+// Number of levels in a full mip chain down to 1x1
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+// Byte size of one mip level, levels of a chain are stored consecutively starting with the largest
+size_t imageLevelSize(ImageFormat format, uint32_t width, uint32_t height, uint32_t level);
+size_t imageChainSize(ImageFormat format, uint32_t width, uint32_t height, uint32_t levels);
+
 class Image {
 public:
 	Image() {}
-	Image(int width, int height, ImageFormat format, VkImage image, VkDeviceMemory memory)
-		: m_width(width), m_height(height), m_format(format), m_image(image), m_memory(memory) {}
+	Image(int width, int height, ImageFormat format, VkImage image, MemoryAllocation memory, uint32_t mipLevels = 1)
+		: m_width(width), m_height(height), m_format(format), m_mipLevels(mipLevels), m_image(image), m_memory(memory) {}
 
 	void destroy(VkDevice device);
 
 	ImageFormat getFormat() const { return m_format; }
+	uint32_t getMipLevels() const { return m_mipLevels; }
 	VkImage getImage() const { return m_image; }
-	VkDeviceMemory getMemory() const { return m_memory; }
+	const MemoryAllocation &getMemory() const { return m_memory; }
 private:
 	int m_width = -1;
 	int m_height = -1;
 
 	ImageFormat m_format = ImageFormat::SRGB;
+	uint32_t m_mipLevels = 1;
 
 	VkImage m_image = VK_NULL_HANDLE;
-	VkDeviceMemory m_memory = VK_NULL_HANDLE;
+	MemoryAllocation m_memory;
 };
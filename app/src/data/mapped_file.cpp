@@ -0,0 +1,101 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "log.h"
+
+
+#ifdef _WIN32
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path) {
+	std::shared_ptr<MappedFile> file(new MappedFile());
+
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	file->m_file = handle;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+		LOG_ERROR("Unable to map empty or unreadable file: {}", path);
+		return nullptr;
+	}
+	file->m_size = static_cast<size_t>(size.QuadPart);
+
+	file->m_mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!file->m_mapping) {
+		LOG_ERROR("Failed to create file mapping for: {}", path);
+		return nullptr;
+	}
+
+	file->m_data = static_cast<const std::byte *>(MapViewOfFile(file->m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!file->m_data) {
+		LOG_ERROR("Failed to map view of file: {}", path);
+		return nullptr;
+	}
+
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+	}
+	if (m_file) {
+		CloseHandle(m_file);
+	}
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path) {
+	std::shared_ptr<MappedFile> file(new MappedFile());
+
+	file->m_file = ::open(path.c_str(), O_RDONLY);
+	if (file->m_file < 0) {
+		return nullptr;
+	}
+
+	struct stat status;
+	if (fstat(file->m_file, &status) != 0 || status.st_size == 0) {
+		LOG_ERROR("Unable to map empty or unreadable file: {}", path);
+		return nullptr;
+	}
+	file->m_size = static_cast<size_t>(status.st_size);
+
+	void *data = mmap(nullptr, file->m_size, PROT_READ, MAP_PRIVATE, file->m_file, 0);
+	if (data == MAP_FAILED) {
+		LOG_ERROR("Failed to map file: {}", path);
+		return nullptr;
+	}
+	file->m_data = static_cast<const std::byte *>(data);
+
+	// Blobs are streamed front to back into staging memory
+	madvise(data, file->m_size, MADV_SEQUENTIAL);
+
+	return file;
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) {
+		munmap(const_cast<std::byte *>(m_data), m_size);
+	}
+	if (m_file >= 0) {
+		close(m_file);
+	}
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstddef>
+
+
+// Read-only memory mapping of an entire file
+class MappedFile {
+public:
+	static std::shared_ptr<MappedFile> open(const std::string &path);
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile();
+
+	const std::byte *data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	MappedFile() {}
+
+	const std::byte *m_data = nullptr;
+	size_t m_size = 0;
+
+#ifdef _WIN32
+	void *m_file = nullptr;
+	void *m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+};
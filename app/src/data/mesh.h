@@ -1,26 +1,75 @@
 #pragma once
 
 #include <glad/vulkan.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
-#include <array>
 
+#include "data/vertex_layout.h"
+#include "data/geometry.h"
 
-struct Mesh {
-	VkDeviceSize positionStart;
-	VkDeviceSize positionLength;
-	VkDeviceSize textureCoordinateStart;
-	VkDeviceSize textureCoordinateLength;
-	VkDeviceSize normalStart;
-	VkDeviceSize normalLength;
-	VkDeviceSize indexStart;
-	VkDeviceSize indexLength;
 
-	size_t indexCount;
+#define MAX_MESH_LODS 4
+
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error; // Approximate distance to the full detail surface, in model units
+};
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// A cluster of consecutive triangles of the first LOD, culled on its own. Laid out as read by the culling shader.
+struct Meshlet {
+	// Bounding sphere in model units
+	glm::vec3 center;
+	float radius;
+
+	// Normal cone, all triangles face away from viewers inside the cone. A cutoff of 1 disables the test.
+	glm::vec3 coneAxis;
+	float coneCutoff;
+
+	uint32_t firstIndex; // Relative to the first index of the mesh
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+
+static_assert(sizeof(Meshlet) == 48, "Meshlet layout must match the culling shader");
+
+struct Mesh {
+	// Into the vertex streams of the format and the index stream, see GeometryLayout
+	int32_t vertexOffset = 0;
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
 
 	int materialIndex;
 
-	std::array<VkDeviceSize, 3> getVertexOffsets() const { return { positionStart, textureCoordinateStart, normalStart }; }
-	size_t getIndexOffset() const { return indexStart; }
+	// Packed meshes quantize positions to their bounds
+	VertexFormat vertexFormat = VertexFormat::SEPARATE;
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	float positionScale = 1.0f;
+
+	// Bounding box and sphere in model units
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	glm::vec3 boundsCenter = glm::vec3(0.0f);
+	float boundsRadius = 0.0f;
+
+	// Simplified index ranges sharing the vertices of the mesh. Level 0 is the full index range.
+	MeshLod lods[MAX_MESH_LODS] = {};
+	uint32_t lodCount = 1;
+
+	// Range in the meshlet table of the model, empty when the mesh is always drawn whole
+	uint32_t meshletStart = 0;
+	uint32_t meshletCount = 0;
+
+	// Maps quantized positions back to model space. The scale is uniform so normals are unaffected.
+	glm::mat4 getDequantizationMatrix() const {
+		return glm::scale(glm::translate(glm::mat4(1.0f), positionOffset), glm::vec3(positionScale));
+	}
+
+	uint32_t getFirstIndex(uint32_t lod = 0) const { return lod ? lods[lod].firstIndex : firstIndex; }
 
-	size_t getIndexCount() const { return indexCount; }
+	uint32_t getIndexCount(uint32_t lod = 0) const { return lod ? lods[lod].indexCount : indexCount; }
 };
@@ -11,55 +11,40 @@
 #include "data/asset_manager.h"
 
 
-std::array<VkVertexInputBindingDescription, 3> Model::getBindingDescription() {
-	std::array<VkVertexInputBindingDescription, 3>  bindingDescriptions{};
-
-	bindingDescriptions[0].binding = 0;
-	bindingDescriptions[0].stride = sizeof(float) * 3;
-	bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-	bindingDescriptions[1].binding = 1;
-	bindingDescriptions[1].stride = sizeof(float) * 2;
-	bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-	bindingDescriptions[2].binding = 2;
-	bindingDescriptions[2].stride = sizeof(float) * 3;
-	bindingDescriptions[2].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-	return bindingDescriptions;
-}
-
-std::array<VkVertexInputAttributeDescription, 3> Model::getAttributeDescriptions() {
-	std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-	attributeDescriptions[0].binding = 0;
-	attributeDescriptions[0].location = 0;
-	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[0].offset = 0;
-
-	attributeDescriptions[1].binding = 1;
-	attributeDescriptions[1].location = 1;
-	attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
-	attributeDescriptions[1].offset = 0;
-
-	attributeDescriptions[2].binding = 2;
-	attributeDescriptions[2].location = 2;
-	attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescriptions[2].offset = 0;
-
-	return attributeDescriptions;
-}
-
 Model::~Model() {
 	for (auto &material : m_materials) {
+		if (m_materialTable) {
+			m_materialTable->remove(material);
+		}
 		material.destroy(m_device);
 	}
 
-	for (auto &image : m_images) {
-		image.destroy(m_device);
+	if (m_instanceCuller) {
+		m_instanceCuller->unregisterModel(m_instanceRegistration);
 	}
 
-	vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
+	if (m_geometryArena) {
+		m_geometryArena->free(m_geometry);
+	}
+}
 
-	vkFreeMemory(m_device, m_modelMemory, nullptr);
+void Model::computeBounds() {
+	bool empty = true;
+	for (const auto &[nodeIndex, meshCollection] : m_meshes) {
+		const glm::mat4 &nodeMatrix = m_meshMatrices.at(nodeIndex);
+		for (const Mesh &mesh : meshCollection) {
+			// Corners of the mesh box moved into the space of the model
+			for (uint32_t corner = 0; corner < 8; ++corner) {
+				glm::vec3 position(
+					corner & 1 ? mesh.boundsMax.x : mesh.boundsMin.x,
+					corner & 2 ? mesh.boundsMax.y : mesh.boundsMin.y,
+					corner & 4 ? mesh.boundsMax.z : mesh.boundsMin.z);
+				position = glm::vec3(nodeMatrix * glm::vec4(position, 1.0f));
+
+				m_boundsMin = empty ? position : glm::min(m_boundsMin, position);
+				m_boundsMax = empty ? position : glm::max(m_boundsMax, position);
+				empty = false;
+			}
+		}
+	}
 }
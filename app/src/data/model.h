@@ -10,51 +10,70 @@
 #include "data/mesh.h"
 #include "data/model_source.h"
 #include "graphics/renderer.h"
+#include "graphics/geometry_arena.h"
+#include "graphics/instance_culling.h"
 #include "graphics/material.h"
+#include "graphics/material_table.h"
 
 
 class Model {
 public:
-	static std::array<VkVertexInputBindingDescription, 3> getBindingDescription();
-	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions();
-
 	Model() {}
-	Model(VkDeviceMemory modelMemory,
-		VkBuffer vertexBuffer,
+	Model(GeometryArena *geometryArena,
+		GeometryAllocation geometry,
+		InstanceCuller *instanceCuller,
+		InstanceRegistration instanceRegistration,
+		MaterialTable *materialTable,
 		VkDevice device,
 		std::unordered_map<int, std::vector<Mesh>> meshes,
 		std::unordered_map<int, glm::mat4> meshMatrices,
-		std::vector<Image> images,
 		std::vector<Material> materials)
-		: m_modelMemory(modelMemory),
-		m_vertexBuffer(vertexBuffer),
+		: m_geometryArena(geometryArena),
+		m_geometry(geometry),
+		m_instanceCuller(instanceCuller),
+		m_instanceRegistration(std::move(instanceRegistration)),
+		m_materialTable(materialTable),
 		m_device(device),
 		m_meshes(meshes),
 		m_meshMatrices(meshMatrices),
-		m_images(images),
-		m_materials(materials) {}
+		m_materials(materials) {
 
-	~Model(); // TODO: Replace with destroy
+		computeBounds();
+	}
 
-	VkBuffer getVertexBuffer() const { return m_vertexBuffer; }
-	std::array<VkBuffer, 3> getVertexBufferAsArray() const { return { m_vertexBuffer, m_vertexBuffer, m_vertexBuffer }; }
+	~Model(); // TODO: Replace with destroy
 
 	const std::unordered_map<int, std::vector<Mesh>> &getMeshes() const { return m_meshes; }
 	const std::unordered_map<int, glm::mat4> &getMeshMatricies() const { return m_meshMatrices; }
+	const InstanceRegistration &getInstanceRegistration() const { return m_instanceRegistration; }
+
+	// Box around the meshes of all nodes, in model units
+	const glm::vec3 &getBoundsMin() const { return m_boundsMin; }
+	const glm::vec3 &getBoundsMax() const { return m_boundsMax; }
 
 	std::vector<Material> &getMaterials() { return m_materials; }
 	const std::vector<Material> &getMaterials() const { return m_materials; }
 
 private:
-	VkDeviceMemory m_modelMemory = VK_NULL_HANDLE;
-	VkBuffer m_vertexBuffer = VK_NULL_HANDLE;
+	void computeBounds();
+
+	// Meshes address the arena directly
+	GeometryArena *m_geometryArena = nullptr;
+	GeometryAllocation m_geometry;
+	// Meshes as seen by GPU driven rendering
+	InstanceCuller *m_instanceCuller = nullptr;
+	InstanceRegistration m_instanceRegistration;
+	// Parameters of the materials
+	MaterialTable *m_materialTable = nullptr;
 	VkDevice m_device = VK_NULL_HANDLE;
 
 	std::unordered_map<int, std::vector<Mesh>> m_meshes;
 	std::unordered_map<int, glm::mat4> m_meshMatrices;
 
-	std::vector<Image> m_images;
 	std::vector<Material> m_materials;
+
+	glm::vec3 m_boundsMin = glm::vec3(0.0f);
+	glm::vec3 m_boundsMax = glm::vec3(0.0f);
 };
 
 struct ModelComponent {
@@ -4,8 +4,11 @@
 #include <vector>
 #include <unordered_map>
 #include <cstddef>
+#include <cstdint>
 
 #include "data/mesh.h"
+#include "data/geometry.h"
+#include "data/mapped_file.h"
 #include "data/image.h"
 #include "data/texture.h"
 #include "graphics/material.h"
@@ -15,9 +18,15 @@ struct ModelImageData {
 	int width;
 	int height;
 	int bits;
+	ImageFormat format;
+	uint32_t mipLevels;
 
+	// Levels are stored consecutively, size covers the whole chain
 	size_t offset;
 	size_t size;
+
+	// Content hash of the stored data, lets models share identical images
+	uint64_t hash;
 };
 
 struct ModelTextureData {
@@ -38,24 +47,74 @@ struct ModelMaterialData {
 };
 
 
+// Non-owning view of a contiguous byte range
+struct ByteView {
+	const std::byte *start = nullptr;
+	size_t length = 0;
+
+	ByteView() {}
+	ByteView(const std::byte *start, size_t length) : start(start), length(length) {}
+	ByteView(const std::vector<std::byte> &bytes) : start(bytes.data()), length(bytes.size()) {}
+
+	const std::byte *data() const { return start; }
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+
+	const std::byte *begin() const { return start; }
+	const std::byte *end() const { return start + length; }
+};
+
+
 // Stores model data in engine format
 class ModelSource {
 public:
 	ModelSource(
 		std::vector<std::byte> vertexData,
 		std::vector<std::byte> imageData,
+		GeometryLayout geometry,
 		std::unordered_map<int, std::vector<Mesh>> meshes,
 		std::unordered_map<int, glm::mat4> meshMatricies,
+		std::vector<Meshlet> meshlets,
 		std::vector<ModelImageData> images,
 		std::vector<ModelTextureData> textures,
 		std::vector<ModelMaterialData> materials)
-		: m_vertexData(vertexData), m_imageData(imageData),
-		m_meshes(meshes), m_meshMatricies(meshMatricies),
-		m_images(images), m_textures(textures),
-		m_materials(materials) {}
+		: m_vertexData(std::move(vertexData)), m_imageData(std::move(imageData)),
+		m_geometry(geometry),
+		m_meshes(std::move(meshes)), m_meshMatricies(std::move(meshMatricies)),
+		m_meshlets(std::move(meshlets)),
+		m_images(std::move(images)), m_textures(std::move(textures)),
+		m_materials(std::move(materials)) {}
+
+	// Blob data is referenced directly from a mapped cooked model
+	ModelSource(
+		std::shared_ptr<MappedFile> mapping,
+		ByteView vertexData,
+		ByteView imageData,
+		GeometryLayout geometry,
+		std::unordered_map<int, std::vector<Mesh>> meshes,
+		std::unordered_map<int, glm::mat4> meshMatricies,
+		std::vector<Meshlet> meshlets,
+		std::vector<ModelImageData> images,
+		std::vector<ModelTextureData> textures,
+		std::vector<ModelMaterialData> materials)
+		: m_mapping(mapping),
+		m_mappedVertexData(vertexData), m_mappedImageData(imageData),
+		m_geometry(geometry),
+		m_meshes(std::move(meshes)), m_meshMatricies(std::move(meshMatricies)),
+		m_meshlets(std::move(meshlets)),
+		m_images(std::move(images)), m_textures(std::move(textures)),
+		m_materials(std::move(materials)) {}
+
+	ModelSource(const ModelSource &) = delete;
+	ModelSource &operator=(const ModelSource &) = delete;
 
-	const std::vector<std::byte> &getVertexData() const { return m_vertexData; }
-	const std::vector<std::byte> &getImageData() const { return m_imageData; }
+	ByteView getVertexData() const { return m_mapping ? m_mappedVertexData : ByteView(m_vertexData); }
+	ByteView getImageData() const { return m_mapping ? m_mappedImageData : ByteView(m_imageData); }
+
+	bool isMapped() const { return m_mapping != nullptr; }
+
+	// Streams stored in the vertex data
+	const GeometryLayout &getGeometry() const { return m_geometry; }
 
 	const std::vector<ModelImageData> &getImages() const { return m_images; }
 	const std::vector<ModelTextureData> &getTextures() const { return m_textures; }
@@ -63,12 +122,21 @@ public:
 
 	const std::unordered_map<int, std::vector<Mesh>> &getMeshes() const { return m_meshes; }
 	const std::unordered_map<int, glm::mat4> &getMeshMatricies() const { return m_meshMatricies; }
+	// Meshes reference ranges of this table
+	const std::vector<Meshlet> &getMeshlets() const { return m_meshlets; }
 private:
 	std::vector<std::byte> m_vertexData;
 	std::vector<std::byte> m_imageData;
 
+	std::shared_ptr<MappedFile> m_mapping;
+	ByteView m_mappedVertexData;
+	ByteView m_mappedImageData;
+
+	GeometryLayout m_geometry;
+
 	std::unordered_map<int, std::vector<Mesh>> m_meshes;
 	std::unordered_map<int, glm::mat4> m_meshMatricies;
+	std::vector<Meshlet> m_meshlets;
 
 	std::vector<ModelImageData> m_images;
 	std::vector<ModelTextureData> m_textures;
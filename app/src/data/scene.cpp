@@ -1,27 +1,112 @@
 #include "scene.h"
 
 #include "data/model.h"
+#include "log.h"
 
+#include <algorithm>
+
+
+void Entity::setMatrix(const glm::mat4 &matrix) {
+	m_scene->m_registry.patch<TransformComponent>(m_handle, [&](TransformComponent &transform) {
+		transform.matrix = matrix;
+	});
+}
+
+void Entity::setParent(Entity parent) {
+	if (parent.m_handle == getComponent<TransformComponent>().parentEntity) {
+		return;
+	}
+
+	// A parent below the entity would close a loop that the transform and hierarchy walks never leave
+	for (Entity ancestor = parent; ancestor; ancestor = ancestor.getParent()) {
+		if (ancestor.m_handle == m_handle) {
+			LOG_ERROR("Entity can't be parented to itself or one of its descendants");
+			return;
+		}
+	}
+
+	m_scene->unlinkChild(m_handle);
+	m_scene->m_registry.patch<TransformComponent>(m_handle, [&](TransformComponent &transform) {
+		transform.parent = parent ? parent.getComponent<IdentityComponent>().uuid : UUID::None();
+		transform.parentEntity = parent.m_handle;
+	});
+	if (parent) {
+		m_scene->linkChild(parent.m_handle, m_handle);
+	}
+	m_scene->m_hierarchyChanged = true;
+}
+
+Entity Entity::getParent() const {
+	entt::entity parent = getComponent<TransformComponent>().parentEntity;
+	return parent != entt::null ? Entity(parent, m_scene) : Entity();
+}
 
 glm::mat4 Entity::getWorldMatrix() {
-	TransformComponent &transformComponent = getComponent<TransformComponent>();
-	glm::mat4 localMatrix = transformComponent.matrix;
-	UUID parentID = transformComponent.parent;
-	if (parentID.isValid()) {
-		return m_scene->m_entityMap[parentID].getWorldMatrix() * localMatrix;
+	entt::registry &registry = m_scene->m_registry;
+
+	// The cached matrix is stale when the entity or one of its ancestors is dirty. Above the highest dirty
+	// ancestor the cache holds, below it the local matrices are multiplied again.
+	const TransformComponent *transform = &registry.get<TransformComponent>(m_handle);
+	const TransformComponent *highestDirty = nullptr;
+	for (const TransformComponent *current = transform; current;) {
+		if (current->dirty) {
+			highestDirty = current;
+		}
+		current = current->parentEntity != entt::null ? &registry.get<TransformComponent>(current->parentEntity) : nullptr;
+	}
+	if (!highestDirty) {
+		return transform->worldMatrix;
+	}
+
+	glm::mat4 matrix = glm::mat4(1.0f);
+	for (const TransformComponent *current = transform;; current = &registry.get<TransformComponent>(current->parentEntity)) {
+		matrix = current->matrix * matrix;
+		if (current == highestDirty) {
+			break;
+		}
 	}
-	return localMatrix;
+	if (highestDirty->parentEntity != entt::null) {
+		matrix = registry.get<TransformComponent>(highestDirty->parentEntity).worldMatrix * matrix;
+	}
+	return matrix;
 }
 
 glm::mat4 Entity::toLocalMatrix(glm::mat4 matrix) {
 	TransformComponent &transformComponent = getComponent<TransformComponent>();
-	if (!transformComponent.parent.isValid()) {
+	if (transformComponent.parentEntity == entt::null) {
 		return matrix;
 	}
-	return glm::inverse(m_scene->m_entityMap[transformComponent.parent].getWorldMatrix()) * matrix;
+	return glm::inverse(Entity(transformComponent.parentEntity, m_scene).getWorldMatrix()) * matrix;
+}
+
+
+// Axis aligned box around a transformed box (Arvo)
+static void transformBounds(const glm::mat4 &matrix, const glm::vec3 &min, const glm::vec3 &max, glm::vec3 &worldMin, glm::vec3 &worldMax) {
+	glm::vec3 center = glm::vec3(matrix * glm::vec4((min + max) * 0.5f, 1.0f));
+	glm::vec3 extent = (max - min) * 0.5f;
+
+	glm::vec3 worldExtent(0.0f);
+	for (int axis = 0; axis < 3; ++axis) {
+		worldExtent += glm::vec3(std::abs(matrix[axis][0]), std::abs(matrix[axis][1]), std::abs(matrix[axis][2])) * extent[axis];
+	}
+
+	worldMin = center - worldExtent;
+	worldMax = center + worldExtent;
 }
 
 
+Scene::Scene() {
+	m_registry.on_construct<ModelComponent>().connect<&Scene::onModelConstruct>(*this);
+	m_registry.on_destroy<ModelComponent>().connect<&Scene::onModelDestroy>(*this);
+	// Storages are torn down in reverse creation order, the spatial one may go before the model one
+	m_registry.on_destroy<SpatialComponent>().connect<&Scene::onSpatialDestroy>(*this);
+	// A replaced model changes the bounds just like a move
+	m_registry.on_update<ModelComponent>().connect<&Scene::onBoundsUpdate>(*this);
+	m_registry.on_update<TransformComponent>().connect<&Scene::onTransformUpdate>(*this);
+	// Removal swaps the last transform into the gap, which breaks the parent before child order
+	m_registry.on_destroy<TransformComponent>().connect<&Scene::onTransformDestroy>(*this);
+}
+
 Entity Scene::createEntity(const std::string &name) {
 	Entity entity(m_registry.create(), this);
 	entity.addComponent<TransformComponent>();
@@ -36,24 +121,259 @@ void Scene::removeEntity(Entity entity) {
 }
 
 void Scene::removeEntity(UUID id) {
-	for (auto &[uuid, entity] : m_entityMap) {
-		TransformComponent &transform = entity.getComponent<TransformComponent>();
-		if (uuid != id && transform.parent == id) {
-			transform.matrix = entity.getWorldMatrix();;
-			transform.parent = UUID::None();
+	removeEntities({ m_entityMap.at(id) });
+}
+
+void Scene::removeEntities(const std::vector<Entity> &entities) {
+	m_removing.clear();
+	for (const Entity &entity : entities) {
+		m_removing.push_back(entity.m_handle);
+	}
+	std::sort(m_removing.begin(), m_removing.end());
+	m_removing.erase(std::unique(m_removing.begin(), m_removing.end()), m_removing.end());
+
+	// World matrices are read while every ancestor is still alive
+	m_detaching.clear();
+	for (entt::entity removed : m_removing) {
+		Entity(removed, this).forEachChild([&](Entity child) {
+			if (!std::binary_search(m_removing.begin(), m_removing.end(), child.m_handle)) {
+				m_detaching.emplace_back(child, child.getWorldMatrix());
+			}
+		});
+	}
+	for (auto &[child, worldMatrix] : m_detaching) {
+		child.setParent(Entity());
+		child.setMatrix(worldMatrix);
+	}
+
+	// Unlinked before anything is destroyed, so the siblings and parents being touched are still valid
+	for (entt::entity removed : m_removing) {
+		unlinkChild(removed);
+	}
+	for (entt::entity removed : m_removing) {
+		m_entityMap.erase(m_registry.get<IdentityComponent>(removed).uuid);
+		m_registry.destroy(removed);
+	}
+	m_removing.clear();
+	m_detaching.clear();
+}
+
+void Scene::removeEntityTree(Entity entity) {
+	std::vector<Entity> entities = { entity };
+	for (size_t i = 0; i < entities.size(); ++i) {
+		// Walked on a copy, appending may move the entities
+		Entity current = entities[i];
+		current.forEachChild([&](Entity child) {
+			entities.push_back(child);
+		});
+	}
+	removeEntities(entities);
+}
+
+void Scene::setParent(const std::vector<Entity> &entities, Entity parent) {
+	for (Entity entity : entities) {
+		entity.setParent(parent);
+	}
+}
+
+void Scene::linkChild(entt::entity parent, entt::entity child) {
+	TransformComponent &parentTransform = m_registry.get<TransformComponent>(parent);
+	TransformComponent &childTransform = m_registry.get<TransformComponent>(child);
+	childTransform.previousSibling = entt::null;
+	childTransform.nextSibling = parentTransform.firstChild;
+	if (parentTransform.firstChild != entt::null) {
+		m_registry.get<TransformComponent>(parentTransform.firstChild).previousSibling = child;
+	}
+	parentTransform.firstChild = child;
+}
+
+void Scene::unlinkChild(entt::entity child) {
+	TransformComponent &transform = m_registry.get<TransformComponent>(child);
+	if (transform.parentEntity == entt::null) {
+		return;
+	}
+
+	if (transform.previousSibling != entt::null) {
+		m_registry.get<TransformComponent>(transform.previousSibling).nextSibling = transform.nextSibling;
+	}
+	else {
+		m_registry.get<TransformComponent>(transform.parentEntity).firstChild = transform.nextSibling;
+	}
+	if (transform.nextSibling != entt::null) {
+		m_registry.get<TransformComponent>(transform.nextSibling).previousSibling = transform.previousSibling;
+	}
+	transform.previousSibling = entt::null;
+	transform.nextSibling = entt::null;
+}
+
+void Scene::onModelConstruct(entt::registry &registry, entt::entity entity) {
+	registry.get_or_emplace<SpatialComponent>(entity);
+	onBoundsUpdate(registry, entity);
+}
+
+void Scene::onModelDestroy(entt::registry &registry, entt::entity entity) {
+	registry.remove<SpatialComponent>(entity);
+}
+
+void Scene::onSpatialDestroy(entt::registry &registry, entt::entity entity) {
+	SpatialComponent &spatial = registry.get<SpatialComponent>(entity);
+	if (spatial.item != SpatialIndex::INVALID_ITEM) {
+		m_spatialIndex.remove(spatial.item);
+		spatial.item = SpatialIndex::INVALID_ITEM;
+	}
+}
+
+void Scene::onTransformUpdate(entt::registry &registry, entt::entity entity) {
+	registry.get<TransformComponent>(entity).dirty = true;
+}
+
+void Scene::onTransformDestroy(entt::registry &registry, entt::entity entity) {
+	m_hierarchyChanged = true;
+}
+
+void Scene::onBoundsUpdate(entt::registry &registry, entt::entity entity) {
+	SpatialComponent *spatial = registry.try_get<SpatialComponent>(entity);
+	if (spatial && !spatial->dirty) {
+		spatial->dirty = true;
+		m_spatialDirty.push_back(entity);
+	}
+}
+
+void Scene::sortTransforms() {
+	auto transforms = m_registry.view<TransformComponent>();
+	for (auto [entity, transform] : transforms.each()) {
+		transform.depth = UINT32_MAX;
+	}
+
+	// Depths are resolved by walking up to the first ancestor with a known depth
+	std::vector<TransformComponent *> chain;
+	for (auto [entity, transform] : transforms.each()) {
+		TransformComponent *current = &transform;
+		while (current->depth == UINT32_MAX && current->parentEntity != entt::null) {
+			chain.push_back(current);
+			current = &m_registry.get<TransformComponent>(current->parentEntity);
 		}
+		if (current->depth == UINT32_MAX) {
+			current->depth = 0;
+		}
+		uint32_t depth = current->depth;
+		for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+			(*it)->depth = ++depth;
+		}
+		chain.clear();
 	}
-	m_registry.destroy(m_entityMap.at(id).m_handle);
-	m_entityMap.erase(id);
+
+	m_registry.sort<TransformComponent>([](const TransformComponent &a, const TransformComponent &b) {
+		return a.depth < b.depth;
+	});
+}
+
+// A single pass over the storage in depth order. An entity is recomputed when it moved or when its parent was
+// recomputed in this pass, so the cost follows the moved subtrees and the clean ones only cost the check.
+void Scene::updateTransforms() {
+	if (m_hierarchyChanged) {
+		sortTransforms();
+		m_hierarchyChanged = false;
+	}
+
+	++m_transformPass;
+	for (auto [entity, transform] : m_registry.view<TransformComponent>().each()) {
+		const TransformComponent *parent = transform.parentEntity != entt::null ? &m_registry.get<TransformComponent>(transform.parentEntity) : nullptr;
+		if (!transform.dirty && !(parent && parent->updatePass == m_transformPass)) {
+			continue;
+		}
+
+		transform.worldMatrix = parent ? parent->worldMatrix * transform.matrix : transform.matrix;
+		transform.updatePass = m_transformPass;
+		transform.dirty = false;
+		onBoundsUpdate(m_registry, entity);
+	}
+}
+
+// Proportional to the entities changed since the last update
+void Scene::updateSpatialIndex() {
+	for (entt::entity entity : m_spatialDirty) {
+		if (!m_registry.valid(entity) || !m_registry.all_of<SpatialComponent, ModelComponent>(entity)) {
+			continue;
+		}
+
+		SpatialComponent &spatial = m_registry.get<SpatialComponent>(entity);
+		const Model &model = *m_registry.get<ModelComponent>(entity).model;
+		spatial.dirty = false;
+
+		glm::vec3 min, max;
+		transformBounds(m_registry.get<TransformComponent>(entity).worldMatrix, model.getBoundsMin(), model.getBoundsMax(), min, max);
+		if (spatial.item == SpatialIndex::INVALID_ITEM) {
+			spatial.item = m_spatialIndex.insert(entity, min, max);
+		}
+		else {
+			m_spatialIndex.update(spatial.item, min, max);
+		}
+	}
+	m_spatialDirty.clear();
+}
+
+const SpatialIndex &Scene::getSpatialIndex() {
+	updateTransforms();
+	updateSpatialIndex();
+	return m_spatialIndex;
 }
 
 void Scene::render(Renderer &renderer) {
-	auto modelEntities = m_registry.view<TransformComponent, ModelComponent>();
-	for (const auto &[entity, transformComponent, modelComponent] : modelEntities.each()) {
-		renderer.addModelCommand(modelComponent.model.get(), transformComponent.matrix);
+	const ViewUniformData &view = *renderer.getCurrentViewUniformBuffer();
+	glm::vec4 frustumPlanes[6];
+	extractFrustumPlanes(view.proj * view.view, frustumPlanes);
+
+	// Only entities whose cell and bounds intersect the frustum are looked at
+	updateTransforms();
+	updateSpatialIndex();
+	m_visibleEntities.clear();
+	m_spatialIndex.queryFrustum(frustumPlanes, [&](entt::entity entity) {
+		m_visibleEntities.push_back(entity);
+	});
+
+	// World space boxes of their meshes, in the order the renderer walks them
+	m_frustumCuller.clear();
+	for (entt::entity entity : m_visibleEntities) {
+		const TransformComponent &transformComponent = m_registry.get<TransformComponent>(entity);
+		const Model &model = *m_registry.get<ModelComponent>(entity).model;
+		for (const auto &[nodeIndex, meshCollection] : model.getMeshes()) {
+			glm::mat4 meshMatrix = transformComponent.worldMatrix * model.getMeshMatricies().at(nodeIndex);
+			for (const Mesh &mesh : meshCollection) {
+				m_frustumCuller.addBox(meshMatrix, mesh.boundsMin, mesh.boundsMax);
+			}
+		}
+	}
+
+	m_frustumCuller.cull(frustumPlanes, m_meshVisibility);
+
+	m_cullingStats.testedMeshes = static_cast<uint32_t>(m_meshVisibility.size());
+	m_cullingStats.visibleMeshes = 0;
+
+	size_t firstMesh = 0;
+	for (entt::entity entity : m_visibleEntities) {
+		const TransformComponent &transformComponent = m_registry.get<TransformComponent>(entity);
+		const Model *model = m_registry.get<ModelComponent>(entity).model.get();
+
+		size_t meshCount = 0;
+		uint32_t visibleCount = 0;
+		for (const auto &[nodeIndex, meshCollection] : model->getMeshes()) {
+			for (size_t i = 0; i < meshCollection.size(); ++i) {
+				visibleCount += m_meshVisibility[firstMesh + meshCount++];
+			}
+		}
+
+		if (visibleCount) {
+			renderer.addModelCommand(model, transformComponent.worldMatrix, &m_meshVisibility[firstMesh]);
+		}
+		m_cullingStats.visibleMeshes += visibleCount;
+		firstMesh += meshCount;
 	}
 }
 
 void Scene::destroy() {
 	m_registry.clear();
+	m_entityMap.clear();
+	m_spatialIndex.clear();
+	m_spatialDirty.clear();
 }
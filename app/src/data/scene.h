@@ -5,6 +5,8 @@
 
 #include "uuid.h"
 #include "graphics/renderer.h"
+#include "graphics/frustum_culling.h"
+#include "data/spatial_index.h"
 
 
 class Scene;
@@ -45,6 +47,17 @@ public:
 		return !(*this == other);
 	}
 
+	// Moves the entity through the registry, so the world matrices and the spatial index see the change
+	void setMatrix(const glm::mat4 &matrix);
+	// Keeps the local matrix, an empty entity detaches it. Parents below the entity are rejected.
+	void setParent(Entity parent);
+	Entity getParent() const;
+
+	// Visits the direct children, which must not be reparented or removed by the callback
+	template<typename Callback>
+	void forEachChild(Callback &&callback) const;
+
+	// Cached by Scene::updateTransforms, only recomputed here when the entity moved since
 	glm::mat4 getWorldMatrix();
 	glm::mat4 toLocalMatrix(glm::mat4 matrix);
 
@@ -57,19 +70,68 @@ private:
 
 class Scene {
 public:
+	Scene();
+
 	Entity createEntity(const std::string &name = "Entity");
+	// Children of removed entities that are not removed themselves are detached and keep their world matrix.
+	// Batches cost the removed entities and their direct children, independent of the scene size.
 	void removeEntity(Entity entity);
 	void removeEntity(UUID id);
+	void removeEntities(const std::vector<Entity> &entities);
+	// Removes the entity with all of its descendants
+	void removeEntityTree(Entity entity);
+
+	// Keeps the local matrices of the entities
+	void setParent(const std::vector<Entity> &entities, Entity parent);
 
+	// Refreshes the world matrices of the entities moved since the last update and of their descendants
+	void updateTransforms();
+
+	// Meshes outside the view frustum are not submitted
 	void render(Renderer& renderer);
+	const CullingStats &getCullingStats() const { return m_cullingStats; }
+
+	// Entities with a model by their world bounds, for visibility, proximity and picking queries
+	const SpatialIndex &getSpatialIndex();
 
 	void destroy();
 private:
 	friend Entity;
 
+	// Moved and new models are reinserted before the next query
+	void updateSpatialIndex();
+	void onModelConstruct(entt::registry &registry, entt::entity entity);
+	void onModelDestroy(entt::registry &registry, entt::entity entity);
+	// Removes the entity from the spatial index, whether the model or the whole entity goes away
+	void onSpatialDestroy(entt::registry &registry, entt::entity entity);
+	void onBoundsUpdate(entt::registry &registry, entt::entity entity);
+	void onTransformUpdate(entt::registry &registry, entt::entity entity);
+	void onTransformDestroy(entt::registry &registry, entt::entity entity);
+	// Maintain the child lists, both ends need to be alive
+	void linkChild(entt::entity parent, entt::entity child);
+	void unlinkChild(entt::entity child);
+	// Orders the transform storage by depth, so parents are visited before their children
+	void sortTransforms();
+
 	UUID m_uuid;
 	entt::registry m_registry;
 	std::unordered_map<UUID, Entity> m_entityMap;
+
+	bool m_hierarchyChanged = false;
+	uint32_t m_transformPass = 0;
+
+	// Reused between removals
+	std::vector<entt::entity> m_removing;
+	std::vector<std::pair<Entity, glm::mat4>> m_detaching;
+
+	SpatialIndex m_spatialIndex;
+	std::vector<entt::entity> m_spatialDirty;
+
+	// Reused between frames
+	std::vector<entt::entity> m_visibleEntities;
+	FrustumCuller m_frustumCuller;
+	std::vector<uint8_t> m_meshVisibility;
+	CullingStats m_cullingStats;
 };
 
 struct IdentityComponent {
@@ -78,8 +140,35 @@ struct IdentityComponent {
 	std::vector<uint64_t> tags = {};
 };
 
+// The matrix is relative to the parent. Changes need to go through Entity::setMatrix and Entity::setParent
+// (or a registry patch of the matrix) to reach the world matrix and the spatial index.
 struct TransformComponent {
 	glm::mat4 matrix = glm::mat4(1.0f);
 	UUID parent = UUID::None();
+
+	glm::mat4 worldMatrix = glm::mat4(1.0f);
+	entt::entity parentEntity = entt::null;
+	// Children of the parent form a doubly linked list, so they are found and unlinked without a scene scan
+	entt::entity firstChild = entt::null;
+	entt::entity previousSibling = entt::null;
+	entt::entity nextSibling = entt::null;
+	uint32_t depth = 0;
+	uint32_t updatePass = 0; // Last pass of Scene::updateTransforms that recomputed the world matrix
+	bool dirty = true;
 };
 
+// Entry of an entity with a model in the spatial index of its scene
+struct SpatialComponent {
+	uint32_t item = SpatialIndex::INVALID_ITEM;
+	bool dirty = false;
+};
+
+template<typename Callback>
+void Entity::forEachChild(Callback &&callback) const {
+	entt::registry &registry = m_scene->m_registry;
+	for (entt::entity child = registry.get<TransformComponent>(m_handle).firstChild; child != entt::null;) {
+		entt::entity next = registry.get<TransformComponent>(child).nextSibling;
+		callback(Entity(child, m_scene));
+		child = next;
+	}
+}
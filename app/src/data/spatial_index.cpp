@@ -0,0 +1,156 @@
+#include "spatial_index.h"
+
+
+SpatialIndex::SpatialIndex() {
+	clear();
+}
+
+uint32_t SpatialIndex::insert(entt::entity entity, const glm::vec3 &min, const glm::vec3 &max) {
+	uint32_t item;
+	if (!m_freeItems.empty()) {
+		item = m_freeItems.back();
+		m_freeItems.pop_back();
+	}
+	else {
+		item = static_cast<uint32_t>(m_items.size());
+		m_items.emplace_back();
+	}
+
+	m_items[item].entity = entity;
+	m_items[item].min = min;
+	m_items[item].max = max;
+	link(item, findNode(min, max));
+	return item;
+}
+
+void SpatialIndex::update(uint32_t item, const glm::vec3 &min, const glm::vec3 &max) {
+	Item &current = m_items[item];
+	current.min = min;
+	current.max = max;
+
+	uint32_t node = findNode(min, max);
+	if (node == current.node) {
+		return;
+	}
+
+	uint32_t previous = current.node;
+	unlink(item);
+	link(item, node);
+	prune(previous);
+}
+
+void SpatialIndex::remove(uint32_t item) {
+	uint32_t node = m_items[item].node;
+	unlink(item);
+	prune(node);
+
+	m_items[item].entity = entt::null;
+	m_freeItems.push_back(item);
+}
+
+void SpatialIndex::clear() {
+	m_items.clear();
+	m_freeItems.clear();
+	m_nodes.clear();
+	m_freeNodes.clear();
+	m_outside.clear();
+
+	Node root;
+	root.halfSize = SPATIAL_INDEX_WORLD_HALF_SIZE;
+	m_nodes.push_back(root);
+}
+
+// Slab test, the distance is clamped to the origin when it lies inside the box
+bool SpatialIndex::intersectRay(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance,
+	const glm::vec3 &center, const glm::vec3 &extent, float &distance) {
+
+	glm::vec3 first = (center - extent - origin) * inverseDirection;
+	glm::vec3 second = (center + extent - origin) * inverseDirection;
+	glm::vec3 lower = glm::min(first, second);
+	glm::vec3 upper = glm::max(first, second);
+
+	float enter = std::max({ lower.x, lower.y, lower.z, 0.0f });
+	float exit = std::min({ upper.x, upper.y, upper.z, maxDistance });
+	distance = enter;
+	return enter <= exit;
+}
+
+uint32_t SpatialIndex::findNode(const glm::vec3 &min, const glm::vec3 &max) {
+	glm::vec3 center = (min + max) * 0.5f;
+	float extent = std::max({ max.x - min.x, max.y - min.y, max.z - min.z }) * 0.5f;
+
+	glm::vec3 offset = glm::abs(center);
+	if (std::max({ offset.x, offset.y, offset.z }) > SPATIAL_INDEX_WORLD_HALF_SIZE || extent > SPATIAL_INDEX_WORLD_HALF_SIZE) {
+		return INVALID_NODE;
+	}
+
+	// An item fits the loose cell of the octant holding its center as long as it is no larger than the octant
+	uint32_t node = 0;
+	for (uint32_t depth = 0; depth < SPATIAL_INDEX_MAX_DEPTH; ++depth) {
+		float childHalfSize = m_nodes[node].halfSize * 0.5f;
+		if (extent > childHalfSize) {
+			break;
+		}
+
+		glm::vec3 nodeCenter = m_nodes[node].center;
+		uint32_t octant = (center.x >= nodeCenter.x ? 1 : 0) | (center.y >= nodeCenter.y ? 2 : 0) | (center.z >= nodeCenter.z ? 4 : 0);
+		uint32_t child = m_nodes[node].children[octant];
+
+		if (child == INVALID_NODE) {
+			Node created;
+			created.center = nodeCenter + glm::vec3(
+				octant & 1 ? childHalfSize : -childHalfSize,
+				octant & 2 ? childHalfSize : -childHalfSize,
+				octant & 4 ? childHalfSize : -childHalfSize);
+			created.halfSize = childHalfSize;
+			created.parent = node;
+
+			if (!m_freeNodes.empty()) {
+				child = m_freeNodes.back();
+				m_freeNodes.pop_back();
+				m_nodes[child] = std::move(created);
+			}
+			else {
+				child = static_cast<uint32_t>(m_nodes.size());
+				m_nodes.push_back(std::move(created));
+			}
+			m_nodes[node].children[octant] = child;
+			++m_nodes[node].childCount;
+		}
+		node = child;
+	}
+	return node;
+}
+
+void SpatialIndex::link(uint32_t item, uint32_t node) {
+	std::vector<uint32_t> &items = node == INVALID_NODE ? m_outside : m_nodes[node].items;
+	m_items[item].node = node;
+	m_items[item].slot = static_cast<uint32_t>(items.size());
+	items.push_back(item);
+}
+
+void SpatialIndex::unlink(uint32_t item) {
+	uint32_t node = m_items[item].node;
+	std::vector<uint32_t> &items = node == INVALID_NODE ? m_outside : m_nodes[node].items;
+
+	// Swap with the last item of the cell so removal stays constant time
+	uint32_t slot = m_items[item].slot;
+	items[slot] = items.back();
+	m_items[items[slot]].slot = slot;
+	items.pop_back();
+}
+
+void SpatialIndex::prune(uint32_t node) {
+	while (node != INVALID_NODE && node != 0 && m_nodes[node].items.empty() && m_nodes[node].childCount == 0) {
+		uint32_t parent = m_nodes[node].parent;
+		for (uint32_t &child : m_nodes[parent].children) {
+			if (child == node) {
+				child = INVALID_NODE;
+			}
+		}
+		--m_nodes[parent].childCount;
+		m_nodes[node].parent = INVALID_NODE;
+		m_freeNodes.push_back(node);
+		node = parent;
+	}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <entt/entt.hpp>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+
+// Extent of the root cell, items outside it are kept in a list that every query scans
+#define SPATIAL_INDEX_WORLD_HALF_SIZE 4096.0f
+#define SPATIAL_INDEX_MAX_DEPTH 10
+
+// Loose octree over world space bounding boxes. Cells are twice the size of their tight octant, so an item only
+// depends on its center and size and can move within its octant without being relinked. Items are stored
+// in the deepest cell their size allows, updates that stay in the same cell only rewrite the bounds.
+class SpatialIndex {
+public:
+	static const uint32_t INVALID_ITEM = UINT32_MAX;
+
+	SpatialIndex();
+
+	uint32_t insert(entt::entity entity, const glm::vec3 &min, const glm::vec3 &max);
+	void update(uint32_t item, const glm::vec3 &min, const glm::vec3 &max);
+	void remove(uint32_t item);
+	void clear();
+
+	size_t size() const { return m_items.size() - m_freeItems.size(); }
+
+	// Callbacks receive every entity whose box passes the test, in no particular order
+	template<typename Callback>
+	void queryFrustum(const glm::vec4 planes[6], Callback &&callback) const {
+		query([&](const glm::vec3 &center, const glm::vec3 &extent) {
+			for (int i = 0; i < 6; ++i) {
+				const glm::vec4 &plane = planes[i];
+				float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+				float radius = std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z;
+				if (distance + radius < 0.0f) {
+					return false;
+				}
+			}
+			return true;
+		}, [&](const Item &item) { callback(item.entity); });
+	}
+
+	template<typename Callback>
+	void queryBox(const glm::vec3 &min, const glm::vec3 &max, Callback &&callback) const {
+		glm::vec3 queryCenter = (min + max) * 0.5f;
+		glm::vec3 queryExtent = (max - min) * 0.5f;
+		query([&](const glm::vec3 &center, const glm::vec3 &extent) {
+			return std::abs(center.x - queryCenter.x) <= extent.x + queryExtent.x
+				&& std::abs(center.y - queryCenter.y) <= extent.y + queryExtent.y
+				&& std::abs(center.z - queryCenter.z) <= extent.z + queryExtent.z;
+		}, [&](const Item &item) { callback(item.entity); });
+	}
+
+	template<typename Callback>
+	void querySphere(const glm::vec3 &sphereCenter, float radius, Callback &&callback) const {
+		query([&](const glm::vec3 &center, const glm::vec3 &extent) {
+			glm::vec3 offset = glm::max(glm::abs(sphereCenter - center) - extent, glm::vec3(0.0f));
+			return glm::dot(offset, offset) <= radius * radius;
+		}, [&](const Item &item) { callback(item.entity); });
+	}
+
+	// Callbacks also receive the distance along the ray to the entry point of the box
+	template<typename Callback>
+	void queryRay(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, Callback &&callback) const {
+		glm::vec3 inverseDirection = 1.0f / direction;
+		float distance = 0.0f;
+		auto intersects = [&](const glm::vec3 &center, const glm::vec3 &extent) {
+			return intersectRay(origin, inverseDirection, maxDistance, center, extent, distance);
+		};
+		query(intersects, [&](const Item &item) {
+			intersects((item.min + item.max) * 0.5f, (item.max - item.min) * 0.5f);
+			callback(item.entity, distance);
+		});
+	}
+
+private:
+	static const uint32_t INVALID_NODE = UINT32_MAX;
+
+	struct Item {
+		entt::entity entity = entt::null;
+		glm::vec3 min = glm::vec3(0.0f);
+		glm::vec3 max = glm::vec3(0.0f);
+		uint32_t node = INVALID_NODE; // INVALID_NODE for items outside the root
+		uint32_t slot = 0; // In the item list of the node
+	};
+
+	struct Node {
+		glm::vec3 center = glm::vec3(0.0f);
+		float halfSize = 0.0f; // Of the tight octant, the loose cell is twice as large
+		uint32_t parent = INVALID_NODE;
+		uint32_t children[8] = { INVALID_NODE, INVALID_NODE, INVALID_NODE, INVALID_NODE, INVALID_NODE, INVALID_NODE, INVALID_NODE, INVALID_NODE };
+		uint32_t childCount = 0;
+		std::vector<uint32_t> items;
+	};
+
+	static bool intersectRay(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance,
+		const glm::vec3 &center, const glm::vec3 &extent, float &distance);
+
+	// Cell an item of these bounds belongs to, created on demand
+	uint32_t findNode(const glm::vec3 &min, const glm::vec3 &max);
+	void link(uint32_t item, uint32_t node);
+	void unlink(uint32_t item);
+	// Releases empty leaves up to the root
+	void prune(uint32_t node);
+
+	template<typename Test, typename Visit>
+	void query(const Test &test, const Visit &visit) const {
+		for (uint32_t itemIndex : m_outside) {
+			testItem(m_items[itemIndex], test, visit);
+		}
+
+		m_stack.clear();
+		m_stack.push_back(0);
+		while (!m_stack.empty()) {
+			const Node &node = m_nodes[m_stack.back()];
+			m_stack.pop_back();
+			if (!test(node.center, glm::vec3(node.halfSize * 2.0f))) {
+				continue;
+			}
+
+			for (uint32_t itemIndex : node.items) {
+				testItem(m_items[itemIndex], test, visit);
+			}
+			if (node.childCount) {
+				for (uint32_t child : node.children) {
+					if (child != INVALID_NODE) {
+						m_stack.push_back(child);
+					}
+				}
+			}
+		}
+	}
+
+	template<typename Test, typename Visit>
+	static void testItem(const Item &item, const Test &test, const Visit &visit) {
+		if (test((item.min + item.max) * 0.5f, (item.max - item.min) * 0.5f)) {
+			visit(item);
+		}
+	}
+
+	std::vector<Item> m_items;
+	std::vector<uint32_t> m_freeItems;
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_freeNodes;
+	std::vector<uint32_t> m_outside;
+
+	// Traversal stack reused between queries
+	mutable std::vector<uint32_t> m_stack;
+};
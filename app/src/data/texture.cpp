@@ -1,6 +1,13 @@
 #include "texture.h"
 
+#include "data/texture_cache.h"
+
 void Texture::destroy(VkDevice device) {
+	if (m_cache) {
+		m_cache->release(*this);
+		return;
+	}
+
 	vkDestroyImageView(device, m_view, nullptr);
 	vkDestroySampler(device, m_sampler, nullptr);
 }
@@ -2,6 +2,9 @@
 
 #include <glad/vulkan.h>
 
+#include <optional>
+#include <cstdint>
+
 
 struct TextureProperties {
 	VkFilter mag = VK_FILTER_LINEAR;
@@ -9,26 +12,40 @@ struct TextureProperties {
 	VkSamplerAddressMode wrapU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	VkSamplerAddressMode wrapV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	VkSamplerAddressMode wrapW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	VkSamplerMipmapMode mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	float maxLod = VK_LOD_CLAMP_NONE;
 };
 
+class TextureCache;
+
 class Texture {
 public:
 	Texture() {}
 	Texture(TextureProperties properties, VkImageView view, VkSampler sampler)
 		: m_properties(properties), m_view(view), m_sampler(sampler) {}
+	Texture(TextureProperties properties, VkImageView view, VkSampler sampler, TextureCache *cache, std::optional<uint64_t> imageKey)
+		: m_properties(properties), m_view(view), m_sampler(sampler), m_cache(cache), m_imageKey(imageKey) {}
 
+	// Textures from a TextureCache give their references back instead
 	void destroy(VkDevice device);
 
 	void setDefault(bool state) { m_default = state; }
 	bool isDefault() const { return m_default; }
 
+	const TextureProperties &getProperties() const { return m_properties; }
 	VkImageView getView() const { return m_view; }
 	VkSampler getSampler() const { return m_sampler; }
+
+	// Set when the image and view belong to a cache entry rather than the texture
+	const std::optional<uint64_t> &getImageKey() const { return m_imageKey; }
 private:
 	TextureProperties m_properties{};
 
 	VkImageView m_view = VK_NULL_HANDLE;
 	VkSampler m_sampler = VK_NULL_HANDLE;
 
+	TextureCache *m_cache = nullptr;
+	std::optional<uint64_t> m_imageKey;
+
 	bool m_default = false;
 };
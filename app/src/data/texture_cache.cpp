@@ -0,0 +1,218 @@
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "hash.h"
+#include "log.h"
+
+
+bool TextureCache::SamplerKey::operator==(const SamplerKey &other) const {
+	return properties.mag == other.properties.mag
+		&& properties.min == other.properties.min
+		&& properties.wrapU == other.properties.wrapU
+		&& properties.wrapV == other.properties.wrapV
+		&& properties.wrapW == other.properties.wrapW
+		&& properties.mipmapMode == other.properties.mipmapMode
+		&& maxLod == other.maxLod;
+}
+
+size_t TextureCache::SamplerKeyHash::operator()(const SamplerKey &key) const {
+	uint64_t hash = key.properties.mag;
+	hash = hashCombine(hash, key.properties.min);
+	hash = hashCombine(hash, key.properties.wrapU);
+	hash = hashCombine(hash, key.properties.wrapV);
+	hash = hashCombine(hash, key.properties.wrapW);
+	hash = hashCombine(hash, key.properties.mipmapMode);
+	hash = hashCombine(hash, static_cast<uint64_t>(key.maxLod * 256.0f));
+	return static_cast<size_t>(hash);
+}
+
+uint64_t TextureCache::makeImageKey(uint64_t contentHash, ImageFormat format, uint32_t width, uint32_t height, uint32_t mipLevels) {
+	uint64_t key = hashCombine(contentHash, static_cast<uint64_t>(format));
+	key = hashCombine(key, width);
+	key = hashCombine(key, height);
+	return hashCombine(key, mipLevels);
+}
+
+void TextureCache::init(const Device &device) {
+	m_device = device.getLogicalDevice();
+
+	VkPhysicalDeviceProperties physicalProperties{};
+	vkGetPhysicalDeviceProperties(device.getPhysicalDevice(), &physicalProperties);
+	m_maxAnisotropy = physicalProperties.limits.maxSamplerAnisotropy;
+}
+
+void TextureCache::destroy() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_images.empty() || !m_samplerEntries.empty()) {
+		LOG_WARN("Texture cache destroyed with {} images and {} samplers still referenced", m_images.size(), m_samplerEntries.size());
+	}
+
+	for (auto &[key, entry] : m_images) {
+		vkDestroyImageView(m_device, entry.view, nullptr);
+		entry.image.destroy(m_device);
+	}
+	for (auto &[sampler, entry] : m_samplerEntries) {
+		vkDestroySampler(m_device, sampler, nullptr);
+	}
+
+	m_images.clear();
+	m_samplers.clear();
+	m_samplerEntries.clear();
+}
+
+Texture TextureCache::acquire(uint64_t imageKey, const TextureProperties &properties, const std::function<Image()> &createImage) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_imageCreated.wait(lock, [&]() { return m_pendingImages.count(imageKey) == 0; });
+
+	auto found = m_images.find(imageKey);
+	if (found != m_images.end()) {
+		++found->second.references;
+		return Texture(properties, found->second.view, acquireSampler(properties, found->second.image.getMipLevels()), this, imageKey);
+	}
+
+	// Creation records uploads, which must not block other threads using the cache
+	m_pendingImages.insert(imageKey);
+	lock.unlock();
+
+	Image image;
+	VkImageView view = VK_NULL_HANDLE;
+	try {
+		image = createImage();
+		view = createImageView(image);
+	}
+	catch (...) {
+		if (image.getImage()) {
+			image.destroy(m_device);
+		}
+
+		lock.lock();
+		m_pendingImages.erase(imageKey);
+		lock.unlock();
+		m_imageCreated.notify_all();
+		throw;
+	}
+
+	lock.lock();
+	m_pendingImages.erase(imageKey);
+	m_images[imageKey] = ImageEntry{ image, view, 1 };
+	Texture texture(properties, view, acquireSampler(properties, image.getMipLevels()), this, imageKey);
+	lock.unlock();
+
+	m_imageCreated.notify_all();
+	return texture;
+}
+
+Texture TextureCache::createTexture(const Image &image, const TextureProperties &properties) {
+	VkImageView view = createImageView(image);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return Texture(properties, view, acquireSampler(properties, image.getMipLevels()), this, std::nullopt);
+}
+
+void TextureCache::release(const Texture &texture) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	releaseSampler(texture.getSampler());
+
+	if (!texture.getImageKey()) {
+		vkDestroyImageView(m_device, texture.getView(), nullptr);
+		return;
+	}
+
+	auto found = m_images.find(*texture.getImageKey());
+	if (found == m_images.end()) {
+		LOG_ERROR("Released texture is not part of the texture cache");
+		return;
+	}
+
+	if (--found->second.references == 0) {
+		vkDestroyImageView(m_device, found->second.view, nullptr);
+		found->second.image.destroy(m_device);
+		m_images.erase(found);
+	}
+}
+
+void TextureCache::logStats() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	uint32_t references = 0;
+	for (const auto &[key, entry] : m_images) {
+		references += entry.references;
+	}
+	LOG_INFO("Texture cache: {} images for {} textures, {} samplers", m_images.size(), references, m_samplerEntries.size());
+}
+
+VkImageView TextureCache::createImageView(const Image &image) const {
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image.getImage();
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = static_cast<VkFormat>(image.getFormat());
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = image.getMipLevels();
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	VkImageView imageView;
+	if (vkCreateImageView(m_device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create texture image view");
+		throw std::runtime_error("Failed to create texture image view");
+	}
+	return imageView;
+}
+
+VkSampler TextureCache::acquireSampler(const TextureProperties &properties, uint32_t mipLevels) {
+	SamplerKey key{ properties, std::min(properties.maxLod, static_cast<float>(mipLevels)) };
+
+	auto found = m_samplers.find(key);
+	if (found != m_samplers.end()) {
+		++m_samplerEntries[found->second].references;
+		return found->second;
+	}
+
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = properties.mag;
+	samplerInfo.minFilter = properties.min;
+	samplerInfo.addressModeU = properties.wrapU;
+	samplerInfo.addressModeV = properties.wrapV;
+	samplerInfo.addressModeW = properties.wrapW;
+	samplerInfo.anisotropyEnable = VK_TRUE;
+	samplerInfo.maxAnisotropy = m_maxAnisotropy;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipmapMode = properties.mipmapMode;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = key.maxLod;
+
+	VkSampler sampler;
+	if (vkCreateSampler(m_device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create texture sampler");
+		throw std::runtime_error("Failed to create texture sampler");
+	}
+
+	m_samplers[key] = sampler;
+	m_samplerEntries[sampler] = SamplerEntry{ key, 1 };
+	return sampler;
+}
+
+void TextureCache::releaseSampler(VkSampler sampler) {
+	auto found = m_samplerEntries.find(sampler);
+	if (found == m_samplerEntries.end()) {
+		LOG_ERROR("Released sampler is not part of the texture cache");
+		return;
+	}
+
+	if (--found->second.references == 0) {
+		m_samplers.erase(found->second.key);
+		vkDestroySampler(m_device, sampler, nullptr);
+		m_samplerEntries.erase(found);
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glad/vulkan.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "data/image.h"
+#include "data/texture.h"
+#include "graphics/device.h"
+
+
+// Shares images and samplers between textures. Images are keyed by a content hash together with their format
+// and extent, so a texture referenced by many materials or models is uploaded once. Samplers are keyed by their sampling state.
+// Both are reference counted, every texture handed out holds one reference until Texture::destroy.
+// All functions are thread safe.
+class TextureCache {
+public:
+	void init(const Device &device);
+	void destroy();
+
+	// Key of an image, equal contents stored in another format or at another size are different images
+	static uint64_t makeImageKey(uint64_t contentHash, ImageFormat format, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+	// Returns a texture for the image cached under imageKey, calling createImage to make it on a miss.
+	// The cache owns images it creates.
+	Texture acquire(uint64_t imageKey, const TextureProperties &properties, const std::function<Image()> &createImage);
+	// Creates a texture for an image owned by the caller, only the sampler is shared
+	Texture createTexture(const Image &image, const TextureProperties &properties);
+
+	void release(const Texture &texture);
+
+	void logStats() const;
+
+private:
+	struct ImageEntry {
+		Image image;
+		VkImageView view = VK_NULL_HANDLE;
+		uint32_t references = 0;
+	};
+
+	struct SamplerKey {
+		TextureProperties properties;
+		float maxLod; // Clamped to the image's mip count
+
+		bool operator==(const SamplerKey &other) const;
+	};
+
+	struct SamplerKeyHash {
+		size_t operator()(const SamplerKey &key) const;
+	};
+
+	struct SamplerEntry {
+		SamplerKey key;
+		uint32_t references = 0;
+	};
+
+	VkImageView createImageView(const Image &image) const;
+	// Expect m_mutex to be held
+	VkSampler acquireSampler(const TextureProperties &properties, uint32_t mipLevels);
+	void releaseSampler(VkSampler sampler);
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	float m_maxAnisotropy = 1.0f;
+
+	std::unordered_map<uint64_t, ImageEntry> m_images;
+	std::unordered_map<SamplerKey, VkSampler, SamplerKeyHash> m_samplers;
+	std::unordered_map<VkSampler, SamplerEntry> m_samplerEntries;
+
+	// Images being created outside the lock, loads of the same image wait for them instead of uploading it twice
+	std::unordered_set<uint64_t> m_pendingImages;
+	std::condition_variable m_imageCreated;
+
+	mutable std::mutex m_mutex;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glad/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+
+// How the vertices of a mesh are stored in the vertex buffer
+enum class VertexFormat : uint32_t {
+	SEPARATE, // Position, texture coordinate and normal streams of 32 bit floats
+	PACKED    // Interleaved PackedVertex records
+};
+
+// 16 bytes per vertex. Positions are quantized to the bounds of their mesh, the mesh
+// stores the transform back to model space. Normals are octahedral encoded.
+struct PackedVertex {
+	int16_t position[4];
+	uint16_t textureCoordinate[2]; // Half floats
+	int16_t normal[2];
+};
+
+static_assert(sizeof(PackedVertex) == 16, "PackedVertex must stay 16 bytes");
+
+// Describes the vertex input of a format, used by the pipeline for its input state and by the converter for packing
+template<VertexFormat Format>
+struct VertexLayout;
+
+template<>
+struct VertexLayout<VertexFormat::SEPARATE> {
+	static constexpr std::array<VkVertexInputBindingDescription, 3> bindings = { {
+		{ 0, sizeof(float) * 3, VK_VERTEX_INPUT_RATE_VERTEX },
+		{ 1, sizeof(float) * 2, VK_VERTEX_INPUT_RATE_VERTEX },
+		{ 2, sizeof(float) * 3, VK_VERTEX_INPUT_RATE_VERTEX }
+	} };
+
+	static constexpr std::array<VkVertexInputAttributeDescription, 3> attributes = { {
+		{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 },
+		{ 1, 1, VK_FORMAT_R32G32_SFLOAT, 0 },
+		{ 2, 2, VK_FORMAT_R32G32B32_SFLOAT, 0 }
+	} };
+
+	static constexpr bool octahedralNormals = false;
+};
+
+template<>
+struct VertexLayout<VertexFormat::PACKED> {
+	using Vertex = PackedVertex;
+
+	static constexpr std::array<VkVertexInputBindingDescription, 1> bindings = { {
+		{ 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX }
+	} };
+
+	static constexpr std::array<VkVertexInputAttributeDescription, 3> attributes = { {
+		{ 0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(Vertex, position) },
+		{ 1, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(Vertex, textureCoordinate) },
+		{ 2, 0, VK_FORMAT_R16G16_SNORM, offsetof(Vertex, normal) }
+	} };
+
+	static constexpr bool octahedralNormals = true;
+};
+
+template<VertexFormat Format>
+constexpr uint32_t vertexBindingCount() { return static_cast<uint32_t>(VertexLayout<Format>::bindings.size()); }
+
+inline uint32_t vertexBindingCount(VertexFormat format) {
+	return format == VertexFormat::PACKED
+		? vertexBindingCount<VertexFormat::PACKED>()
+		: vertexBindingCount<VertexFormat::SEPARATE>();
+}
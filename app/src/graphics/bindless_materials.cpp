@@ -0,0 +1,182 @@
+#include "bindless_materials.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+
+#include "log.h"
+
+
+void BindlessMaterials::init(const Device &device, VkBuffer materialBuffer, uint32_t frameCount) {
+	m_device = device;
+	m_retiredTextures.resize(frameCount);
+	VkDevice logicalDevice = m_device.getLogicalDevice();
+
+	VkPhysicalDeviceVulkan12Properties properties12{};
+	properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &properties12;
+	vkGetPhysicalDeviceProperties2(m_device.getPhysicalDevice(), &properties);
+
+	m_textureCapacity = std::min({
+		static_cast<uint32_t>(BINDLESS_MAX_TEXTURES),
+		properties12.maxPerStageDescriptorUpdateAfterBindSamplers,
+		properties12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		properties12.maxDescriptorSetUpdateAfterBindSamplers,
+		properties12.maxDescriptorSetUpdateAfterBindSampledImages });
+
+	// Layout, slots no pending frame uses are written while earlier frames using the set are still in flight,
+	// which needs update unused while pending. The variable count binding has to be the last one.
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].descriptorCount = m_textureCapacity;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	std::array<VkDescriptorBindingFlags, 2> bindingFlags = {
+		0,
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+			VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+	};
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+	bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &m_layout) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create bindless descriptor set layout");
+		throw std::runtime_error("Failed to create bindless descriptor set layout");
+	}
+
+	// Pool holding the single set, separate from the descriptor allocator since it needs update after bind
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {{
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_textureCapacity },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
+	}};
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+
+	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &m_pool) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create bindless descriptor pool");
+		throw std::runtime_error("Failed to create bindless descriptor pool");
+	}
+
+	VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{};
+	countInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+	countInfo.descriptorSetCount = 1;
+	countInfo.pDescriptorCounts = &m_textureCapacity;
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.pNext = &countInfo;
+	allocInfo.descriptorPool = m_pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_layout;
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &m_set) != VK_SUCCESS) {
+		LOG_ERROR("Failed to allocate bindless descriptor set");
+		throw std::runtime_error("Failed to allocate bindless descriptor set");
+	}
+
+	VkDescriptorBufferInfo materialInfo{};
+	materialInfo.buffer = materialBuffer;
+	materialInfo.offset = 0;
+	materialInfo.range = VK_WHOLE_SIZE;
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_set;
+	write.dstBinding = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &materialInfo;
+	vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+
+	m_slotTextures.resize(m_textureCapacity);
+	LOG_DEBUG("Bindless materials initialized with {} texture slots", m_textureCapacity);
+}
+
+void BindlessMaterials::destroy() {
+	VkDevice logicalDevice = m_device.getLogicalDevice();
+
+	// Frees the set as well
+	vkDestroyDescriptorPool(logicalDevice, m_pool, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, m_layout, nullptr);
+}
+
+uint32_t BindlessMaterials::acquireTexture(const Texture &texture) {
+	std::pair<VkImageView, VkSampler> key(texture.getView(), texture.getSampler());
+
+	auto it = m_textureSlots.find(key);
+	if (it != m_textureSlots.end()) {
+		++it->second.references;
+		return it->second.index;
+	}
+
+	uint32_t index;
+	if (!m_freeTextures.empty()) {
+		index = m_freeTextures.back();
+		m_freeTextures.pop_back();
+	}
+	else if (m_textureCount < m_textureCapacity) {
+		index = m_textureCount++;
+	}
+	else {
+		LOG_ERROR("Bindless texture array is full");
+		throw std::runtime_error("Bindless texture array is full");
+	}
+
+	m_textureSlots[key] = { index, 1 };
+	m_slotTextures[index] = key;
+
+	// Partially bound, so slots are written when first used and stale ones are never read
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = texture.getView();
+	imageInfo.sampler = texture.getSampler();
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_set;
+	write.dstBinding = 1;
+	write.dstArrayElement = index;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_device.getLogicalDevice(), 1, &write, 0, nullptr);
+
+	return index;
+}
+
+void BindlessMaterials::releaseTexture(uint32_t index) {
+	auto it = m_textureSlots.find(m_slotTextures[index]);
+	if (--it->second.references == 0) {
+		// Frames in flight may still sample the descriptor, it is only rewritten once they are done
+		m_textureSlots.erase(it);
+		m_retiredTextures[m_frame].push_back(index);
+	}
+}
+
+void BindlessMaterials::beginFrame(uint32_t frame) {
+	m_frame = frame;
+	m_freeTextures.insert(m_freeTextures.end(), m_retiredTextures[frame].begin(), m_retiredTextures[frame].end());
+	m_retiredTextures[frame].clear();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <glad/vulkan.h>
+
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+
+#include "graphics/device.h"
+#include "data/texture.h"
+
+
+// Upper bound, further limited by the update after bind limits of the device
+#define BINDLESS_MAX_TEXTURES 16384
+
+// A single descriptor set holding every texture of every loaded material in one partially bound array, next to the
+// material table. Draws select their material through the materialIndex of their object, so the set is bound once
+// per command buffer and materials no longer break instanced draws. Texture slots are shared by materials using the
+// same image view and sampler. Used from the render thread.
+class BindlessMaterials {
+public:
+	void init(const Device &device, VkBuffer materialBuffer, uint32_t frameCount);
+	void destroy();
+
+	// Slot of the texture in the array, written on first use
+	uint32_t acquireTexture(const Texture &texture);
+	// The slot is reused once the frames in flight are done with it
+	void releaseTexture(uint32_t index);
+	// Call after waiting for the fence of the frame
+	void beginFrame(uint32_t frame);
+
+	VkDescriptorSetLayout getLayout() const { return m_layout; }
+	VkDescriptorSet getSet() const { return m_set; }
+
+private:
+	struct TextureSlot {
+		uint32_t index;
+		uint32_t references;
+	};
+
+	Device m_device;
+
+	VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+	VkDescriptorPool m_pool = VK_NULL_HANDLE;
+	VkDescriptorSet m_set = VK_NULL_HANDLE;
+
+	uint32_t m_textureCapacity = 0;
+	std::map<std::pair<VkImageView, VkSampler>, TextureSlot> m_textureSlots;
+	std::vector<std::pair<VkImageView, VkSampler>> m_slotTextures; // By texture slot
+	std::vector<uint32_t> m_freeTextures;
+	std::vector<std::vector<uint32_t>> m_retiredTextures; // Released while each frame slot was current
+	uint32_t m_frame = 0;
+	uint32_t m_textureCount = 0;
+};
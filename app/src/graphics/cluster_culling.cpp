@@ -0,0 +1,167 @@
+#include "cluster_culling.h"
+
+#include <stdexcept>
+#include <array>
+
+#include "log.h"
+#include "data/geometry.h"
+
+
+// Converted primitives are narrowed to geometry indices whatever their source type, the shader reads them in pairs
+static_assert(sizeof(GeometryIndex) == sizeof(uint16_t), "cull_clusters.comp unpacks two 16 bit indices per word");
+
+static VkBuffer createCullingBuffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create cluster culling buffer");
+		throw std::runtime_error("Failed to create cluster culling buffer");
+	}
+	return buffer;
+}
+
+void ClusterCuller::init(const Device &device, DescriptorLayoutCache *layoutCache, DescriptorAllocator *allocator, uint32_t frameCount,
+	const GeometryArena &geometryArena) {
+
+	m_device = device;
+
+	VkDescriptorSetLayout frameLayout = VK_NULL_HANDLE;
+	m_frames.resize(frameCount);
+	for (uint32_t i = 0; i < frameCount; ++i) {
+		Frame &frame = m_frames[i];
+		m_uniformBuffers.emplace_back(m_device);
+
+		frame.indexBuffer = createCullingBuffer(m_device.getLogicalDevice(), CLUSTER_CULLING_MAX_INDICES * sizeof(uint32_t),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+		frame.indexMemory = m_device.getAllocator().allocateBuffer(frame.indexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		frame.drawBuffer = createCullingBuffer(m_device.getLogicalDevice(), CLUSTER_CULLING_MAX_DRAWS * sizeof(VkDrawIndexedIndirectCommand),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+		frame.drawMemory = m_device.getAllocator().allocateBuffer(frame.drawBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		VkDescriptorBufferInfo uniformInfo{};
+		uniformInfo.buffer = m_uniformBuffers[i].getBuffer();
+		uniformInfo.offset = 0;
+		uniformInfo.range = m_uniformBuffers[i].getSize();
+
+		VkDescriptorBufferInfo indexInfo{};
+		indexInfo.buffer = frame.indexBuffer;
+		indexInfo.offset = 0;
+		indexInfo.range = VK_WHOLE_SIZE;
+
+		VkDescriptorBufferInfo drawInfo{};
+		drawInfo.buffer = frame.drawBuffer;
+		drawInfo.offset = 0;
+		drawInfo.range = VK_WHOLE_SIZE;
+
+		DescriptorBuilder::begin(layoutCache, allocator)
+			.bindBuffer(0, &uniformInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bindBuffer(1, &indexInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bindBuffer(2, &drawInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.build(frame.set, frameLayout);
+	}
+
+	VkDescriptorBufferInfo meshletInfo = geometryArena.getMeshletInfo();
+	VkDescriptorBufferInfo sourceIndexInfo = geometryArena.getIndexInfo();
+
+	VkDescriptorSetLayout geometryLayout;
+	DescriptorBuilder::begin(layoutCache, allocator)
+		.bindBuffer(0, &meshletInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bindBuffer(1, &sourceIndexInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build(m_geometrySet, geometryLayout);
+
+	m_pipeline.init(m_device, "assets/shaders/cull_clusters.comp.spv", { frameLayout, geometryLayout }, sizeof(ClusterCullingJob));
+}
+
+void ClusterCuller::destroy() {
+	m_pipeline.destroy();
+
+	for (Frame &frame : m_frames) {
+		vkDestroyBuffer(m_device.getLogicalDevice(), frame.indexBuffer, nullptr);
+		m_device.getAllocator().free(frame.indexMemory);
+		vkDestroyBuffer(m_device.getLogicalDevice(), frame.drawBuffer, nullptr);
+		m_device.getAllocator().free(frame.drawMemory);
+	}
+	m_frames.clear();
+
+	for (auto &uniformBuffer : m_uniformBuffers) {
+		uniformBuffer.destroy();
+	}
+	m_uniformBuffers.clear();
+}
+
+void ClusterCuller::beginFrame(uint32_t frame) {
+	m_frame = frame;
+	m_frames[m_frame].jobs.clear();
+	m_frames[m_frame].indexCount = 0;
+}
+
+bool ClusterCuller::canAddDraw(const Mesh &mesh) const {
+	// Room is reserved for every triangle, the shader only fills what survives
+	const Frame &frame = m_frames[m_frame];
+	return frame.jobs.size() < CLUSTER_CULLING_MAX_DRAWS && frame.indexCount + mesh.indexCount <= CLUSTER_CULLING_MAX_INDICES;
+}
+
+void ClusterCuller::bindIndexBuffer(VkCommandBuffer commandBuffer) const {
+	vkCmdBindIndexBuffer(commandBuffer, m_frames[m_frame].indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+uint32_t ClusterCuller::addDraw(const Mesh &mesh, const glm::mat4 &matrix) {
+	Frame &frame = m_frames[m_frame];
+
+	uint32_t drawIndex = static_cast<uint32_t>(frame.jobs.size());
+	auto *commands = static_cast<VkDrawIndexedIndirectCommand *>(frame.drawMemory.mapped);
+	commands[drawIndex] = { 0, 1, frame.indexCount, mesh.vertexOffset, 0 };
+
+	ClusterCullingJob job{};
+	job.matrix = matrix;
+	job.firstMeshlet = mesh.meshletStart;
+	job.meshletCount = mesh.meshletCount;
+	job.firstSourceIndex = mesh.firstIndex;
+	job.firstOutputIndex = frame.indexCount;
+	job.drawIndex = drawIndex;
+	frame.jobs.push_back(job);
+	frame.indexCount += mesh.indexCount;
+	return drawIndex;
+}
+
+void ClusterCuller::setFirstInstance(uint32_t drawIndex, uint32_t firstInstance) {
+	static_cast<VkDrawIndexedIndirectCommand *>(m_frames[m_frame].drawMemory.mapped)[drawIndex].firstInstance = firstInstance;
+}
+
+void ClusterCuller::recordDraw(VkCommandBuffer commandBuffer, uint32_t drawIndex) const {
+	vkCmdDrawIndexedIndirect(commandBuffer, m_frames[m_frame].drawBuffer, drawIndex * sizeof(VkDrawIndexedIndirectCommand), 1,
+		sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void ClusterCuller::record(VkCommandBuffer commandBuffer, const glm::mat4 &view, const glm::mat4 &projection) {
+	Frame &frame = m_frames[m_frame];
+
+	ClusterCullingData &data = *m_uniformBuffers[m_frame].getData();
+	extractFrustumPlanes(projection * view, data.frustumPlanes);
+	data.cameraPosition = glm::inverse(view)[3];
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline.getPipeline());
+	std::array<VkDescriptorSet, 2> sets = { frame.set, m_geometrySet };
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline.getLayout(), 0,
+		static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+
+	for (const ClusterCullingJob &job : frame.jobs) {
+		vkCmdPushConstants(commandBuffer, m_pipeline.getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClusterCullingJob), &job);
+		vkCmdDispatch(commandBuffer, (job.meshletCount + CLUSTER_CULLING_GROUP_SIZE - 1) / CLUSTER_CULLING_GROUP_SIZE, 1, 1);
+	}
+
+	// Draws of the frame are submitted after this command buffer, the barrier covers them
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glad/vulkan.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "graphics/device.h"
+#include "graphics/memory.h"
+#include "graphics/pipeline.h"
+#include "graphics/descriptors.h"
+#include "graphics/uniform.h"
+#include "graphics/geometry_arena.h"
+#include "graphics/frustum_culling.h"
+#include "data/mesh.h"
+
+
+#define CLUSTER_CULLING_MAX_DRAWS 4096
+#define CLUSTER_CULLING_MAX_INDICES (1 << 22)
+#define CLUSTER_CULLING_GROUP_SIZE 64
+
+// Inward facing frustum planes and the camera of a frame, std140
+struct ClusterCullingData {
+	glm::vec4 frustumPlanes[6];
+	glm::vec4 cameraPosition;
+};
+
+// Push constants of one culled mesh. Survivors are appended to the output range of its draw.
+struct ClusterCullingJob {
+	glm::mat4 matrix;
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
+	uint32_t firstSourceIndex; // In the index stream of the geometry arena
+	uint32_t firstOutputIndex;
+	uint32_t drawIndex;
+};
+
+// Culls meshlets against the view frustum and their normal cones on the GPU. Surviving triangles are compacted into a
+// per frame index buffer and drawn indirectly. The dispatches are recorded into a separate command buffer that is
+// submitted ahead of the frame, so draws recorded in the render pass see the results.
+class ClusterCuller {
+public:
+	// Meshlets and indices are read from the geometry arena
+	void init(const Device &device, DescriptorLayoutCache *layoutCache, DescriptorAllocator *allocator, uint32_t frameCount,
+		const GeometryArena &geometryArena);
+	void destroy();
+
+	void beginFrame(uint32_t frame);
+	// False when the frame is out of space, the mesh is then drawn whole
+	bool canAddDraw(const Mesh &mesh) const;
+	// Draws of culled meshes read the compacted indices of the frame
+	void bindIndexBuffer(VkCommandBuffer commandBuffer) const;
+	// Queues culling of the meshlets of a mesh, the returned slot holds the indirect draw of the survivors
+	uint32_t addDraw(const Mesh &mesh, const glm::mat4 &matrix);
+	// Draws read their object at their first instance, assigned once the draw order is known
+	void setFirstInstance(uint32_t drawIndex, uint32_t firstInstance);
+	// Safe from any thread once the draws of the frame are added
+	void recordDraw(VkCommandBuffer commandBuffer, uint32_t drawIndex) const;
+
+	bool hasWork() const { return !m_frames[m_frame].jobs.empty(); }
+	// Records the culling dispatches of the frame followed by a barrier for the draws
+	void record(VkCommandBuffer commandBuffer, const glm::mat4 &view, const glm::mat4 &projection);
+
+private:
+	struct Frame {
+		VkBuffer indexBuffer = VK_NULL_HANDLE;
+		MemoryAllocation indexMemory;
+		// Host visible, draws are reset by the CPU and counted up by the shader
+		VkBuffer drawBuffer = VK_NULL_HANDLE;
+		MemoryAllocation drawMemory;
+
+		VkDescriptorSet set = VK_NULL_HANDLE;
+
+		std::vector<ClusterCullingJob> jobs;
+		uint32_t indexCount = 0;
+	};
+
+	Device m_device;
+	ComputePipeline m_pipeline;
+	VkDescriptorSet m_geometrySet = VK_NULL_HANDLE;
+
+	std::vector<Frame> m_frames;
+	std::vector<UniformBuffer<ClusterCullingData>> m_uniformBuffers;
+	uint32_t m_frame = 0;
+};
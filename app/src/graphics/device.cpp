@@ -4,11 +4,16 @@
 #include <set>
 #include <stdexcept>
 
+#include "graphics/memory.h"
 #include "log.h"
 
 
 
 void Device::destroy() {
+	if (m_allocator) {
+		m_allocator->destroy();
+	}
+
 	if (m_device) {
 		vkDestroyDevice(m_device, nullptr);
 	}
@@ -57,11 +62,73 @@ void Device::init(VkInstance instance, VkSurfaceKHR surface, const Validator& va
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
 	// Features
-	VkPhysicalDeviceFeatures deviceFeatures{};
-	createInfo.pEnabledFeatures = &deviceFeatures;
+	VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+	supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures{};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &supportedFeatures12;
+	vkGetPhysicalDeviceFeatures2(m_physicalDevice, &supportedFeatures);
+
+	VkPhysicalDeviceVulkan12Features deviceFeatures12{};
+	deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 deviceFeatures{};
+	deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures.pNext = &deviceFeatures12;
+	createInfo.pNext = &deviceFeatures;
 
 	// We force required anisotropy to be required
-	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	deviceFeatures.features.samplerAnisotropy = VK_TRUE;
+	// Converted models and KTX2 images store BC compressed textures, decoded on load without support
+	m_textureCompressionBCSupported = supportedFeatures.features.textureCompressionBC;
+	if (m_textureCompressionBCSupported) {
+		deviceFeatures.features.textureCompressionBC = VK_TRUE;
+	}
+	else {
+		LOG_WARN("BC texture compression is not supported, compressed textures are decoded on load");
+	}
+
+	// Indirect draws find their object through the first instance, required by cluster culling on its own
+	m_indirectFirstInstanceSupported = supportedFeatures.features.drawIndirectFirstInstance;
+	if (m_indirectFirstInstanceSupported) {
+		deviceFeatures.features.drawIndirectFirstInstance = VK_TRUE;
+	}
+	else {
+		LOG_WARN("Indirect draws with a first instance are not supported, cluster culling is disabled");
+	}
+
+	// GPU driven rendering writes its draws and their count from a compute shader
+	m_gpuDrivenRenderingSupported = supportedFeatures12.drawIndirectCount
+		&& supportedFeatures.features.multiDrawIndirect
+		&& m_indirectFirstInstanceSupported;
+	if (m_gpuDrivenRenderingSupported) {
+		deviceFeatures12.drawIndirectCount = VK_TRUE;
+		deviceFeatures.features.multiDrawIndirect = VK_TRUE;
+	}
+	else {
+		LOG_WARN("Indirect count draws are not supported, GPU driven rendering is disabled");
+	}
+
+	// Bindless materials index a partially bound texture array with the material of the draw. Slots no pending
+	// frame reads are written while the set is in use, which needs update after bind and update unused while pending.
+	m_bindlessMaterialsSupported = supportedFeatures12.descriptorIndexing
+		&& supportedFeatures12.runtimeDescriptorArray
+		&& supportedFeatures12.shaderSampledImageArrayNonUniformIndexing
+		&& supportedFeatures12.descriptorBindingPartiallyBound
+		&& supportedFeatures12.descriptorBindingVariableDescriptorCount
+		&& supportedFeatures12.descriptorBindingSampledImageUpdateAfterBind
+		&& supportedFeatures12.descriptorBindingUpdateUnusedWhilePending;
+	if (m_bindlessMaterialsSupported) {
+		deviceFeatures12.descriptorIndexing = VK_TRUE;
+		deviceFeatures12.runtimeDescriptorArray = VK_TRUE;
+		deviceFeatures12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		deviceFeatures12.descriptorBindingPartiallyBound = VK_TRUE;
+		deviceFeatures12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+		deviceFeatures12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		deviceFeatures12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	}
+	else {
+		LOG_WARN("Descriptor indexing is not supported, materials are bound per draw");
+	}
 
 	// Extensions
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.getExtensions().size());
@@ -85,6 +152,9 @@ void Device::init(VkInstance instance, VkSurfaceKHR surface, const Validator& va
 		LOG_ERROR("Unable to load Vulkan symbols for logical device");
 		throw std::runtime_error("Unable to load Vulkan symbols for logical device");
 	}
+
+	m_allocator = std::make_shared<MemoryAllocator>();
+	m_allocator->init(m_physicalDevice, m_device);
 }
 
 // TODO: Very basic for now, needs to check additional criteria for proper automatic physical device selection
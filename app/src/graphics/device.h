@@ -3,11 +3,14 @@
 #include <glad/vulkan.h>
 
 #include <optional>
+#include <memory>
 
 #include "validation.h"
 #include "extensions.h"
 
 
+class MemoryAllocator;
+
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
@@ -33,6 +36,18 @@ public:
 	VkQueue getGraphicsQueue() const { return m_graphicsQueue; }
 	VkQueue getPresentQueue() const { return m_presentQueue; }
 
+	// Sampling BC1 to BC7 images
+	bool supportsTextureCompressionBC() const { return m_textureCompressionBCSupported; }
+	// Indirect draws with a non zero first instance
+	bool supportsIndirectFirstInstance() const { return m_indirectFirstInstanceSupported; }
+	// Indirect count draws with multi draw and first instance
+	bool supportsGpuDrivenRendering() const { return m_gpuDrivenRenderingSupported; }
+	// Descriptor indexing of partially bound texture arrays, updated after bind and while pending
+	bool supportsBindlessMaterials() const { return m_bindlessMaterialsSupported; }
+
+	// Shared by every copy of the device
+	MemoryAllocator &getAllocator() const { return *m_allocator; }
+
 	explicit operator bool() const noexcept { return m_physicalDevice && m_device && m_graphicsQueue && m_presentQueue; }
 
 private:
@@ -46,4 +61,10 @@ private:
 	VkQueue m_graphicsQueue{};
 	VkQueue m_presentQueue{};
 
+	bool m_textureCompressionBCSupported = false;
+	bool m_indirectFirstInstanceSupported = false;
+	bool m_gpuDrivenRenderingSupported = false;
+	bool m_bindlessMaterialsSupported = false;
+
+	std::shared_ptr<MemoryAllocator> m_allocator;
 };
@@ -0,0 +1,153 @@
+#include "frustum_culling.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(FRUSTUM_CULLING_AVX)
+#include <immintrin.h>
+#elif defined(FRUSTUM_CULLING_SSE2)
+#include <emmintrin.h>
+#elif defined(FRUSTUM_CULLING_NEON)
+#include <arm_neon.h>
+#endif
+
+
+// Planes from the rows of the view projection matrix (Gribb and Hartmann). The near plane uses the OpenGL
+// form, which lies behind the Vulkan near plane and so only culls conservatively.
+void extractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6]) {
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; ++row) {
+		rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+	}
+	for (int axis = 0; axis < 3; ++axis) {
+		planes[axis * 2 + 0] = rows[3] + rows[axis];
+		planes[axis * 2 + 1] = rows[3] - rows[axis];
+	}
+	for (int i = 0; i < 6; ++i) {
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+void FrustumCuller::clear() {
+	m_count = 0;
+	m_centerX.clear();
+	m_centerY.clear();
+	m_centerZ.clear();
+	m_extentX.clear();
+	m_extentY.clear();
+	m_extentZ.clear();
+}
+
+void FrustumCuller::addBox(const glm::mat4 &matrix, const glm::vec3 &min, const glm::vec3 &max) {
+	glm::vec3 center = glm::vec3(matrix * glm::vec4((min + max) * 0.5f, 1.0f));
+	glm::vec3 extent = (max - min) * 0.5f;
+
+	// Every world axis gathers the model axes projected onto it (Arvo)
+	glm::vec3 worldExtent(0.0f);
+	for (int axis = 0; axis < 3; ++axis) {
+		worldExtent += glm::vec3(std::abs(matrix[axis][0]), std::abs(matrix[axis][1]), std::abs(matrix[axis][2])) * extent[axis];
+	}
+
+	// Padding lanes are appended in whole blocks and overwritten as boxes arrive
+	if (m_count % FRUSTUM_CULLING_LANES == 0) {
+		size_t size = m_count + FRUSTUM_CULLING_LANES;
+		for (std::vector<float> *values : { &m_centerX, &m_centerY, &m_centerZ, &m_extentX, &m_extentY, &m_extentZ }) {
+			values->resize(size, 0.0f);
+		}
+	}
+
+	m_centerX[m_count] = center.x;
+	m_centerY[m_count] = center.y;
+	m_centerZ[m_count] = center.z;
+	m_extentX[m_count] = worldExtent.x;
+	m_extentY[m_count] = worldExtent.y;
+	m_extentZ[m_count] = worldExtent.z;
+	++m_count;
+}
+
+void FrustumCuller::cull(const glm::vec4 planes[6], std::vector<uint8_t> &visibility) const {
+	visibility.resize(m_count);
+	for (size_t first = 0; first < m_count; first += FRUSTUM_CULLING_LANES) {
+		uint32_t mask = cullBlock(planes, first);
+		size_t lanes = std::min<size_t>(FRUSTUM_CULLING_LANES, m_count - first);
+		for (size_t lane = 0; lane < lanes; ++lane) {
+			visibility[first + lane] = (mask >> lane) & 1;
+		}
+	}
+}
+
+// A box is outside when it lies entirely behind one plane, i.e. the distance of its center is below the
+// projection of its extent onto the plane normal
+uint32_t FrustumCuller::cullBlock(const glm::vec4 planes[6], size_t first) const {
+#if defined(FRUSTUM_CULLING_AVX)
+	__m256 centerX = _mm256_loadu_ps(&m_centerX[first]);
+	__m256 centerY = _mm256_loadu_ps(&m_centerY[first]);
+	__m256 centerZ = _mm256_loadu_ps(&m_centerZ[first]);
+	__m256 extentX = _mm256_loadu_ps(&m_extentX[first]);
+	__m256 extentY = _mm256_loadu_ps(&m_extentY[first]);
+	__m256 extentZ = _mm256_loadu_ps(&m_extentZ[first]);
+
+	int inside = 0xFF;
+	for (int i = 0; i < 6 && inside; ++i) {
+		const glm::vec4 &plane = planes[i];
+		__m256 distance = _mm256_add_ps(
+			_mm256_add_ps(_mm256_mul_ps(centerX, _mm256_set1_ps(plane.x)), _mm256_mul_ps(centerY, _mm256_set1_ps(plane.y))),
+			_mm256_add_ps(_mm256_mul_ps(centerZ, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+		__m256 radius = _mm256_add_ps(
+			_mm256_add_ps(_mm256_mul_ps(extentX, _mm256_set1_ps(std::abs(plane.x))), _mm256_mul_ps(extentY, _mm256_set1_ps(std::abs(plane.y)))),
+			_mm256_mul_ps(extentZ, _mm256_set1_ps(std::abs(plane.z))));
+		inside &= _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+	}
+	return static_cast<uint32_t>(inside);
+#elif defined(FRUSTUM_CULLING_SSE2)
+	__m128 centerX = _mm_loadu_ps(&m_centerX[first]);
+	__m128 centerY = _mm_loadu_ps(&m_centerY[first]);
+	__m128 centerZ = _mm_loadu_ps(&m_centerZ[first]);
+	__m128 extentX = _mm_loadu_ps(&m_extentX[first]);
+	__m128 extentY = _mm_loadu_ps(&m_extentY[first]);
+	__m128 extentZ = _mm_loadu_ps(&m_extentZ[first]);
+
+	int inside = 0xF;
+	for (int i = 0; i < 6 && inside; ++i) {
+		const glm::vec4 &plane = planes[i];
+		__m128 distance = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane.x)), _mm_mul_ps(centerY, _mm_set1_ps(plane.y))),
+			_mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+		__m128 radius = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(std::abs(plane.x))), _mm_mul_ps(extentY, _mm_set1_ps(std::abs(plane.y)))),
+			_mm_mul_ps(extentZ, _mm_set1_ps(std::abs(plane.z))));
+		inside &= _mm_movemask_ps(_mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+	}
+	return static_cast<uint32_t>(inside);
+#elif defined(FRUSTUM_CULLING_NEON)
+	float32x4_t centerX = vld1q_f32(&m_centerX[first]);
+	float32x4_t centerY = vld1q_f32(&m_centerY[first]);
+	float32x4_t centerZ = vld1q_f32(&m_centerZ[first]);
+	float32x4_t extentX = vld1q_f32(&m_extentX[first]);
+	float32x4_t extentY = vld1q_f32(&m_extentY[first]);
+	float32x4_t extentZ = vld1q_f32(&m_extentZ[first]);
+
+	uint32x4_t inside = vdupq_n_u32(UINT32_MAX);
+	for (int i = 0; i < 6; ++i) {
+		const glm::vec4 &plane = planes[i];
+		float32x4_t distance = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(plane.w), centerX, plane.x), centerY, plane.y), centerZ, plane.z);
+		float32x4_t radius = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(extentX, std::abs(plane.x)), extentY, std::abs(plane.y)), extentZ, std::abs(plane.z));
+		inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(distance, radius), vdupq_n_f32(0.0f)));
+	}
+	return (vgetq_lane_u32(inside, 0) & 1) | (vgetq_lane_u32(inside, 1) & 2) | (vgetq_lane_u32(inside, 2) & 4) | (vgetq_lane_u32(inside, 3) & 8);
+#else
+	uint32_t inside = 0;
+	for (uint32_t lane = 0; lane < FRUSTUM_CULLING_LANES; ++lane) {
+		size_t box = first + lane;
+		bool visible = true;
+		for (int i = 0; i < 6 && visible; ++i) {
+			const glm::vec4 &plane = planes[i];
+			float distance = plane.x * m_centerX[box] + plane.y * m_centerY[box] + plane.z * m_centerZ[box] + plane.w;
+			float radius = std::abs(plane.x) * m_extentX[box] + std::abs(plane.y) * m_extentY[box] + std::abs(plane.z) * m_extentZ[box];
+			visible = distance + radius >= 0.0f;
+		}
+		inside |= static_cast<uint32_t>(visible) << lane;
+	}
+	return inside;
+#endif
+}
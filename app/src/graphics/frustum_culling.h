@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+
+// Boxes tested per kernel iteration. AVX needs to be enabled by the compiler flags, SSE2 and NEON are baseline.
+#if defined(__AVX__)
+#define FRUSTUM_CULLING_AVX
+#define FRUSTUM_CULLING_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLING_SSE2
+#define FRUSTUM_CULLING_LANES 4
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define FRUSTUM_CULLING_NEON
+#define FRUSTUM_CULLING_LANES 4
+#else
+#define FRUSTUM_CULLING_LANES 4
+#endif
+
+// Normalized, inward facing planes of the frustum of a view projection matrix
+void extractFrustumPlanes(const glm::mat4 &viewProjection, glm::vec4 planes[6]);
+
+// Meshes tested against the view frustum in the last frame
+struct CullingStats {
+	uint32_t testedMeshes = 0;
+	uint32_t visibleMeshes = 0;
+};
+
+// Tests world space bounding boxes against the view frustum. Boxes are stored as centers and half extents in
+// separate arrays, so the kernel tests FRUSTUM_CULLING_LANES boxes against a plane with one set of vector operations.
+class FrustumCuller {
+public:
+	void clear();
+	// Adds a model space box moved to world space by the matrix, grown to stay axis aligned
+	void addBox(const glm::mat4 &matrix, const glm::vec3 &min, const glm::vec3 &max);
+	size_t getBoxCount() const { return m_count; }
+
+	// One entry per box, 1 when the box intersects the frustum
+	void cull(const glm::vec4 planes[6], std::vector<uint8_t> &visibility) const;
+
+private:
+	// Bit per lane for the boxes starting at first
+	uint32_t cullBlock(const glm::vec4 planes[6], size_t first) const;
+
+	size_t m_count = 0;
+	// Padded to a multiple of the lane count
+	std::vector<float> m_centerX, m_centerY, m_centerZ;
+	std::vector<float> m_extentX, m_extentY, m_extentZ;
+};
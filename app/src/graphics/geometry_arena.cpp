@@ -0,0 +1,184 @@
+#include "geometry_arena.h"
+
+#include <stdexcept>
+
+#include "log.h"
+
+
+static_assert(sizeof(GeometryIndex) == sizeof(uint16_t), "The index stream is bound as VK_INDEX_TYPE_UINT16");
+
+static const uint32_t RANGE_CAPACITIES[GeometryAllocation::RANGE_COUNT] = {
+	GEOMETRY_ARENA_SEPARATE_VERTICES,
+	GEOMETRY_ARENA_PACKED_VERTICES,
+	GEOMETRY_ARENA_INDICES,
+	GEOMETRY_ARENA_MESHLETS
+};
+
+static GeometryAllocation::Range streamRange(GeometryStream stream) {
+	switch (stream) {
+	case GeometryStream::PACKED: return GeometryAllocation::PACKED_VERTICES;
+	case GeometryStream::INDEX: return GeometryAllocation::INDICES;
+	default: return GeometryAllocation::SEPARATE_VERTICES;
+	}
+}
+
+static VkDeviceSize alignRegion(VkDeviceSize offset) {
+	return (offset + GEOMETRY_ARENA_REGION_ALIGNMENT - 1) & ~static_cast<VkDeviceSize>(GEOMETRY_ARENA_REGION_ALIGNMENT - 1);
+}
+
+void GeometryAllocation::rebase(Mesh &mesh) const {
+	mesh.vertexOffset += static_cast<int32_t>(starts[mesh.vertexFormat == VertexFormat::PACKED ? PACKED_VERTICES : SEPARATE_VERTICES]);
+	mesh.firstIndex += starts[INDICES];
+	for (uint32_t lod = 1; lod < mesh.lodCount; ++lod) {
+		mesh.lods[lod].firstIndex += starts[INDICES];
+	}
+	mesh.meshletStart += starts[MESHLETS];
+}
+
+void GeometryArena::init(const Device &device, uint32_t frameCount) {
+	m_device = device;
+	m_retired.resize(frameCount);
+
+	VkDeviceSize size = 0;
+	for (uint32_t i = 0; i < static_cast<uint32_t>(GeometryStream::COUNT); ++i) {
+		GeometryStream stream = static_cast<GeometryStream>(i);
+		m_streamOffsets[i] = size;
+		size = alignRegion(size + RANGE_CAPACITIES[streamRange(stream)] * geometryStreamStride(stream));
+	}
+	m_meshletOffset = size;
+	size += RANGE_CAPACITIES[GeometryAllocation::MESHLETS] * sizeof(Meshlet);
+
+	for (uint32_t range = 0; range < GeometryAllocation::RANGE_COUNT; ++range) {
+		m_allocators[range].init(RANGE_CAPACITIES[range]);
+	}
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+		| VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(m_device.getLogicalDevice(), &bufferInfo, nullptr, &m_buffer) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create geometry arena buffer");
+		throw std::runtime_error("Failed to create geometry arena buffer");
+	}
+
+	m_memory = m_device.getAllocator().allocateBuffer(m_buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	LOG_DEBUG("Geometry arena reserved {:.1f} MiB", size / (1024.0 * 1024.0));
+}
+
+void GeometryArena::destroy() {
+	vkDestroyBuffer(m_device.getLogicalDevice(), m_buffer, nullptr);
+	if (m_memory) {
+		m_device.getAllocator().free(m_memory);
+	}
+}
+
+GeometryAllocation GeometryArena::allocate(UploadQueue &uploadQueue, const GeometryLayout &layout, const std::byte *data,
+	const std::vector<Meshlet> &meshlets) {
+
+	const uint32_t counts[GeometryAllocation::RANGE_COUNT] = {
+		layout.separateVertexCount,
+		layout.packedVertexCount,
+		layout.indexCount,
+		static_cast<uint32_t>(meshlets.size())
+	};
+
+	GeometryAllocation allocation;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (uint32_t range = 0; range < GeometryAllocation::RANGE_COUNT; ++range) {
+			if (counts[range] == 0) {
+				continue;
+			}
+
+			// Ranges are counted in elements, the allocator rounds them up to its minimum size
+			VkDeviceSize start;
+			allocation.nodes[range] = m_allocators[range].allocate(counts[range], 1, start);
+			if (allocation.nodes[range] == TlsfAllocator::INVALID_NODE) {
+				for (uint32_t allocated = 0; allocated < range; ++allocated) {
+					if (allocation.nodes[allocated] != TlsfAllocator::INVALID_NODE) {
+						m_allocators[allocated].free(allocation.nodes[allocated]);
+					}
+				}
+				LOG_ERROR("Geometry arena is out of space");
+				throw std::runtime_error("Geometry arena is out of space");
+			}
+			allocation.starts[range] = static_cast<uint32_t>(start);
+		}
+	}
+
+	for (uint32_t i = 0; i < static_cast<uint32_t>(GeometryStream::COUNT); ++i) {
+		GeometryStream stream = static_cast<GeometryStream>(i);
+		size_t size = layout.getStreamSize(stream);
+		if (size) {
+			VkDeviceSize offset = getStreamOffset(stream) + allocation.starts[streamRange(stream)] * geometryStreamStride(stream);
+			uploadQueue.uploadBuffer(m_buffer, offset, data + layout.getStreamOffset(stream), size);
+		}
+	}
+	if (!meshlets.empty()) {
+		uploadQueue.uploadBuffer(m_buffer, m_meshletOffset + allocation.starts[GeometryAllocation::MESHLETS] * sizeof(Meshlet),
+			meshlets.data(), meshlets.size() * sizeof(Meshlet));
+	}
+
+	return allocation;
+}
+
+void GeometryArena::free(GeometryAllocation &allocation) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_retired[m_frame].push_back(allocation.nodes);
+	allocation.nodes.fill(TlsfAllocator::INVALID_NODE);
+}
+
+void GeometryArena::beginFrame(uint32_t frame) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_frame = frame;
+
+	// Frames that could read these ranges were submitted before the slot was last used, its fence has signalled
+	for (const auto &nodes : m_retired[frame]) {
+		for (uint32_t range = 0; range < GeometryAllocation::RANGE_COUNT; ++range) {
+			if (nodes[range] != TlsfAllocator::INVALID_NODE) {
+				m_allocators[range].free(nodes[range]);
+			}
+		}
+	}
+	m_retired[frame].clear();
+}
+
+void GeometryArena::bindVertexBuffers(VkCommandBuffer commandBuffer, VertexFormat format) const {
+	if (format == VertexFormat::PACKED) {
+		VkDeviceSize offset = getStreamOffset(GeometryStream::PACKED);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_buffer, &offset);
+		return;
+	}
+
+	std::array<VkBuffer, 3> buffers = { m_buffer, m_buffer, m_buffer };
+	std::array<VkDeviceSize, 3> offsets = {
+		getStreamOffset(GeometryStream::POSITION),
+		getStreamOffset(GeometryStream::TEXTURE_COORDINATE),
+		getStreamOffset(GeometryStream::NORMAL)
+	};
+	vkCmdBindVertexBuffers(commandBuffer, 0, static_cast<uint32_t>(buffers.size()), buffers.data(), offsets.data());
+}
+
+void GeometryArena::bindIndexBuffer(VkCommandBuffer commandBuffer) const {
+	vkCmdBindIndexBuffer(commandBuffer, m_buffer, getStreamOffset(GeometryStream::INDEX), VK_INDEX_TYPE_UINT16);
+}
+
+VkDescriptorBufferInfo GeometryArena::getIndexInfo() const {
+	VkDescriptorBufferInfo info{};
+	info.buffer = m_buffer;
+	info.offset = getStreamOffset(GeometryStream::INDEX);
+	info.range = GEOMETRY_ARENA_INDICES * geometryStreamStride(GeometryStream::INDEX);
+	return info;
+}
+
+VkDescriptorBufferInfo GeometryArena::getMeshletInfo() const {
+	VkDescriptorBufferInfo info{};
+	info.buffer = m_buffer;
+	info.offset = m_meshletOffset;
+	info.range = GEOMETRY_ARENA_MESHLETS * sizeof(Meshlet);
+	return info;
+}
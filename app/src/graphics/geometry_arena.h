@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glad/vulkan.h>
+
+#include <array>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+#include "graphics/device.h"
+#include "graphics/memory.h"
+#include "graphics/upload_queue.h"
+#include "data/geometry.h"
+#include "data/mesh.h"
+
+
+// Capacity of the arena in elements, the regions are reserved up front
+#define GEOMETRY_ARENA_SEPARATE_VERTICES (1u << 20)
+#define GEOMETRY_ARENA_PACKED_VERTICES (1u << 22)
+#define GEOMETRY_ARENA_INDICES (1u << 24)
+#define GEOMETRY_ARENA_MESHLETS (1u << 17)
+// Largest minStorageBufferOffsetAlignment allowed by the spec
+#define GEOMETRY_ARENA_REGION_ALIGNMENT 256
+
+// Ranges of the arena owned by one model
+struct GeometryAllocation {
+	enum Range : uint32_t { SEPARATE_VERTICES, PACKED_VERTICES, INDICES, MESHLETS, RANGE_COUNT };
+
+	std::array<uint32_t, RANGE_COUNT> starts{};
+	std::array<uint32_t, RANGE_COUNT> nodes = { TlsfAllocator::INVALID_NODE, TlsfAllocator::INVALID_NODE,
+		TlsfAllocator::INVALID_NODE, TlsfAllocator::INVALID_NODE };
+
+	// Moves a mesh from the streams of its model to the arena
+	void rebase(Mesh &mesh) const;
+};
+
+// Device local vertex, index and meshlet storage shared by all models. Every stream lives in a fixed region of
+// one buffer and is sub-allocated with a free list, so geometry is bound once per vertex format instead of per mesh.
+class GeometryArena {
+public:
+	void init(const Device &device, uint32_t frameCount);
+	void destroy();
+
+	// Reserves ranges for the streams and meshlets of a model and queues their upload. Thread safe.
+	GeometryAllocation allocate(UploadQueue &uploadQueue, const GeometryLayout &layout, const std::byte *data,
+		const std::vector<Meshlet> &meshlets);
+	// Ranges return to the free lists once the frames in flight are done with them. Thread safe.
+	void free(GeometryAllocation &allocation);
+	// Call after waiting for the fence of the frame
+	void beginFrame(uint32_t frame);
+
+	void bindVertexBuffers(VkCommandBuffer commandBuffer, VertexFormat format) const;
+	void bindIndexBuffer(VkCommandBuffer commandBuffer) const;
+
+	// Storage buffer views for the culling shader
+	VkDescriptorBufferInfo getIndexInfo() const;
+	VkDescriptorBufferInfo getMeshletInfo() const;
+
+private:
+	VkDeviceSize getStreamOffset(GeometryStream stream) const { return m_streamOffsets[static_cast<uint32_t>(stream)]; }
+
+	Device m_device;
+
+	VkBuffer m_buffer = VK_NULL_HANDLE;
+	MemoryAllocation m_memory;
+
+	std::array<VkDeviceSize, static_cast<size_t>(GeometryStream::COUNT)> m_streamOffsets{};
+	VkDeviceSize m_meshletOffset = 0;
+
+	std::mutex m_mutex;
+	std::array<TlsfAllocator, GeometryAllocation::RANGE_COUNT> m_allocators;
+	// Nodes freed while each frame slot was current
+	std::vector<std::vector<std::array<uint32_t, GeometryAllocation::RANGE_COUNT>>> m_retired;
+	uint32_t m_frame = 0;
+};
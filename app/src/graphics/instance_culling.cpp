@@ -0,0 +1,344 @@
+#include "instance_culling.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+
+#include "log.h"
+#include "graphics/frustum_culling.h"
+#include "data/model.h"
+
+
+static VkBuffer createCullingBuffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create instance culling buffer");
+		throw std::runtime_error("Failed to create instance culling buffer");
+	}
+	return buffer;
+}
+
+static VkDescriptorBufferInfo wholeBuffer(VkBuffer buffer) {
+	VkDescriptorBufferInfo info{};
+	info.buffer = buffer;
+	info.offset = 0;
+	info.range = VK_WHOLE_SIZE;
+	return info;
+}
+
+void InstanceCuller::init(const Device &device, DescriptorLayoutCache *layoutCache, DescriptorAllocator *allocator, uint32_t frameCount) {
+	m_device = device;
+	VkDevice logicalDevice = m_device.getLogicalDevice();
+	MemoryAllocator &memoryAllocator = m_device.getAllocator();
+
+	m_meshBuffer = createCullingBuffer(logicalDevice, INSTANCE_CULLING_MAX_MESHES * sizeof(InstanceMeshRecord),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+	m_meshMemory = memoryAllocator.allocateBuffer(m_meshBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	m_meshAllocator.init(INSTANCE_CULLING_MAX_MESHES);
+	m_batchAllocator.init(INSTANCE_CULLING_MAX_BATCHES);
+
+	// Lowest slots are handed out first
+	for (uint32_t slot = INSTANCE_CULLING_MAX_MODELS; slot > 0; --slot) {
+		m_freeSlots.push_back(slot - 1);
+	}
+
+	VkDescriptorBufferInfo meshInfo = wholeBuffer(m_meshBuffer);
+	VkDescriptorSetLayout meshLayout;
+	DescriptorBuilder::begin(layoutCache, allocator)
+		.bindBuffer(0, &meshInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.build(m_meshSet, meshLayout);
+
+	VkDescriptorSetLayout cullLayout = VK_NULL_HANDLE;
+	m_frames.resize(frameCount);
+	for (uint32_t i = 0; i < frameCount; ++i) {
+		Frame &frame = m_frames[i];
+		m_uniformBuffers.emplace_back(m_device);
+
+		frame.instanceBuffer = createCullingBuffer(logicalDevice, INSTANCE_CULLING_MAX_INSTANCES * sizeof(InstanceRecord),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		frame.instanceMemory = memoryAllocator.allocateBuffer(frame.instanceBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		frame.batchBuffer = createCullingBuffer(logicalDevice, INSTANCE_CULLING_MAX_BATCHES * sizeof(InstanceBatchRecord),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		frame.batchMemory = memoryAllocator.allocateBuffer(frame.batchBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		frame.countBuffer = createCullingBuffer(logicalDevice, INSTANCE_CULLING_MAX_BATCHES * sizeof(uint32_t),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+		frame.countMemory = memoryAllocator.allocateBuffer(frame.countBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		frame.drawBuffer = createCullingBuffer(logicalDevice, INSTANCE_CULLING_MAX_DRAWS * sizeof(VkDrawIndexedIndirectCommand),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+		frame.drawMemory = memoryAllocator.allocateBuffer(frame.drawBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		frame.objectBuffer = createCullingBuffer(logicalDevice, INSTANCE_CULLING_MAX_DRAWS * sizeof(ObjectData),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		frame.objectMemory = memoryAllocator.allocateBuffer(frame.objectBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		frame.modelInstanceCounts.resize(INSTANCE_CULLING_MAX_MODELS, 0);
+
+		VkDescriptorBufferInfo uniformInfo{};
+		uniformInfo.buffer = m_uniformBuffers[i].getBuffer();
+		uniformInfo.offset = 0;
+		uniformInfo.range = m_uniformBuffers[i].getSize();
+
+		VkDescriptorBufferInfo instanceInfo = wholeBuffer(frame.instanceBuffer);
+		VkDescriptorBufferInfo batchInfo = wholeBuffer(frame.batchBuffer);
+		VkDescriptorBufferInfo countInfo = wholeBuffer(frame.countBuffer);
+		VkDescriptorBufferInfo drawInfo = wholeBuffer(frame.drawBuffer);
+		VkDescriptorBufferInfo objectInfo = wholeBuffer(frame.objectBuffer);
+
+		DescriptorBuilder::begin(layoutCache, allocator)
+			.bindBuffer(0, &uniformInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bindBuffer(1, &instanceInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bindBuffer(2, &batchInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bindBuffer(3, &countInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bindBuffer(4, &drawInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bindBuffer(5, &objectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.build(frame.cullSet, cullLayout);
+
+		DescriptorBuilder::begin(layoutCache, allocator)
+			.bindBuffer(0, &objectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+			.build(frame.objectSet, m_objectLayout);
+	}
+
+	m_pipeline.init(m_device, "assets/shaders/cull_instances.comp.spv", { cullLayout, meshLayout }, sizeof(uint32_t));
+}
+
+void InstanceCuller::destroy() {
+	m_pipeline.destroy();
+
+	VkDevice logicalDevice = m_device.getLogicalDevice();
+	MemoryAllocator &memoryAllocator = m_device.getAllocator();
+	for (Frame &frame : m_frames) {
+		vkDestroyBuffer(logicalDevice, frame.instanceBuffer, nullptr);
+		memoryAllocator.free(frame.instanceMemory);
+		vkDestroyBuffer(logicalDevice, frame.batchBuffer, nullptr);
+		memoryAllocator.free(frame.batchMemory);
+		vkDestroyBuffer(logicalDevice, frame.countBuffer, nullptr);
+		memoryAllocator.free(frame.countMemory);
+		vkDestroyBuffer(logicalDevice, frame.drawBuffer, nullptr);
+		memoryAllocator.free(frame.drawMemory);
+		vkDestroyBuffer(logicalDevice, frame.objectBuffer, nullptr);
+		memoryAllocator.free(frame.objectMemory);
+	}
+	m_frames.clear();
+
+	for (auto &uniformBuffer : m_uniformBuffers) {
+		uniformBuffer.destroy();
+	}
+	m_uniformBuffers.clear();
+
+	vkDestroyBuffer(logicalDevice, m_meshBuffer, nullptr);
+	if (m_meshMemory) {
+		memoryAllocator.free(m_meshMemory);
+	}
+}
+
+InstanceRegistration InstanceCuller::registerModel(UploadQueue &uploadQueue, const std::unordered_map<int, std::vector<Mesh>> &meshes,
+	const std::unordered_map<int, glm::mat4> &meshMatrices) {
+
+	InstanceRegistration registration;
+	std::vector<InstanceMeshRecord> records;
+
+	for (const auto &[nodeIndex, meshCollection] : meshes) {
+		const glm::mat4 &nodeMatrix = meshMatrices.at(nodeIndex);
+		for (const Mesh &mesh : meshCollection) {
+			auto batch = std::find_if(registration.batches.begin(), registration.batches.end(), [&](const InstanceBatch &batch) {
+				return batch.materialIndex == mesh.materialIndex && batch.vertexFormat == mesh.vertexFormat;
+			});
+			if (batch == registration.batches.end()) {
+				batch = registration.batches.insert(batch, { mesh.materialIndex, mesh.vertexFormat, 0 });
+			}
+			++batch->meshCount;
+
+			InstanceMeshRecord record{};
+			record.nodeMatrix = nodeMatrix;
+			record.bounds = glm::vec4(mesh.boundsCenter, mesh.boundsRadius);
+			record.dequantization = glm::vec4(mesh.positionOffset, mesh.positionScale);
+			record.lodCount = std::max(mesh.lodCount, 1u);
+			for (uint32_t lod = 0; lod < record.lodCount; ++lod) {
+				record.lodFirstIndex[lod] = mesh.getFirstIndex(lod);
+				record.lodIndexCount[lod] = mesh.getIndexCount(lod);
+				record.lodError[lod] = mesh.lods[lod].error;
+			}
+			record.vertexOffset = mesh.vertexOffset;
+			// Made absolute once the batch range is known
+			record.batch = static_cast<uint32_t>(batch - registration.batches.begin());
+			records.push_back(record);
+		}
+	}
+
+	registration.meshCount = static_cast<uint32_t>(records.size());
+	if (records.empty()) {
+		return registration;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		VkDeviceSize firstMesh, firstBatch;
+		if (!m_freeSlots.empty()) {
+			registration.meshNode = m_meshAllocator.allocate(records.size(), 1, firstMesh);
+			registration.batchNode = m_batchAllocator.allocate(registration.batches.size(), 1, firstBatch);
+		}
+		if (registration.meshNode == TlsfAllocator::INVALID_NODE || registration.batchNode == TlsfAllocator::INVALID_NODE) {
+			if (registration.meshNode != TlsfAllocator::INVALID_NODE) {
+				m_meshAllocator.free(registration.meshNode);
+			}
+			if (registration.batchNode != TlsfAllocator::INVALID_NODE) {
+				m_batchAllocator.free(registration.batchNode);
+			}
+			LOG_WARN("Instance culling mesh table is full, model is drawn by the CPU");
+			return InstanceRegistration();
+		}
+
+		registration.slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		registration.firstMesh = static_cast<uint32_t>(firstMesh);
+		registration.firstBatch = static_cast<uint32_t>(firstBatch);
+	}
+
+	for (InstanceMeshRecord &record : records) {
+		record.batch += registration.firstBatch;
+	}
+	uploadQueue.uploadBuffer(m_meshBuffer, registration.firstMesh * sizeof(InstanceMeshRecord), records.data(),
+		records.size() * sizeof(InstanceMeshRecord));
+
+	return registration;
+}
+
+void InstanceCuller::unregisterModel(InstanceRegistration &registration) {
+	if (!registration.isValid()) {
+		return;
+	}
+
+	// Cull dispatches in flight still read the records of the model
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_frames[m_frame].retired.push_back({ registration.slot, registration.meshNode, registration.batchNode });
+	registration = InstanceRegistration();
+}
+
+void InstanceCuller::beginFrame(uint32_t frame) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_frame = frame;
+
+	Frame &current = m_frames[m_frame];
+	// The fence of the frame has signalled, so have those of the frames submitted before it
+	for (const RetiredRegistration &retired : current.retired) {
+		m_meshAllocator.free(retired.meshNode);
+		m_batchAllocator.free(retired.batchNode);
+		m_freeSlots.push_back(retired.slot);
+	}
+	current.retired.clear();
+
+	current.instanceCount = 0;
+	current.drawCount = 0;
+	current.models.clear();
+	current.draws.clear();
+	std::fill(current.modelInstanceCounts.begin(), current.modelInstanceCounts.end(), 0);
+}
+
+bool InstanceCuller::addInstance(const Model &model, const glm::mat4 &matrix) {
+	const InstanceRegistration &registration = model.getInstanceRegistration();
+	Frame &frame = m_frames[m_frame];
+
+	// Every mesh of every instance may survive, so each reserves a draw
+	if (!registration.isValid() || frame.instanceCount >= INSTANCE_CULLING_MAX_INSTANCES
+		|| frame.drawCount + registration.meshCount > INSTANCE_CULLING_MAX_DRAWS) {
+		return false;
+	}
+
+	auto *instances = static_cast<InstanceRecord *>(frame.instanceMemory.mapped);
+	instances[frame.instanceCount++] = { matrix, registration.firstMesh, registration.meshCount, {} };
+	frame.drawCount += registration.meshCount;
+
+	if (frame.modelInstanceCounts[registration.slot]++ == 0) {
+		frame.models.push_back(&model);
+	}
+	return true;
+}
+
+const std::vector<InstanceDraw> &InstanceCuller::prepareDraws() {
+	Frame &frame = m_frames[m_frame];
+	auto *batchRecords = static_cast<InstanceBatchRecord *>(frame.batchMemory.mapped);
+
+	// Work is proportional to the batches of the drawn models, not to their instances
+	frame.draws.clear();
+	uint32_t firstDraw = 0;
+	for (const Model *model : frame.models) {
+		const InstanceRegistration &registration = model->getInstanceRegistration();
+		uint32_t instanceCount = frame.modelInstanceCounts[registration.slot];
+
+		for (uint32_t i = 0; i < registration.batches.size(); ++i) {
+			const InstanceBatch &batch = registration.batches[i];
+
+			InstanceDraw draw{};
+			draw.model = model;
+			draw.batch = &batch;
+			draw.batchIndex = registration.firstBatch + i;
+			draw.firstDraw = firstDraw;
+			draw.maxDrawCount = instanceCount * batch.meshCount;
+			frame.draws.push_back(draw);
+
+			// Objects carry the material for bindless materials
+			batchRecords[draw.batchIndex] = { firstDraw, model->getMaterials()[batch.materialIndex].id };
+			firstDraw += draw.maxDrawCount;
+		}
+	}
+
+	return frame.draws;
+}
+
+void InstanceCuller::record(VkCommandBuffer commandBuffer, const glm::mat4 &view, const glm::mat4 &projection, float pixelsPerUnit,
+	float lodErrorThreshold) {
+
+	Frame &frame = m_frames[m_frame];
+
+	InstanceCullingData &data = *m_uniformBuffers[m_frame].getData();
+	extractFrustumPlanes(projection * view, data.frustumPlanes);
+	data.view = view;
+	data.pixelsPerUnit = pixelsPerUnit;
+	data.lodErrorThreshold = lodErrorThreshold;
+
+	vkCmdFillBuffer(commandBuffer, frame.countBuffer, 0, VK_WHOLE_SIZE, 0);
+
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline.getPipeline());
+	std::array<VkDescriptorSet, 2> sets = { frame.cullSet, m_meshSet };
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline.getLayout(), 0,
+		static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_pipeline.getLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &frame.instanceCount);
+
+	// One workgroup per instance, its threads walk the meshes of the model
+	uint32_t groupsX = std::min(frame.instanceCount, static_cast<uint32_t>(INSTANCE_CULLING_MAX_GROUPS_X));
+	uint32_t groupsY = (frame.instanceCount + groupsX - 1) / groupsX;
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+	// Draws of the frame are submitted after this command buffer, the barrier covers them
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void InstanceCuller::draw(VkCommandBuffer commandBuffer, const InstanceDraw &draw) const {
+	const Frame &frame = m_frames[m_frame];
+	vkCmdDrawIndexedIndirectCount(commandBuffer,
+		frame.drawBuffer, draw.firstDraw * sizeof(VkDrawIndexedIndirectCommand),
+		frame.countBuffer, draw.batchIndex * sizeof(uint32_t),
+		draw.maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <glad/vulkan.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+#include "graphics/device.h"
+#include "graphics/memory.h"
+#include "graphics/pipeline.h"
+#include "graphics/descriptors.h"
+#include "graphics/uniform.h"
+#include "graphics/upload_queue.h"
+#include "graphics/object_buffer.h"
+#include "data/mesh.h"
+
+
+// Capacity of the mesh table, shared by all registered models
+#define INSTANCE_CULLING_MAX_MODELS 256
+#define INSTANCE_CULLING_MAX_MESHES (1u << 16)
+#define INSTANCE_CULLING_MAX_BATCHES (1u << 16)
+// Capacity of one frame, instances that do not fit are drawn by the CPU path
+#define INSTANCE_CULLING_MAX_INSTANCES (1u << 17)
+#define INSTANCE_CULLING_MAX_DRAWS (1u << 18)
+#define INSTANCE_CULLING_GROUP_SIZE 64
+// Instances are spread over a second dispatch dimension past the minimum workgroup count limit
+#define INSTANCE_CULLING_MAX_GROUPS_X 65535
+
+// Inward facing frustum planes and LOD selection parameters of a frame, std140
+struct InstanceCullingData {
+	glm::vec4 frustumPlanes[6];
+	glm::mat4 view;
+	float pixelsPerUnit; // Pixels covered by one unit at distance one
+	float lodErrorThreshold;
+	float padding[2];
+};
+
+// One mesh of a registered model as read by the culling shader, std430
+struct InstanceMeshRecord {
+	glm::mat4 nodeMatrix;
+	glm::vec4 bounds; // Bounding sphere in model units
+	glm::vec4 dequantization; // Position offset and uniform scale
+	uint32_t lodFirstIndex[MAX_MESH_LODS];
+	uint32_t lodIndexCount[MAX_MESH_LODS];
+	float lodError[MAX_MESH_LODS];
+	int32_t vertexOffset;
+	uint32_t lodCount;
+	uint32_t batch;
+	uint32_t padding;
+};
+
+static_assert(MAX_MESH_LODS == 4, "Mesh records store their LODs in vec4s");
+static_assert(sizeof(InstanceMeshRecord) == 160, "Mesh record layout must match the culling shader");
+
+// One drawn model of a frame, std430
+struct InstanceRecord {
+	glm::mat4 matrix;
+	uint32_t firstMesh;
+	uint32_t meshCount;
+	uint32_t padding[2];
+};
+
+// First draw and material id of a batch of the frame, std430
+struct InstanceBatchRecord {
+	uint32_t firstDraw;
+	uint32_t materialIndex;
+};
+
+// Meshes of a model that share a material and vertex format, drawn together with one indirect count draw
+struct InstanceBatch {
+	int materialIndex;
+	VertexFormat vertexFormat;
+	uint32_t meshCount;
+};
+
+// Ranges of the mesh and batch tables owned by one model
+struct InstanceRegistration {
+	static const uint32_t INVALID_SLOT = UINT32_MAX;
+
+	uint32_t slot = INVALID_SLOT;
+	uint32_t firstMesh = 0;
+	uint32_t meshCount = 0;
+	uint32_t firstBatch = 0;
+	std::vector<InstanceBatch> batches;
+
+	uint32_t meshNode = TlsfAllocator::INVALID_NODE;
+	uint32_t batchNode = TlsfAllocator::INVALID_NODE;
+
+	bool isValid() const { return slot != INVALID_SLOT; }
+};
+
+class Model;
+
+// A batch of the current frame, up to maxDrawCount draws starting at firstDraw
+struct InstanceDraw {
+	const Model *model;
+	const InstanceBatch *batch;
+	uint32_t batchIndex;
+	uint32_t firstDraw;
+	uint32_t maxDrawCount;
+};
+
+// GPU driven rendering of whole models. The meshes of registered models live in a device local table, so the CPU
+// only writes one record per drawn model each frame. A compute pass culls and selects the LOD of every mesh of
+// every instance and compacts the survivors into the indirect draws of their batch, which are then drawn with one
+// count draw per batch. Objects are written next to the draws and read by the vertex shader at their first instance.
+class InstanceCuller {
+public:
+	void init(const Device &device, DescriptorLayoutCache *layoutCache, DescriptorAllocator *allocator, uint32_t frameCount);
+	void destroy();
+
+	// Adds the meshes of a model to the table and queues their upload. Thread safe. The registration is invalid
+	// when the table is full, the model is then drawn by the CPU path.
+	InstanceRegistration registerModel(UploadQueue &uploadQueue, const std::unordered_map<int, std::vector<Mesh>> &meshes,
+		const std::unordered_map<int, glm::mat4> &meshMatrices);
+	// The ranges and slot are reused once the frames in flight are done with them
+	void unregisterModel(InstanceRegistration &registration);
+
+	// Call after waiting for the fence of the frame
+	void beginFrame(uint32_t frame);
+	// False when the model is not registered or the frame is out of space
+	bool addInstance(const Model &model, const glm::mat4 &matrix);
+	bool hasWork() const { return m_frames[m_frame].instanceCount != 0; }
+
+	// Reserves the draws of every batch with instances this frame
+	const std::vector<InstanceDraw> &prepareDraws();
+	// Records culling of the instances of the frame followed by a barrier for the draws
+	void record(VkCommandBuffer commandBuffer, const glm::mat4 &view, const glm::mat4 &projection, float pixelsPerUnit,
+		float lodErrorThreshold);
+	void draw(VkCommandBuffer commandBuffer, const InstanceDraw &draw) const;
+
+	// Objects of the draws for the vertex shader, in the layout of ObjectBuffer
+	VkDescriptorSetLayout getObjectLayout() const { return m_objectLayout; }
+	VkDescriptorSet getObjectSet() const { return m_frames[m_frame].objectSet; }
+
+private:
+	struct RetiredRegistration {
+		uint32_t slot;
+		uint32_t meshNode;
+		uint32_t batchNode;
+	};
+
+	struct Frame {
+		// Host visible, written while the frame is recorded
+		VkBuffer instanceBuffer = VK_NULL_HANDLE;
+		MemoryAllocation instanceMemory;
+		VkBuffer batchBuffer = VK_NULL_HANDLE; // Record of every batch
+		MemoryAllocation batchMemory;
+
+		// Cleared before culling and counted up by the shader
+		VkBuffer countBuffer = VK_NULL_HANDLE;
+		MemoryAllocation countMemory;
+		VkBuffer drawBuffer = VK_NULL_HANDLE;
+		MemoryAllocation drawMemory;
+		VkBuffer objectBuffer = VK_NULL_HANDLE;
+		MemoryAllocation objectMemory;
+
+		VkDescriptorSet cullSet = VK_NULL_HANDLE;
+		VkDescriptorSet objectSet = VK_NULL_HANDLE;
+
+		uint32_t instanceCount = 0;
+		uint32_t drawCount = 0;
+		std::vector<const Model *> models;
+		std::vector<uint32_t> modelInstanceCounts; // By registration slot
+		std::vector<InstanceDraw> draws;
+		// Unregistered while the frame was current, released when it comes around again
+		std::vector<RetiredRegistration> retired;
+	};
+
+	Device m_device;
+	ComputePipeline m_pipeline;
+
+	VkBuffer m_meshBuffer = VK_NULL_HANDLE;
+	MemoryAllocation m_meshMemory;
+	VkDescriptorSet m_meshSet = VK_NULL_HANDLE;
+	VkDescriptorSetLayout m_objectLayout = VK_NULL_HANDLE;
+
+	std::mutex m_mutex;
+	TlsfAllocator m_meshAllocator;
+	TlsfAllocator m_batchAllocator;
+	std::vector<uint32_t> m_freeSlots;
+
+	std::vector<Frame> m_frames;
+	std::vector<UniformBuffer<InstanceCullingData>> m_uniformBuffers;
+	uint32_t m_frame = 0;
+};
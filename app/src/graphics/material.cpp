@@ -8,9 +8,5 @@ void Material::destroy(VkDevice device) {
 	if (!occlusionTexture.isDefault()) occlusionTexture.destroy(device);
 	if (!emissiveTexture.isDefault()) emissiveTexture.destroy(device);
 
-	for (auto &buffer : propertiesBuffers) {
-		buffer.destroy();
-	}
-
 	// Sets lifetime is not managed by Material
 }
\ No newline at end of file
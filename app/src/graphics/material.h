@@ -6,7 +6,6 @@
 #include <vector>
 
 #include "data/texture.h"
-#include "graphics/uniform.h"
 
 
 struct MaterialProperties {
@@ -24,17 +23,15 @@ public:
 		Texture normalTexture,
 		Texture occlusionTexture,
 		Texture emissiveTexture,
-		std::vector<UniformBuffer<MaterialProperties>> propertiesBuffers = {})
+		MaterialProperties properties = {})
 		: colorTexture(colorTexture),
 		metallicRoughnessTexture(metallicRoughnessTexture),
 		normalTexture(normalTexture),
 		occlusionTexture(occlusionTexture),
 		emissiveTexture(emissiveTexture),
-		propertiesBuffers(propertiesBuffers),
-		sets() {}
+		properties(properties) {}
 
 	void destroy(VkDevice device);
-	MaterialProperties *getProperties(int index) { return propertiesBuffers[index].getData(); }
 
 	Texture colorTexture;
 	Texture metallicRoughnessTexture;
@@ -43,6 +40,8 @@ public:
 	Texture occlusionTexture;
 	Texture emissiveTexture;
 
-	std::vector<UniformBuffer<MaterialProperties>> propertiesBuffers;
-	std::vector<VkDescriptorSet> sets;
-};
+	// Copied into the material table, edits are uploaded through Renderer::updateMaterial
+	MaterialProperties properties;
+	VkDescriptorSet set = VK_NULL_HANDLE; // Textures and the material table, unused with bindless materials
+	uint32_t id = 0; // Record in the material table, also orders draws by material in the render queue
+};
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "material_table.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "log.h"
+#include "graphics/bindless_materials.h"
+
+
+void MaterialTable::init(const Device &device, BindlessMaterials *bindlessMaterials, uint32_t frameCount) {
+	m_device = device;
+	m_bindlessMaterials = bindlessMaterials;
+	m_retiredRecords.resize(frameCount);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = MATERIAL_TABLE_MAX_MATERIALS * sizeof(MaterialRecord);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(m_device.getLogicalDevice(), &bufferInfo, nullptr, &m_buffer) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create material table buffer");
+		throw std::runtime_error("Failed to create material table buffer");
+	}
+	m_memory = m_device.getAllocator().allocateBuffer(m_buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+void MaterialTable::destroy() {
+	vkDestroyBuffer(m_device.getLogicalDevice(), m_buffer, nullptr);
+	m_device.getAllocator().free(m_memory);
+}
+
+void MaterialTable::add(Material &material) {
+	if (!m_freeRecords.empty()) {
+		material.id = m_freeRecords.back();
+		m_freeRecords.pop_back();
+	}
+	else if (m_records.size() < MATERIAL_TABLE_MAX_MATERIALS) {
+		material.id = static_cast<uint32_t>(m_records.size());
+		m_records.emplace_back();
+	}
+	else {
+		LOG_ERROR("Material table is full");
+		throw std::runtime_error("Material table is full");
+	}
+
+	MaterialRecord &record = m_records[material.id];
+	record = MaterialRecord{};
+	if (m_bindlessMaterials) {
+		record.colorTexture = m_bindlessMaterials->acquireTexture(material.colorTexture);
+		record.metallicRoughnessTexture = m_bindlessMaterials->acquireTexture(material.metallicRoughnessTexture);
+		record.normalTexture = m_bindlessMaterials->acquireTexture(material.normalTexture);
+		record.occlusionTexture = m_bindlessMaterials->acquireTexture(material.occlusionTexture);
+		record.emissiveTexture = m_bindlessMaterials->acquireTexture(material.emissiveTexture);
+	}
+	writeProperties(record, material.properties);
+	m_dirtyRecords.push_back(material.id);
+}
+
+void MaterialTable::update(const Material &material) {
+	writeProperties(m_records[material.id], material.properties);
+	m_dirtyRecords.push_back(material.id);
+}
+
+void MaterialTable::remove(const Material &material) {
+	const MaterialRecord &record = m_records[material.id];
+	if (m_bindlessMaterials) {
+		m_bindlessMaterials->releaseTexture(record.colorTexture);
+		m_bindlessMaterials->releaseTexture(record.metallicRoughnessTexture);
+		m_bindlessMaterials->releaseTexture(record.normalTexture);
+		m_bindlessMaterials->releaseTexture(record.occlusionTexture);
+		m_bindlessMaterials->releaseTexture(record.emissiveTexture);
+	}
+	// Frames in flight may still shade with the record
+	m_retiredRecords[m_frame].push_back(material.id);
+}
+
+void MaterialTable::beginFrame(uint32_t frame) {
+	m_frame = frame;
+	m_freeRecords.insert(m_freeRecords.end(), m_retiredRecords[frame].begin(), m_retiredRecords[frame].end());
+	m_retiredRecords[frame].clear();
+}
+
+bool MaterialTable::flush(UploadQueue &uploadQueue) {
+	if (m_dirtyRecords.empty()) {
+		return false;
+	}
+
+	// Materials of a model are added together, so their records mostly form a few contiguous ranges
+	std::sort(m_dirtyRecords.begin(), m_dirtyRecords.end());
+	m_dirtyRecords.erase(std::unique(m_dirtyRecords.begin(), m_dirtyRecords.end()), m_dirtyRecords.end());
+
+	size_t first = 0;
+	for (size_t i = 1; i <= m_dirtyRecords.size(); ++i) {
+		if (i == m_dirtyRecords.size() || m_dirtyRecords[i] != m_dirtyRecords[i - 1] + 1) {
+			uint32_t firstRecord = m_dirtyRecords[first];
+			uint32_t recordCount = static_cast<uint32_t>(i - first);
+			// Edited records may still be read by the previous frame
+			uploadQueue.uploadBuffer(m_buffer, firstRecord * sizeof(MaterialRecord), &m_records[firstRecord],
+				recordCount * sizeof(MaterialRecord), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+			first = i;
+		}
+	}
+
+	m_dirtyRecords.clear();
+	return true;
+}
+
+void MaterialTable::writeProperties(MaterialRecord &record, const MaterialProperties &properties) {
+	record.colorFactor = properties.colorFactor;
+	record.emissiveFactor = properties.emissiveFactor;
+	record.metallicFactor = properties.metallicFactor;
+	record.roughnessFactor = properties.roughnessFactor;
+	record.doubleSided = properties.dubbleSided ? 1 : 0;
+}
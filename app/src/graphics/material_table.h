@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/vulkan.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+#include "graphics/device.h"
+#include "graphics/memory.h"
+#include "graphics/material.h"
+#include "graphics/upload_queue.h"
+
+
+#define MATERIAL_TABLE_MAX_MATERIALS (1u << 16)
+
+class BindlessMaterials;
+
+// One material as read by the fragment shaders, std430. Textures are indices into the bindless texture array and
+// unused when materials bind their own textures.
+struct MaterialRecord {
+	glm::vec4 colorFactor;
+	glm::vec4 emissiveFactor;
+	float metallicFactor;
+	float roughnessFactor;
+	uint32_t colorTexture;
+	uint32_t metallicRoughnessTexture;
+	uint32_t normalTexture;
+	uint32_t occlusionTexture;
+	uint32_t emissiveTexture;
+	uint32_t doubleSided;
+};
+
+static_assert(sizeof(MaterialRecord) == 64, "Material record layout must match the shaders");
+
+// Parameters of every loaded material in one device local storage buffer, indexed by the id of the material.
+// A CPU copy of the records is kept, added and edited records are marked dirty and uploaded in contiguous ranges
+// by flush, so the buffer is only written when a material changes. Used from the render thread.
+class MaterialTable {
+public:
+	// Texture indices of records are taken from the bindless materials when given
+	void init(const Device &device, BindlessMaterials *bindlessMaterials, uint32_t frameCount);
+	void destroy();
+
+	// Assigns the id of the material
+	void add(Material &material);
+	// Call after editing the properties of an added material
+	void update(const Material &material);
+	// The record is reused once the frames in flight are done with it
+	void remove(const Material &material);
+	// Call after waiting for the fence of the frame
+	void beginFrame(uint32_t frame);
+
+	// Queues the upload of dirty records, false when nothing was dirty
+	bool flush(UploadQueue &uploadQueue);
+
+	VkBuffer getBuffer() const { return m_buffer; }
+
+private:
+	void writeProperties(MaterialRecord &record, const MaterialProperties &properties);
+
+	Device m_device;
+	BindlessMaterials *m_bindlessMaterials = nullptr;
+
+	VkBuffer m_buffer = VK_NULL_HANDLE;
+	MemoryAllocation m_memory;
+
+	std::vector<MaterialRecord> m_records;
+	std::vector<uint32_t> m_freeRecords;
+	std::vector<std::vector<uint32_t>> m_retiredRecords; // Removed while each frame slot was current
+	uint32_t m_frame = 0;
+	std::vector<uint32_t> m_dirtyRecords;
+};
@@ -1,16 +1,341 @@
 #include "memory.h"
 
 #include <stdexcept>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "log.h"
 
 
-uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkPhysicalDevice device) {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+static uint32_t highestBit(uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return static_cast<uint32_t>(index);
+#else
+	return 63 - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+}
+
+static uint32_t lowestBit(uint64_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return static_cast<uint32_t>(index);
+#else
+	return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+
+void TlsfAllocator::init(VkDeviceSize size) {
+	m_nodes.clear();
+	m_unusedNodes.clear();
+	m_usedCount = 0;
+
+	m_firstLevelBitmap = 0;
+	m_secondLevelBitmaps.fill(0);
+	for (auto &heads : m_freeHeads) {
+		heads.fill(INVALID_NODE);
+	}
+
+	uint32_t root = createNode();
+	m_nodes[root].offset = 0;
+	m_nodes[root].size = size & ~(MEMORY_MIN_ALLOCATION_SIZE - 1);
+	insertFree(root);
+}
+
+// Maps a size to its free list, the first level is the power of two and the second a linear subdivision of it
+static void mapSize(VkDeviceSize size, uint32_t secondLevelBits, uint32_t &firstLevel, uint32_t &secondLevel) {
+	firstLevel = highestBit(size);
+	secondLevel = static_cast<uint32_t>(size >> (firstLevel - secondLevelBits)) ^ (1u << secondLevelBits);
+}
+
+uint32_t TlsfAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) {
+	size = alignUp(std::max<VkDeviceSize>(size, MEMORY_MIN_ALLOCATION_SIZE), MEMORY_MIN_ALLOCATION_SIZE);
+	alignment = std::max<VkDeviceSize>(alignment, MEMORY_MIN_ALLOCATION_SIZE);
+
+	// Free ranges always start at a multiple of the minimum size, which bounds the alignment padding
+	uint32_t node = findFree(size + alignment - MEMORY_MIN_ALLOCATION_SIZE);
+	if (node == INVALID_NODE) {
+		return INVALID_NODE;
+	}
+	removeFree(node);
+
+	VkDeviceSize padding = alignUp(m_nodes[node].offset, alignment) - m_nodes[node].offset;
+	if (padding) {
+		// The physical neighbours of a free range are never free, so the padding becomes a range of its own
+		uint32_t front = createNode();
+		m_nodes[front].offset = m_nodes[node].offset;
+		m_nodes[front].size = padding;
+		m_nodes[front].previousPhysical = m_nodes[node].previousPhysical;
+		m_nodes[front].nextPhysical = node;
+		if (m_nodes[front].previousPhysical != INVALID_NODE) {
+			m_nodes[m_nodes[front].previousPhysical].nextPhysical = front;
+		}
+		m_nodes[node].previousPhysical = front;
+		m_nodes[node].offset += padding;
+		m_nodes[node].size -= padding;
+		insertFree(front);
+	}
+
+	if (m_nodes[node].size > size) {
+		uint32_t back = createNode();
+		m_nodes[back].offset = m_nodes[node].offset + size;
+		m_nodes[back].size = m_nodes[node].size - size;
+		m_nodes[back].previousPhysical = node;
+		m_nodes[back].nextPhysical = m_nodes[node].nextPhysical;
+		if (m_nodes[back].nextPhysical != INVALID_NODE) {
+			m_nodes[m_nodes[back].nextPhysical].previousPhysical = back;
+		}
+		m_nodes[node].nextPhysical = back;
+		m_nodes[node].size = size;
+		insertFree(back);
+	}
+
+	m_nodes[node].free = false;
+	++m_usedCount;
+
+	offset = m_nodes[node].offset;
+	return node;
+}
+
+void TlsfAllocator::free(uint32_t node) {
+	--m_usedCount;
+
+	uint32_t next = m_nodes[node].nextPhysical;
+	if (next != INVALID_NODE && m_nodes[next].free) {
+		removeFree(next);
+		m_nodes[node].size += m_nodes[next].size;
+		m_nodes[node].nextPhysical = m_nodes[next].nextPhysical;
+		if (m_nodes[node].nextPhysical != INVALID_NODE) {
+			m_nodes[m_nodes[node].nextPhysical].previousPhysical = node;
+		}
+		releaseNode(next);
+	}
+
+	uint32_t previous = m_nodes[node].previousPhysical;
+	if (previous != INVALID_NODE && m_nodes[previous].free) {
+		removeFree(previous);
+		m_nodes[previous].size += m_nodes[node].size;
+		m_nodes[previous].nextPhysical = m_nodes[node].nextPhysical;
+		if (m_nodes[previous].nextPhysical != INVALID_NODE) {
+			m_nodes[m_nodes[previous].nextPhysical].previousPhysical = previous;
+		}
+		releaseNode(node);
+		node = previous;
+	}
+
+	insertFree(node);
+}
+
+uint32_t TlsfAllocator::createNode() {
+	if (!m_unusedNodes.empty()) {
+		uint32_t node = m_unusedNodes.back();
+		m_unusedNodes.pop_back();
+		m_nodes[node] = Node{};
+		return node;
+	}
+
+	m_nodes.emplace_back();
+	return static_cast<uint32_t>(m_nodes.size() - 1);
+}
+
+void TlsfAllocator::releaseNode(uint32_t node) {
+	m_unusedNodes.push_back(node);
+}
+
+void TlsfAllocator::insertFree(uint32_t node) {
+	uint32_t firstLevel, secondLevel;
+	mapSize(m_nodes[node].size, SECOND_LEVEL_BITS, firstLevel, secondLevel);
+
+	uint32_t &head = m_freeHeads[firstLevel][secondLevel];
+	m_nodes[node].free = true;
+	m_nodes[node].previousFree = INVALID_NODE;
+	m_nodes[node].nextFree = head;
+	if (head != INVALID_NODE) {
+		m_nodes[head].previousFree = node;
+	}
+	head = node;
+
+	m_firstLevelBitmap |= 1ull << firstLevel;
+	m_secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+}
+
+void TlsfAllocator::removeFree(uint32_t node) {
+	uint32_t firstLevel, secondLevel;
+	mapSize(m_nodes[node].size, SECOND_LEVEL_BITS, firstLevel, secondLevel);
+
+	Node &entry = m_nodes[node];
+	if (entry.previousFree != INVALID_NODE) {
+		m_nodes[entry.previousFree].nextFree = entry.nextFree;
+	}
+	if (entry.nextFree != INVALID_NODE) {
+		m_nodes[entry.nextFree].previousFree = entry.previousFree;
+	}
+
+	uint32_t &head = m_freeHeads[firstLevel][secondLevel];
+	if (head == node) {
+		head = entry.nextFree;
+		if (head == INVALID_NODE) {
+			m_secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+			if (!m_secondLevelBitmaps[firstLevel]) {
+				m_firstLevelBitmap &= ~(1ull << firstLevel);
+			}
+		}
+	}
+
+	entry.free = false;
+	entry.previousFree = INVALID_NODE;
+	entry.nextFree = INVALID_NODE;
+}
+
+uint32_t TlsfAllocator::findFree(VkDeviceSize size) {
+	// Round up to the next list so every range in it is large enough
+	uint32_t firstLevel = highestBit(size);
+	size += (1ull << (firstLevel - SECOND_LEVEL_BITS)) - 1;
+
+	uint32_t secondLevel;
+	mapSize(size, SECOND_LEVEL_BITS, firstLevel, secondLevel);
+
+	uint32_t secondLevelMap = m_secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+	if (!secondLevelMap) {
+		uint64_t firstLevelMap = firstLevel + 1 < FIRST_LEVEL_COUNT ? m_firstLevelBitmap & (~0ull << (firstLevel + 1)) : 0;
+		if (!firstLevelMap) {
+			return INVALID_NODE;
+		}
+
+		firstLevel = lowestBit(firstLevelMap);
+		secondLevelMap = m_secondLevelBitmaps[firstLevel];
+	}
+
+	return m_freeHeads[firstLevel][lowestBit(secondLevelMap)];
+}
+
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device) {
+	m_device = device;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+
+	m_pools.resize(m_memoryProperties.memoryTypeCount * 2);
+	for (uint32_t i = 0; i < m_pools.size(); ++i) {
+		m_pools[i].memoryType = i / 2;
+	}
+
+	m_heapStats.resize(m_memoryProperties.memoryHeapCount);
+	for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; ++i) {
+		m_heapStats[i].heapSize = m_memoryProperties.memoryHeaps[i].size;
+	}
+}
+
+void MemoryAllocator::destroy() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (uint32_t i = 0; i < m_heapStats.size(); ++i) {
+		if (m_heapStats[i].allocationCount) {
+			LOG_WARN("Memory heap {} destroyed with {} live allocations", i, m_heapStats[i].allocationCount);
+		}
+	}
+
+	for (auto &pool : m_pools) {
+		for (auto &block : pool.blocks) {
+			if (block) {
+				vkFreeMemory(m_device, block->memory, nullptr);
+			}
+		}
+	}
+	m_pools.clear();
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear) {
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	uint32_t poolIndex = memoryType * 2 + (linear ? 0 : 1);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
 
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+	MemoryAllocation allocation;
+	VkDeviceSize slotSize = std::max(requirements.size, requirements.alignment);
+	if (slotSize <= MEMORY_SMALL_ALLOCATION_SIZE) {
+		uint32_t sizeClass = slotSize <= MEMORY_MIN_ALLOCATION_SIZE ? 0 : highestBit(slotSize - 1) + 1 - highestBit(MEMORY_MIN_ALLOCATION_SIZE);
+		allocation = allocateSlot(poolIndex, sizeClass);
+	}
+	else if (requirements.size > getBlockSize(memoryType) / 2) {
+		std::byte *mapped = nullptr;
+		allocation.memory = allocateMemory(requirements.size, memoryType, mapped);
+		allocation.mapped = mapped;
+		allocation.kind = MemoryAllocation::Kind::DEDICATED;
+		allocation.pool = poolIndex;
+	}
+	else {
+		allocation = allocateFromBlocks(poolIndex, requirements.size, requirements.alignment);
+	}
+
+	allocation.size = requirements.size;
+	allocation.allocator = this;
+
+	MemoryHeapStats &stats = m_heapStats[m_memoryProperties.memoryTypes[memoryType].heapIndex];
+	stats.usedBytes += allocation.size;
+	++stats.allocationCount;
+
+	return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties) {
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
+
+	MemoryAllocation allocation = allocate(memRequirements, properties, true);
+	vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset);
+	return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateImage(VkImage image, VkMemoryPropertyFlags properties) {
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(m_device, image, &memRequirements);
+
+	// Images are always created with optimal tiling
+	MemoryAllocation allocation = allocate(memRequirements, properties, false);
+	vkBindImageMemory(m_device, image, allocation.memory, allocation.offset);
+	return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation &allocation) {
+	if (!allocation) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	uint32_t memoryType = m_pools[allocation.pool].memoryType;
+	MemoryHeapStats &stats = m_heapStats[m_memoryProperties.memoryTypes[memoryType].heapIndex];
+	stats.usedBytes -= allocation.size;
+	--stats.allocationCount;
+
+	switch (allocation.kind) {
+	case MemoryAllocation::Kind::DEDICATED:
+		freeMemory(allocation.memory, allocation.size, memoryType);
+		break;
+	case MemoryAllocation::Kind::BLOCK:
+		freeFromBlocks(allocation);
+		break;
+	case MemoryAllocation::Kind::SLOT:
+		freeSlot(allocation);
+		break;
+	}
+
+	allocation = MemoryAllocation{};
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+	for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
 			return i;
 		}
 	}
@@ -18,3 +343,193 @@ uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, V
 	LOG_ERROR("Failed to find suitable memory type");
 	throw std::runtime_error("Failed to find suitable memory type");
 }
+
+std::vector<MemoryHeapStats> MemoryAllocator::getHeapStats() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_heapStats;
+}
+
+void MemoryAllocator::logStats() const {
+	std::vector<MemoryHeapStats> heapStats = getHeapStats();
+
+	for (uint32_t i = 0; i < heapStats.size(); ++i) {
+		const MemoryHeapStats &stats = heapStats[i];
+		if (!stats.memoryCount) {
+			continue;
+		}
+
+		LOG_INFO("Memory heap {}: {} resources using {:.1f} MiB of {:.1f} MiB reserved in {} allocations ({:.1f} MiB heap)",
+			i, stats.allocationCount,
+			stats.usedBytes / (1024.0 * 1024.0),
+			stats.reservedBytes / (1024.0 * 1024.0),
+			stats.memoryCount,
+			stats.heapSize / (1024.0 * 1024.0));
+	}
+}
+
+VkDeviceSize MemoryAllocator::getBlockSize(uint32_t memoryType) const {
+	// Keep small heaps (like the host visible device local window) from being used up by one block
+	VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[m_memoryProperties.memoryTypes[memoryType].heapIndex].size;
+	return std::min<VkDeviceSize>(MEMORY_BLOCK_SIZE, heapSize / 8);
+}
+
+VkDeviceMemory MemoryAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryType, std::byte *&mapped) {
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		LOG_ERROR("Failed to allocate device memory ({} bytes, type {})", size, memoryType);
+		throw std::runtime_error("Failed to allocate device memory");
+	}
+
+	mapped = nullptr;
+	if (m_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, (void **)&mapped);
+	}
+
+	MemoryHeapStats &stats = m_heapStats[m_memoryProperties.memoryTypes[memoryType].heapIndex];
+	stats.reservedBytes += size;
+	++stats.memoryCount;
+
+	return memory;
+}
+
+void MemoryAllocator::freeMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType) {
+	vkFreeMemory(m_device, memory, nullptr);
+
+	MemoryHeapStats &stats = m_heapStats[m_memoryProperties.memoryTypes[memoryType].heapIndex];
+	stats.reservedBytes -= size;
+	--stats.memoryCount;
+}
+
+MemoryAllocation MemoryAllocator::allocateFromBlocks(uint32_t poolIndex, VkDeviceSize size, VkDeviceSize alignment) {
+	Pool &pool = m_pools[poolIndex];
+
+	MemoryAllocation allocation;
+	allocation.kind = MemoryAllocation::Kind::BLOCK;
+	allocation.pool = poolIndex;
+	allocation.size = size;
+
+	for (uint32_t i = 0; i < pool.blocks.size(); ++i) {
+		Block *block = pool.blocks[i].get();
+		if (!block) {
+			continue;
+		}
+
+		uint32_t node = block->allocator.allocate(size, alignment, allocation.offset);
+		if (node != TlsfAllocator::INVALID_NODE) {
+			allocation.memory = block->memory;
+			allocation.mapped = block->mapped ? block->mapped + allocation.offset : nullptr;
+			allocation.block = i;
+			allocation.node = node;
+			return allocation;
+		}
+	}
+
+	auto block = std::make_unique<Block>();
+	block->size = getBlockSize(pool.memoryType);
+	block->memory = allocateMemory(block->size, pool.memoryType, block->mapped);
+	block->allocator.init(block->size);
+
+	// Reuse the slot of a released block
+	auto freeSlot = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+	if (freeSlot == pool.blocks.end()) {
+		freeSlot = pool.blocks.insert(pool.blocks.end(), nullptr);
+	}
+	*freeSlot = std::move(block);
+	uint32_t blockIndex = static_cast<uint32_t>(freeSlot - pool.blocks.begin());
+
+	Block &newBlock = *pool.blocks[blockIndex];
+	uint32_t node = newBlock.allocator.allocate(size, alignment, allocation.offset);
+	if (node == TlsfAllocator::INVALID_NODE) {
+		LOG_ERROR("Allocation of {} bytes does not fit in a memory block", size);
+		throw std::runtime_error("Allocation does not fit in a memory block");
+	}
+
+	allocation.memory = newBlock.memory;
+	allocation.mapped = newBlock.mapped ? newBlock.mapped + allocation.offset : nullptr;
+	allocation.block = blockIndex;
+	allocation.node = node;
+	return allocation;
+}
+
+MemoryAllocation MemoryAllocator::allocateSlot(uint32_t poolIndex, uint32_t sizeClass) {
+	Pool &pool = m_pools[poolIndex];
+	VkDeviceSize slotSize = MEMORY_MIN_ALLOCATION_SIZE << sizeClass;
+
+	std::vector<uint32_t> &availablePages = pool.availablePages[sizeClass];
+	if (availablePages.empty()) {
+		// Pages are aligned to the slot size, so every slot satisfies any alignment up to its size
+		auto page = std::make_unique<Page>();
+		page->allocation = allocateFromBlocks(poolIndex, MEMORY_PAGE_SIZE, slotSize);
+		page->sizeClass = sizeClass;
+
+		uint32_t slotCount = static_cast<uint32_t>(MEMORY_PAGE_SIZE / slotSize);
+		for (uint32_t i = slotCount; i > 0; --i) {
+			page->freeSlots.push_back(static_cast<uint16_t>(i - 1));
+		}
+
+		auto freeSlot = std::find(pool.pages.begin(), pool.pages.end(), nullptr);
+		if (freeSlot == pool.pages.end()) {
+			freeSlot = pool.pages.insert(pool.pages.end(), nullptr);
+		}
+		*freeSlot = std::move(page);
+		availablePages.push_back(static_cast<uint32_t>(freeSlot - pool.pages.begin()));
+	}
+
+	uint32_t pageIndex = availablePages.back();
+	Page &page = *pool.pages[pageIndex];
+
+	uint16_t slot = page.freeSlots.back();
+	page.freeSlots.pop_back();
+	if (page.freeSlots.empty()) {
+		availablePages.pop_back();
+	}
+
+	MemoryAllocation allocation;
+	allocation.memory = page.allocation.memory;
+	allocation.offset = page.allocation.offset + slot * slotSize;
+	allocation.mapped = page.allocation.mapped ? static_cast<std::byte *>(page.allocation.mapped) + slot * slotSize : nullptr;
+	allocation.kind = MemoryAllocation::Kind::SLOT;
+	allocation.pool = poolIndex;
+	allocation.block = pageIndex;
+	allocation.node = slot;
+	return allocation;
+}
+
+void MemoryAllocator::freeFromBlocks(MemoryAllocation &allocation) {
+	Pool &pool = m_pools[allocation.pool];
+	Block &block = *pool.blocks[allocation.block];
+	block.allocator.free(allocation.node);
+
+	// Empty blocks are returned to the driver, except for the last one of the pool
+	if (block.allocator.empty()) {
+		size_t liveBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(), [](const std::unique_ptr<Block> &block) { return block != nullptr; });
+		if (liveBlocks > 1) {
+			freeMemory(block.memory, block.size, pool.memoryType);
+			pool.blocks[allocation.block].reset();
+		}
+	}
+}
+
+void MemoryAllocator::freeSlot(MemoryAllocation &allocation) {
+	Pool &pool = m_pools[allocation.pool];
+	Page &page = *pool.pages[allocation.block];
+	std::vector<uint32_t> &availablePages = pool.availablePages[page.sizeClass];
+
+	page.freeSlots.push_back(static_cast<uint16_t>(allocation.node));
+	if (page.freeSlots.size() == 1) {
+		availablePages.push_back(allocation.block);
+	}
+
+	// Release empty pages as long as another page of the size class has room
+	VkDeviceSize slotSize = MEMORY_MIN_ALLOCATION_SIZE << page.sizeClass;
+	if (page.freeSlots.size() == MEMORY_PAGE_SIZE / slotSize && availablePages.size() > 1) {
+		availablePages.erase(std::find(availablePages.begin(), availablePages.end(), allocation.block));
+		freeFromBlocks(page.allocation);
+		pool.pages[allocation.block].reset();
+	}
+}
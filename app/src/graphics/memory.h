@@ -2,7 +2,161 @@
 
 #include <glad/vulkan.h>
 
+#include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
 #include "graphics/device.h"
 
 
-uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkPhysicalDevice device);
+// Size of the VkDeviceMemory blocks sub-allocated from, requests above half a block get their own memory
+#define MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+// Requests up to this size are served from fixed size slots in pages of MEMORY_PAGE_SIZE
+#define MEMORY_SMALL_ALLOCATION_SIZE (16ull * 1024)
+#define MEMORY_PAGE_SIZE (256ull * 1024)
+#define MEMORY_MIN_ALLOCATION_SIZE 256ull
+
+
+class MemoryAllocator;
+
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// Host visible memory is persistently mapped, points at offset
+	void *mapped = nullptr;
+
+	MemoryAllocator *allocator = nullptr;
+
+	explicit operator bool() const noexcept { return memory != VK_NULL_HANDLE; }
+
+private:
+	friend class MemoryAllocator;
+
+	enum class Kind : uint8_t { DEDICATED, BLOCK, SLOT };
+
+	Kind kind = Kind::DEDICATED;
+	uint32_t pool = 0;
+	uint32_t block = 0;
+	uint32_t node = 0;
+};
+
+struct MemoryHeapStats {
+	VkDeviceSize heapSize = 0;
+	VkDeviceSize reservedBytes = 0;  // Bytes held in VkDeviceMemory objects
+	VkDeviceSize usedBytes = 0;      // Bytes handed out to resources
+	uint32_t memoryCount = 0;
+	uint32_t allocationCount = 0;
+};
+
+
+// Two level segregated fit allocator over a linear range, used to sub-allocate memory blocks.
+// Allocation and free are O(1) and neighbouring free ranges are merged immediately.
+class TlsfAllocator {
+public:
+	static const uint32_t INVALID_NODE = UINT32_MAX;
+
+	void init(VkDeviceSize size);
+
+	// Returns INVALID_NODE when no free range fits
+	uint32_t allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset);
+	void free(uint32_t node);
+
+	bool empty() const { return m_usedCount == 0; }
+
+private:
+	static const uint32_t SECOND_LEVEL_BITS = 4;
+	static const uint32_t SECOND_LEVEL_COUNT = 1 << SECOND_LEVEL_BITS;
+	static const uint32_t FIRST_LEVEL_COUNT = 64;
+
+	struct Node {
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		uint32_t previousPhysical = INVALID_NODE;
+		uint32_t nextPhysical = INVALID_NODE;
+		uint32_t previousFree = INVALID_NODE;
+		uint32_t nextFree = INVALID_NODE;
+		bool free = false;
+	};
+
+	uint32_t createNode();
+	void releaseNode(uint32_t node);
+
+	void insertFree(uint32_t node);
+	void removeFree(uint32_t node);
+	uint32_t findFree(VkDeviceSize size);
+
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_unusedNodes;
+	uint32_t m_usedCount = 0;
+
+	uint64_t m_firstLevelBitmap = 0;
+	std::array<uint32_t, FIRST_LEVEL_COUNT> m_secondLevelBitmaps{};
+	std::array<std::array<uint32_t, SECOND_LEVEL_COUNT>, FIRST_LEVEL_COUNT> m_freeHeads;
+};
+
+
+// Sub-allocates device memory so resources share a small number of VkDeviceMemory objects.
+// Small requests use size class pages, larger ones a TLSF allocator per block. Linear (buffer) and
+// optimal (image) resources are kept in separate pools, which keeps bufferImageGranularity out of the way.
+// All functions are thread safe.
+class MemoryAllocator {
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice device);
+	void destroy();
+
+	MemoryAllocation allocate(const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties, bool linear);
+	// Allocates and binds memory for the resource
+	MemoryAllocation allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+	MemoryAllocation allocateImage(VkImage image, VkMemoryPropertyFlags properties);
+	void free(MemoryAllocation &allocation);
+
+	// Uses the memory properties cached at init
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	std::vector<MemoryHeapStats> getHeapStats() const;
+	void logStats() const;
+
+private:
+	static const uint32_t SIZE_CLASS_COUNT = 7; // 256 B to 16 KiB
+
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		std::byte *mapped = nullptr;
+		TlsfAllocator allocator;
+	};
+
+	struct Page {
+		MemoryAllocation allocation;
+		uint32_t sizeClass = 0;
+		std::vector<uint16_t> freeSlots;
+	};
+
+	struct Pool {
+		uint32_t memoryType = 0;
+		std::vector<std::unique_ptr<Block>> blocks;
+		std::vector<std::unique_ptr<Page>> pages;
+		// Pages with at least one free slot, per size class
+		std::array<std::vector<uint32_t>, SIZE_CLASS_COUNT> availablePages;
+	};
+
+	VkDeviceSize getBlockSize(uint32_t memoryType) const;
+	VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType, std::byte *&mapped);
+	void freeMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType);
+
+	MemoryAllocation allocateFromBlocks(uint32_t poolIndex, VkDeviceSize size, VkDeviceSize alignment);
+	MemoryAllocation allocateSlot(uint32_t poolIndex, uint32_t sizeClass);
+	void freeFromBlocks(MemoryAllocation &allocation);
+	void freeSlot(MemoryAllocation &allocation);
+
+	VkDevice m_device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties m_memoryProperties{};
+
+	std::vector<Pool> m_pools; // Two per memory type, linear followed by optimal
+	std::vector<MemoryHeapStats> m_heapStats;
+
+	mutable std::mutex m_mutex;
+};
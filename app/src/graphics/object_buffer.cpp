@@ -0,0 +1,81 @@
+#include "object_buffer.h"
+
+#include <stdexcept>
+
+#include "log.h"
+
+
+void ObjectBuffer::init(const Device &device, DescriptorLayoutCache *layoutCache, DescriptorAllocator *allocator, uint32_t frameCount) {
+	m_device = device;
+	m_layoutCache = layoutCache;
+	m_allocator = allocator;
+
+	m_frames.resize(frameCount);
+	for (Frame &frame : m_frames) {
+		createBuffer(frame, OBJECT_BUFFER_INITIAL_OBJECTS);
+	}
+}
+
+void ObjectBuffer::destroy() {
+	for (Frame &frame : m_frames) {
+		vkDestroyBuffer(m_device.getLogicalDevice(), frame.buffer, nullptr);
+		m_device.getAllocator().free(frame.memory);
+		releaseRetired(frame);
+	}
+	m_frames.clear();
+}
+
+void ObjectBuffer::beginFrame(uint32_t frame) {
+	m_frame = frame;
+	releaseRetired(m_frames[m_frame]);
+}
+
+void ObjectBuffer::reserve(uint32_t count) {
+	Frame &frame = m_frames[m_frame];
+	if (count <= frame.capacity) {
+		return;
+	}
+
+	// The old buffer may be referenced by the command buffer being recorded, it lives until the frame comes around
+	frame.retired.push_back({ frame.buffer, frame.memory });
+
+	uint32_t capacity = frame.capacity;
+	while (capacity < count) {
+		capacity *= 2;
+	}
+	createBuffer(frame, capacity);
+	LOG_DEBUG("Object buffer grown to {} objects", capacity);
+}
+
+void ObjectBuffer::createBuffer(Frame &frame, uint32_t capacity) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = capacity * sizeof(ObjectData);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(m_device.getLogicalDevice(), &bufferInfo, nullptr, &frame.buffer) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create object buffer");
+		throw std::runtime_error("Failed to create object buffer");
+	}
+	frame.memory = m_device.getAllocator().allocateBuffer(frame.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	frame.capacity = capacity;
+
+	VkDescriptorBufferInfo objectInfo{};
+	objectInfo.buffer = frame.buffer;
+	objectInfo.offset = 0;
+	objectInfo.range = VK_WHOLE_SIZE;
+
+	// A new set rather than an update, the previous one may already be bound
+	DescriptorBuilder::begin(m_layoutCache, m_allocator)
+		.bindBuffer(0, &objectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT)
+		.build(frame.set, m_layout);
+}
+
+void ObjectBuffer::releaseRetired(Frame &frame) {
+	for (RetiredBuffer &retired : frame.retired) {
+		vkDestroyBuffer(m_device.getLogicalDevice(), retired.buffer, nullptr);
+		m_device.getAllocator().free(retired.memory);
+	}
+	frame.retired.clear();
+}
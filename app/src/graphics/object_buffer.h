@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glad/vulkan.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+#include "graphics/device.h"
+#include "graphics/memory.h"
+#include "graphics/descriptors.h"
+
+
+// Objects per frame to start with, a frame with more draws grows its buffer
+#define OBJECT_BUFFER_INITIAL_OBJECTS (1u << 17)
+
+// Per draw data read by the vertex shader at gl_InstanceIndex, std430. Written by the CPU for the draws of the
+// render queue and by instance culling for GPU driven draws.
+struct ObjectData {
+	glm::mat4 matrix; // Model to world, including the dequantization of packed positions
+	uint32_t materialIndex;
+	uint32_t padding[3];
+};
+
+static_assert(sizeof(ObjectData) == 80, "Object layout must match the shaders");
+
+// Host visible object data of every frame in flight, mapped for the lifetime of the buffer. Draws select their
+// object through firstInstance, so no per draw state is recorded besides the draw itself.
+class ObjectBuffer {
+public:
+	void init(const Device &device, DescriptorLayoutCache *layoutCache, DescriptorAllocator *allocator, uint32_t frameCount);
+	void destroy();
+
+	// Call after waiting for the fence of the frame
+	void beginFrame(uint32_t frame);
+	// Grows the buffer of the current frame to hold the objects, which replaces its set
+	void reserve(uint32_t count);
+	// Objects of the current frame, written directly
+	ObjectData *getObjects() const { return static_cast<ObjectData *>(m_frames[m_frame].memory.mapped); }
+
+	// The same layout holds the objects written by instance culling
+	VkDescriptorSetLayout getLayout() const { return m_layout; }
+	VkDescriptorSet getSet() const { return m_frames[m_frame].set; }
+
+private:
+	struct RetiredBuffer {
+		VkBuffer buffer;
+		MemoryAllocation memory;
+	};
+
+	struct Frame {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkDescriptorSet set = VK_NULL_HANDLE;
+		uint32_t capacity = 0;
+		std::vector<RetiredBuffer> retired; // Replaced by growth, destroyed when the frame comes around
+	};
+
+	void createBuffer(Frame &frame, uint32_t capacity);
+	void releaseRetired(Frame &frame);
+
+	Device m_device;
+	DescriptorLayoutCache *m_layoutCache = nullptr;
+	DescriptorAllocator *m_allocator = nullptr;
+	std::vector<Frame> m_frames;
+	VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+	uint32_t m_frame = 0;
+};
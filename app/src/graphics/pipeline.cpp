@@ -1,6 +1,7 @@
 #include "pipeline.h"
 
 #include <fstream>
+#include <array>
 #include <stdexcept>
 
 #include "log.h"
@@ -24,9 +25,27 @@ static std::vector<char> readFile(const std::string &filename) {
 	return buffer;
 }
 
+static VkShaderModule createShaderModule(const Device &device, const std::vector<char> &code) {
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device.getLogicalDevice(), &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create shader module");
+		throw std::runtime_error("Failed to create shader module");
+	}
+
+	return shaderModule;
+}
+
 void Pipeline::init(const Device& device, const RenderPass &renderPass, const SwapChain &swapChain,
 	const std::string &vertexShader, const std::string &fragmentShader,
-	const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts) {
+	const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts,
+	const VkVertexInputBindingDescription *bindings, uint32_t bindingCount,
+	const VkVertexInputAttributeDescription *attributes, uint32_t attributeCount,
+	bool octahedralNormals) {
 
 	m_device = device;
 	
@@ -36,13 +55,30 @@ void Pipeline::init(const Device& device, const RenderPass &renderPass, const Sw
 	VkShaderModule vertShaderModule = createShaderModule(device, vertShaderCode);
 	VkShaderModule fragShaderModule = createShaderModule(device, fragShaderCode);
 
-	// Vertex shader
+	// Vertex shader, constant 0 selects how normals are decoded
+	std::array<VkBool32, 1> specializationConstants = {
+		static_cast<VkBool32>(octahedralNormals ? VK_TRUE : VK_FALSE)
+	};
+
+	std::array<VkSpecializationMapEntry, 1> specializationEntries{};
+	for (uint32_t i = 0; i < specializationEntries.size(); ++i) {
+		specializationEntries[i].constantID = i;
+		specializationEntries[i].offset = i * sizeof(VkBool32);
+		specializationEntries[i].size = sizeof(VkBool32);
+	}
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+	specializationInfo.pMapEntries = specializationEntries.data();
+	specializationInfo.dataSize = sizeof(specializationConstants);
+	specializationInfo.pData = specializationConstants.data();
+
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
 	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
 	vertShaderStageInfo.module = vertShaderModule;
 	vertShaderStageInfo.pName = "main";
-	vertShaderStageInfo.pSpecializationInfo = nullptr;
+	vertShaderStageInfo.pSpecializationInfo = &specializationInfo;
 
 	// Fragment shader
 	VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
@@ -55,15 +91,12 @@ void Pipeline::init(const Device& device, const RenderPass &renderPass, const Sw
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
 	// Vertex input
-	auto bindingDescription = Model::getBindingDescription();
-	auto attributeDescriptions = Model::getAttributeDescriptions();
-
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescription.size());
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexBindingDescriptions = bindingDescription.data();
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	vertexInputInfo.vertexBindingDescriptionCount = bindingCount;
+	vertexInputInfo.vertexAttributeDescriptionCount = attributeCount;
+	vertexInputInfo.pVertexBindingDescriptions = bindings;
+	vertexInputInfo.pVertexAttributeDescriptions = attributes;
 
 	// Input assembly
 	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
@@ -163,19 +196,13 @@ void Pipeline::init(const Device& device, const RenderPass &renderPass, const Sw
 	depthStencil.front = {}; // Optional
 	depthStencil.back = {}; // Optional
 
-	// Push constant
-	VkPushConstantRange pushConstantRange{};
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(glm::mat4);
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-	// Pipeline layout
+	// Pipeline layout, per draw data is read from the object buffer
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
 	pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutInfo.pushConstantRangeCount = 1;
-	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = nullptr;
 
 	if (vkCreatePipelineLayout(device.getLogicalDevice(), &pipelineLayoutInfo, nullptr, &m_layout) != VK_SUCCESS) {
 		LOG_ERROR("Failed to create pipeline layout");
@@ -220,17 +247,47 @@ void Pipeline::destory() {
 	vkDestroyPipelineLayout(m_device.getLogicalDevice(), m_layout, nullptr);
 }
 
-VkShaderModule Pipeline::createShaderModule(const Device &device, const std::vector<char> &code) {
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
+void ComputePipeline::init(const Device &device, const std::string &shader,
+	const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts, uint32_t pushConstantSize) {
 
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(device.getLogicalDevice(), &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-		LOG_ERROR("Failed to create shader module");
-		throw std::runtime_error("Failed to create shader module");
+	m_device = device;
+
+	VkShaderModule shaderModule = createShaderModule(device, readFile(shader));
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = pushConstantSize;
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = pushConstantSize ? 1 : 0;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device.getLogicalDevice(), &pipelineLayoutInfo, nullptr, &m_layout) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create compute pipeline layout");
+		throw std::runtime_error("Failed to create compute pipeline layout");
 	}
 
-	return shaderModule;
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = m_layout;
+
+	if (vkCreateComputePipelines(device.getLogicalDevice(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_pipeline) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create compute pipeline");
+		throw std::runtime_error("Failed to create compute pipeline");
+	}
+
+	vkDestroyShaderModule(device.getLogicalDevice(), shaderModule, nullptr);
+}
+
+void ComputePipeline::destroy() {
+	vkDestroyPipeline(m_device.getLogicalDevice(), m_pipeline, nullptr);
+	vkDestroyPipelineLayout(m_device.getLogicalDevice(), m_layout, nullptr);
 }
@@ -8,23 +8,54 @@
 #include "device.h"
 #include "render_pass.h"
 #include "swap_chain.h"
+#include "data/vertex_layout.h"
 
 
 class Pipeline {
 public:
+	// The vertex input state comes from the layout of the vertex format
+	template<VertexFormat Format>
 	void init(const Device &device, const RenderPass& renderPass, const SwapChain& swapChain,
 		const std::string& vertexShader, const std::string& fragmentShader,
-		const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts);
+		const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts) {
+
+		using Layout = VertexLayout<Format>;
+		init(device, renderPass, swapChain, vertexShader, fragmentShader, descriptorSetLayouts,
+			Layout::bindings.data(), static_cast<uint32_t>(Layout::bindings.size()),
+			Layout::attributes.data(), static_cast<uint32_t>(Layout::attributes.size()),
+			Layout::octahedralNormals);
+	}
 	void destory();
 
 	VkPipeline getPipeline() const { return m_pipeline; }
 	VkPipelineLayout getLayout() const { return m_layout; }
 
 private:
-	VkShaderModule createShaderModule(const Device &device, const std::vector<char> &code);
+	void init(const Device &device, const RenderPass &renderPass, const SwapChain &swapChain,
+		const std::string &vertexShader, const std::string &fragmentShader,
+		const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts,
+		const VkVertexInputBindingDescription *bindings, uint32_t bindingCount,
+		const VkVertexInputAttributeDescription *attributes, uint32_t attributeCount,
+		bool octahedralNormals);
 
 	Device m_device;
 
 	VkPipeline m_pipeline;
 	VkPipelineLayout m_layout;
 };
+
+class ComputePipeline {
+public:
+	void init(const Device &device, const std::string &shader,
+		const std::vector<VkDescriptorSetLayout> &descriptorSetLayouts, uint32_t pushConstantSize);
+	void destroy();
+
+	VkPipeline getPipeline() const { return m_pipeline; }
+	VkPipelineLayout getLayout() const { return m_layout; }
+
+private:
+	Device m_device;
+
+	VkPipeline m_pipeline = VK_NULL_HANDLE;
+	VkPipelineLayout m_layout = VK_NULL_HANDLE;
+};
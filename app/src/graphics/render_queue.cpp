@@ -0,0 +1,76 @@
+#include "render_queue.h"
+
+#include <array>
+
+
+void RenderQueue::clear() {
+	m_packets.clear();
+	m_transforms.clear();
+	m_entries.clear();
+	m_runs.clear();
+}
+
+uint32_t RenderQueue::addTransform(const glm::mat4 &matrix) {
+	m_transforms.push_back(matrix);
+	return static_cast<uint32_t>(m_transforms.size() - 1);
+}
+
+void RenderQueue::add(uint64_t key, const DrawPacket &packet) {
+	m_entries.push_back({ key, static_cast<uint32_t>(m_packets.size()) });
+	m_packets.push_back(packet);
+}
+
+void RenderQueue::sort() {
+	size_t count = m_entries.size();
+	if (count >= 2) {
+		sortEntries();
+	}
+
+	// Packets of a run are adjacent in key order, the comparison guards against truncated key fields
+	m_runs.clear();
+	for (size_t i = 0; i < count; ++i) {
+		const DrawPacket &packet = getPacket(i);
+		if (!m_runs.empty()) {
+			const DrawPacket &previous = getPacket(i - 1);
+			bool sameMaterial = m_mergeMaterials || packet.material == previous.material;
+			if (packet.mesh == previous.mesh && packet.lod == previous.lod && sameMaterial) {
+				++m_runs.back().packetCount;
+				continue;
+			}
+		}
+		m_runs.push_back({ static_cast<uint32_t>(i), 1, INVALID_DRAW });
+	}
+}
+
+// Eight passes over byte digits, least significant first. The histograms of all digits are gathered in one
+// read, and digits every key shares are skipped, which drops most passes when few fields vary.
+void RenderQueue::sortEntries() {
+	size_t count = m_entries.size();
+
+	std::array<std::array<uint32_t, 256>, 8> histograms{};
+	for (const SortEntry &entry : m_entries) {
+		for (int digit = 0; digit < 8; ++digit) {
+			++histograms[digit][(entry.key >> (digit * 8)) & 0xFF];
+		}
+	}
+
+	m_scratch.resize(count);
+	for (int digit = 0; digit < 8; ++digit) {
+		std::array<uint32_t, 256> &histogram = histograms[digit];
+		if (histogram[(m_entries[0].key >> (digit * 8)) & 0xFF] == count) {
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (uint32_t &bucket : histogram) {
+			uint32_t size = bucket;
+			bucket = offset;
+			offset += size;
+		}
+
+		for (const SortEntry &entry : m_entries) {
+			m_scratch[histogram[(entry.key >> (digit * 8)) & 0xFF]++] = entry;
+		}
+		m_entries.swap(m_scratch);
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "data/mesh.h"
+#include "graphics/material.h"
+
+
+// Sort key fields, most significant first. Draws are grouped by pass, then by the state they bind, and go front
+// to back within equal state. Fields are truncated to their width, which only costs sort quality.
+#define RENDER_QUEUE_PASS_BITS 2
+#define RENDER_QUEUE_PIPELINE_BITS 2
+#define RENDER_QUEUE_MATERIAL_BITS 20
+#define RENDER_QUEUE_GEOMETRY_BITS 24
+#define RENDER_QUEUE_DEPTH_BITS 16
+
+#define RENDER_QUEUE_PASS_OPAQUE 0
+
+// One mesh draw. Its node matrix is stored once per node in the queue.
+struct DrawPacket {
+	const Mesh *mesh;
+	const Material *material;
+	uint32_t transform;
+	uint32_t lod;
+};
+
+// Consecutive packets of the sorted queue drawing the same mesh LOD with the same material, unless materials are
+// merged, recorded as one instanced draw. Entities sharing a model end up in the same runs, since the key groups
+// equal geometry.
+struct DrawRun {
+	uint32_t firstPacket;
+	uint32_t packetCount;
+	uint32_t clusterDraw; // Slot in the cluster culler, RenderQueue::INVALID_DRAW when drawn from the arena
+};
+
+// Binds recorded for the draws of the queue in the last frame. Avoided binds are those skipped because the
+// previous draw already had the state bound, compared to binding everything for every draw.
+struct RenderQueueStats {
+	uint32_t draws = 0;
+	uint32_t instances = 0; // Packets drawn, more than the draws when runs were instanced
+	uint32_t pipelineBinds = 0;
+	uint32_t vertexBufferBinds = 0;
+	uint32_t indexBufferBinds = 0;
+	uint32_t materialBinds = 0;
+
+	uint32_t getBinds() const { return pipelineBinds + vertexBufferBinds + indexBufferBinds + materialBinds; }
+	uint32_t getBindsAvoided() const { return draws * 4 - getBinds(); }
+
+	RenderQueueStats &operator+=(const RenderQueueStats &other) {
+		draws += other.draws;
+		instances += other.instances;
+		pipelineBinds += other.pipelineBinds;
+		vertexBufferBinds += other.vertexBufferBinds;
+		indexBufferBinds += other.indexBufferBinds;
+		materialBinds += other.materialBinds;
+		return *this;
+	}
+};
+
+// Draw packets of a frame with 64 bit sort keys. Packets are sorted through a compact array of keys and packet
+// indices with an LSD radix sort, so the cost is linear in the draw count.
+class RenderQueue {
+public:
+	static const uint32_t INVALID_DRAW = UINT32_MAX;
+
+	void clear();
+	uint32_t addTransform(const glm::mat4 &matrix);
+	void add(uint64_t key, const DrawPacket &packet);
+	// Sorts the packets and splits them into runs
+	void sort();
+	// Runs may span materials when draws find their material through their object
+	void setMergeMaterials(bool enabled) { m_mergeMaterials = enabled; }
+
+	size_t size() const { return m_entries.size(); }
+	// In key order once sorted
+	const DrawPacket &getPacket(size_t index) const { return m_packets[m_entries[index].packet]; }
+	uint64_t getKey(size_t index) const { return m_entries[index].key; }
+	const glm::mat4 &getTransform(uint32_t transform) const { return m_transforms[transform]; }
+
+	std::vector<DrawRun> &getRuns() { return m_runs; }
+	const std::vector<DrawRun> &getRuns() const { return m_runs; }
+
+	static uint64_t makeKey(uint32_t pass, uint32_t pipeline, uint32_t material, uint32_t geometry, uint32_t depth) {
+		uint64_t key = pass & ((1u << RENDER_QUEUE_PASS_BITS) - 1);
+		key = (key << RENDER_QUEUE_PIPELINE_BITS) | (pipeline & ((1u << RENDER_QUEUE_PIPELINE_BITS) - 1));
+		key = (key << RENDER_QUEUE_MATERIAL_BITS) | (material & ((1u << RENDER_QUEUE_MATERIAL_BITS) - 1));
+		key = (key << RENDER_QUEUE_GEOMETRY_BITS) | (geometry & ((1u << RENDER_QUEUE_GEOMETRY_BITS) - 1));
+		key = (key << RENDER_QUEUE_DEPTH_BITS) | (depth & ((1u << RENDER_QUEUE_DEPTH_BITS) - 1));
+		return key;
+	}
+
+	// Bits of a non-negative float order like the float, the exponent and leading mantissa bits are kept
+	static uint32_t quantizeDepth(float depth) {
+		depth = depth > 0.0f ? depth : 0.0f;
+		uint32_t bits;
+		std::memcpy(&bits, &depth, sizeof(bits));
+		return bits >> (31 - RENDER_QUEUE_DEPTH_BITS);
+	}
+
+private:
+	void sortEntries();
+
+	struct SortEntry {
+		uint64_t key;
+		uint32_t packet;
+	};
+
+	std::vector<DrawPacket> m_packets;
+	std::vector<glm::mat4> m_transforms;
+	std::vector<SortEntry> m_entries;
+	std::vector<SortEntry> m_scratch;
+	std::vector<DrawRun> m_runs;
+	bool m_mergeMaterials = false;
+};
@@ -2,10 +2,20 @@
 
 #include <stdexcept>
 #include <array>
+#include <algorithm>
 
 #include "log.h"
 #include "data/model.h"
 
+
+// Coarser LODs are used while their error projects to less than this many pixels
+#define LOD_ERROR_THRESHOLD 1.0f
+
+// Parallel recording splits the render queue into slices of at least this many meshes, one secondary command
+// buffer each. Fewer meshes do not pay for the extra command buffer.
+#define RENDERER_MIN_MESHES_PER_SLICE 512
+#define RENDERER_MAX_RECORDING_SLICES 16
+
 VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType,
 	const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData, void *pUserData) {
 
@@ -53,6 +63,17 @@ static void destroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMesse
 
 
 Renderer::~Renderer() {
+	m_uploadQueue.destroy();
+	m_textureCache.destroy();
+	m_clusterCuller.destroy();
+	m_instanceCuller.destroy();
+	m_objectBuffer.destroy();
+	if (m_bindless) {
+		m_bindlessMaterials.destroy();
+	}
+	m_materialTable.destroy();
+	m_geometryArena.destroy();
+
 	m_descriptorLayoutCache.destroy();
 	m_descriptorAllocator.destroy();
 
@@ -66,6 +87,7 @@ Renderer::~Renderer() {
 	m_swapChain.destroy();
 
 	m_renderPass.destroy();
+	m_packedPipeline.destory();
 	m_pipeline.destory();
 
 	// Destroy sync objects
@@ -75,7 +97,12 @@ Renderer::~Renderer() {
 		vkDestroyFence(m_device.getLogicalDevice(), m_inFlightFences[i], nullptr);
 	}
 
-	// Destroy command pool
+	// Destroy command pools
+	for (const auto &pools : m_slicePools) {
+		for (VkCommandPool pool : pools) {
+			vkDestroyCommandPool(m_device.getLogicalDevice(), pool, nullptr);
+		}
+	}
 	vkDestroyCommandPool(m_device.getLogicalDevice(), m_commandPool, nullptr);
 
 	m_device.destroy();
@@ -184,19 +211,36 @@ void Renderer::init(const AppInfo& info, GLFWwindow *window) {
 		.bindDummy(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 		.bindDummy(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
 		.bindDummy(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-		.bindDummy(6, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.bindDummy(6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT)
 		.buildLayout(imageLayout);
 
-	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { viewLayout, imageLayout };
+	// Draws read their objects from the object buffer, or from instance culling when GPU driven
+	m_objectBuffer.init(m_device, &m_descriptorLayoutCache, &m_descriptorAllocator, MAX_FRAMES_IN_FLIGHT);
+	m_instanceCuller.init(m_device, &m_descriptorLayoutCache, &m_descriptorAllocator, MAX_FRAMES_IN_FLIGHT);
+	m_gpuDriven = m_device.supportsGpuDrivenRendering();
+
+	// Bindless materials replace the material sets with one global set, materials are then found through objects
+	m_bindless = m_device.supportsBindlessMaterials();
+	m_materialTable.init(m_device, m_bindless ? &m_bindlessMaterials : nullptr, MAX_FRAMES_IN_FLIGHT);
+	if (m_bindless) {
+		m_bindlessMaterials.init(m_device, m_materialTable.getBuffer(), MAX_FRAMES_IN_FLIGHT);
+		imageLayout = m_bindlessMaterials.getLayout();
+	}
+	m_renderQueue.setMergeMaterials(m_bindless);
+	const char *fragmentShader = m_bindless ? "assets/shaders/static_bindless.frag.spv" : "assets/shaders/static.frag.spv";
+
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { viewLayout, imageLayout, m_objectBuffer.getLayout() };
 
-	// Create graphics pipeline
-	m_pipeline.init(m_device, m_renderPass, m_swapChain, "assets/shaders/static.vert.spv", "assets/shaders/static.frag.spv", descriptorSetLayouts);
+	// Create graphics pipelines, one per vertex format. Both layouts are identical.
+	m_pipeline.init<VertexFormat::SEPARATE>(m_device, m_renderPass, m_swapChain, "assets/shaders/static.vert.spv", fragmentShader, descriptorSetLayouts);
+	m_packedPipeline.init<VertexFormat::PACKED>(m_device, m_renderPass, m_swapChain, "assets/shaders/static.vert.spv", fragmentShader, descriptorSetLayouts);
 
 	// Create frame buffers
 	m_swapChain.createFrameBuffers(m_renderPass);
 
 	// Create command pool
 	QueueFamilyIndices queueFamilyIndices = m_device.findQueueFamilies(m_surface);
+	m_graphicsQueueFamily = queueFamilyIndices.graphicsFamily.value();
 
 	VkCommandPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -208,6 +252,13 @@ void Renderer::init(const AppInfo& info, GLFWwindow *window) {
 		throw std::runtime_error("Failed to create command pool");
 	}
 
+	m_uploadQueue.init(this);
+	m_textureCache.init(m_device);
+	m_geometryArena.init(m_device, MAX_FRAMES_IN_FLIGHT);
+	m_clusterCuller.init(m_device, &m_descriptorLayoutCache, &m_descriptorAllocator, MAX_FRAMES_IN_FLIGHT, m_geometryArena);
+	// Culled draws are indirect and select their object through the first instance
+	m_clusterCulling = m_device.supportsIndirectFirstInstance();
+
 	// Create command buffers
 	m_commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
@@ -222,6 +273,49 @@ void Renderer::init(const AppInfo& info, GLFWwindow *window) {
 		throw std::runtime_error("Failed to allocate command buffers");
 	}
 
+	m_cullCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	allocInfo.commandBufferCount = static_cast<uint32_t>(m_cullCommandBuffers.size());
+
+	if (vkAllocateCommandBuffers(m_device.getLogicalDevice(), &allocInfo, m_cullCommandBuffers.data()) != VK_SUCCESS) {
+		LOG_ERROR("Failed to allocate culling command buffers");
+		throw std::runtime_error("Failed to allocate culling command buffers");
+	}
+
+	// Secondary command buffers for parallel recording, the workers are only started once it is enabled
+	m_instanceCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	allocInfo.commandBufferCount = static_cast<uint32_t>(m_instanceCommandBuffers.size());
+
+	if (vkAllocateCommandBuffers(m_device.getLogicalDevice(), &allocInfo, m_instanceCommandBuffers.data()) != VK_SUCCESS) {
+		LOG_ERROR("Failed to allocate secondary command buffers");
+		throw std::runtime_error("Failed to allocate secondary command buffers");
+	}
+
+	VkCommandPoolCreateInfo slicePoolInfo{};
+	slicePoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	slicePoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // Reset as a whole every frame
+	slicePoolInfo.queueFamilyIndex = m_graphicsQueueFamily;
+
+	m_slicePools.resize(MAX_FRAMES_IN_FLIGHT);
+	m_sliceCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		m_slicePools[i].resize(RENDERER_MAX_RECORDING_SLICES);
+		m_sliceCommandBuffers[i].resize(RENDERER_MAX_RECORDING_SLICES);
+		for (size_t slice = 0; slice < RENDERER_MAX_RECORDING_SLICES; ++slice) {
+			if (vkCreateCommandPool(m_device.getLogicalDevice(), &slicePoolInfo, nullptr, &m_slicePools[i][slice]) != VK_SUCCESS) {
+				LOG_ERROR("Failed to create recording command pool");
+				throw std::runtime_error("Failed to create recording command pool");
+			}
+
+			allocInfo.commandPool = m_slicePools[i][slice];
+			allocInfo.commandBufferCount = 1;
+			if (vkAllocateCommandBuffers(m_device.getLogicalDevice(), &allocInfo, &m_sliceCommandBuffers[i][slice]) != VK_SUCCESS) {
+				LOG_ERROR("Failed to allocate secondary command buffers");
+				throw std::runtime_error("Failed to allocate secondary command buffers");
+			}
+		}
+	}
+
 	// Create sync objects
 	m_imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 	m_renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -270,6 +364,11 @@ void Renderer::newFrame() {
 	vkResetFences(m_device.getLogicalDevice(), 1, &m_inFlightFences[m_currentFrame]);
 
 	vkResetCommandBuffer(m_commandBuffers[m_currentFrame], 0);
+	vkResetCommandBuffer(m_cullCommandBuffers[m_currentFrame], 0);
+	vkResetCommandBuffer(m_instanceCommandBuffers[m_currentFrame], 0);
+	for (VkCommandPool pool : m_slicePools[m_currentFrame]) {
+		vkResetCommandPool(m_device.getLogicalDevice(), pool, 0);
+	}
 }
 
 void Renderer::prepare() {
@@ -299,13 +398,75 @@ void Renderer::prepare() {
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 
-	vkCmdBeginRenderPass(m_commandBuffers[m_currentFrame], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// The render pass holds either inline commands or secondary command buffers, not both
+	m_recordingParallel = m_parallelRecording;
+	if (m_recordingParallel && !m_recordingWorkers) {
+		// The caller of parallelFor records a slice as well
+		m_recordingWorkers = std::make_unique<ThreadPool>(std::max(2u, std::thread::hardware_concurrency()) - 1);
+	}
+	vkCmdBeginRenderPass(m_commandBuffers[m_currentFrame], &renderPassInfo,
+		m_recordingParallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+	m_geometryArena.beginFrame(m_currentFrame);
+	m_materialTable.beginFrame(m_currentFrame);
+	if (m_bindless) {
+		m_bindlessMaterials.beginFrame(m_currentFrame);
+	}
+	m_clusterCuller.beginFrame(m_currentFrame);
+	m_instanceCuller.beginFrame(m_currentFrame);
+	m_objectBuffer.beginFrame(m_currentFrame);
+
+	m_renderQueue.clear();
+
+	if (!m_recordingParallel) {
+		m_inlineState = CommandState{};
+		m_inlineState.commandBuffer = m_commandBuffers[m_currentFrame];
+		beginDraws(m_inlineState);
+	}
+}
 
-	vkCmdBindPipeline(m_commandBuffers[m_currentFrame], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getPipeline());
-	vkCmdBindDescriptorSets(m_commandBuffers[m_currentFrame], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 0, 1, &m_uniformSets[m_currentFrame], 0, nullptr);
+void Renderer::beginDraws(CommandState &state) {
+	// Geometry of all models lives in the arena, vertex buffers only change with the vertex format
+	vkCmdBindPipeline(state.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getPipeline());
+	m_geometryArena.bindVertexBuffers(state.commandBuffer, VertexFormat::SEPARATE);
+	m_geometryArena.bindIndexBuffer(state.commandBuffer);
+	state.boundVertexFormat = VertexFormat::SEPARATE;
+	state.culledIndicesBound = false;
+	vkCmdBindDescriptorSets(state.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 0, 1, &m_uniformSets[m_currentFrame], 0, nullptr);
+
+	VkDescriptorSet objectSet = m_objectBuffer.getSet();
+	vkCmdBindDescriptorSets(state.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 2, 1, &objectSet, 0, nullptr);
+
+	if (m_bindless) {
+		VkDescriptorSet materialSet = m_bindlessMaterials.getSet();
+		vkCmdBindDescriptorSets(state.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 1, 1, &materialSet, 0, nullptr);
+	}
 }
 
 void Renderer::execute() {
+	// Submitted ahead of the frame on the same queue, the upload batch ends with a barrier for shader reads
+	if (m_materialTable.flush(m_uploadQueue)) {
+		m_uploadQueue.flush();
+	}
+
+	// Packets are recorded in key order, so draws sharing state follow each other
+	m_renderQueue.sort();
+	m_objectBuffer.reserve(static_cast<uint32_t>(m_renderQueue.size()));
+	writeObjects();
+
+	// Instances were only counted while the frame was recorded, their draws can be laid out now
+	if (m_recordingParallel) {
+		recordSecondaryCommandBuffers();
+	}
+	else {
+		// Growing the object buffer replaces the set bound when the frame was prepared
+		VkDescriptorSet objectSet = m_objectBuffer.getSet();
+		vkCmdBindDescriptorSets(m_inlineState.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 2, 1, &objectSet, 0, nullptr);
+		recordRuns(m_inlineState, 0, m_renderQueue.getRuns().size());
+		m_renderQueueStats = m_inlineState.stats;
+		recordInstanceDraws(m_inlineState);
+	}
+
 	// End render pass
 	vkCmdEndRenderPass(m_commandBuffers[m_currentFrame]);
 	// End command buffer
@@ -314,6 +475,37 @@ void Renderer::execute() {
 		throw std::runtime_error("Failed to record command buffer");
 	}
 
+	// Culling runs first, its barriers order it before the draws of the frame
+	std::array<VkCommandBuffer, 2> commandBuffers{};
+	uint32_t commandBufferCount = 0;
+	if (m_clusterCuller.hasWork() || m_instanceCuller.hasWork()) {
+		VkCommandBuffer cullCommandBuffer = m_cullCommandBuffers[m_currentFrame];
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(cullCommandBuffer, &beginInfo) != VK_SUCCESS) {
+			LOG_ERROR("Failed to begin recording culling command buffer");
+			throw std::runtime_error("Failed to begin recording culling command buffer");
+		}
+
+		const ViewUniformData *view = m_viewUniformBuffers[m_currentFrame].getData();
+		if (m_clusterCuller.hasWork()) {
+			m_clusterCuller.record(cullCommandBuffer, view->view, view->proj);
+		}
+		if (m_instanceCuller.hasWork()) {
+			m_instanceCuller.record(cullCommandBuffer, view->view, view->proj, getPixelsPerUnit(*view), LOD_ERROR_THRESHOLD);
+		}
+
+		if (vkEndCommandBuffer(cullCommandBuffer) != VK_SUCCESS) {
+			LOG_ERROR("Failed to record culling command buffer");
+			throw std::runtime_error("Failed to record culling command buffer");
+		}
+		commandBuffers[commandBufferCount++] = cullCommandBuffer;
+	}
+	commandBuffers[commandBufferCount++] = m_commandBuffers[m_currentFrame];
+
 	// Queue buffer
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -324,17 +516,14 @@ void Renderer::execute() {
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &m_commandBuffers[m_currentFrame];
+	submitInfo.commandBufferCount = commandBufferCount;
+	submitInfo.pCommandBuffers = commandBuffers.data();
 
 	VkSemaphore signalSemaphores[] = { m_renderFinishedSemaphores[m_currentFrame] };
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, m_inFlightFences[m_currentFrame]) != VK_SUCCESS) {
-		LOG_ERROR("Failed to submit draw command buffer");
-		throw std::runtime_error("Failed to submit draw command buffer");
-	}
+	submit(submitInfo, m_inFlightFences[m_currentFrame]);
 
 	// Submit result to swap chain
 	VkPresentInfoKHR presentInfo{};
@@ -350,7 +539,11 @@ void Renderer::execute() {
 
 	presentInfo.pResults = nullptr; // Optional
 
-	VkResult result = vkQueuePresentKHR(m_device.getPresentQueue(), &presentInfo);
+	VkResult result;
+	{
+		std::lock_guard<std::mutex> lock(m_queueMutex);
+		result = vkQueuePresentKHR(m_device.getPresentQueue(), &presentInfo);
+	}
 
 	// Check if swap chain has become incompatible (window resize etc)
 	//  or if swap chain is suboptimal 
@@ -368,79 +561,314 @@ void Renderer::execute() {
 }
 
 void Renderer::waitForIdle() {
+	std::lock_guard<std::mutex> lock(m_queueMutex);
 	vkDeviceWaitIdle(m_device.getLogicalDevice());
 }
 
-void Renderer::addTransformCommand(const glm::mat4 &matrix) {
-	vkCmdPushConstants(m_commandBuffers[m_currentFrame], m_pipeline.getLayout(), VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &matrix);
+// Picks the coarsest LOD whose error, projected at the nearest point of the bounding sphere, stays below the threshold
+uint32_t Renderer::selectLod(const Mesh &mesh, const glm::mat4 &modelMatrix, const ViewUniformData &view) const {
+	if (mesh.lodCount < 2) {
+		return 0;
+	}
+
+	glm::vec4 center = view.view * modelMatrix * glm::vec4(mesh.boundsCenter, 1.0f);
+	float scale = std::max({
+		glm::length(glm::vec3(modelMatrix[0].x, modelMatrix[0].y, modelMatrix[0].z)),
+		glm::length(glm::vec3(modelMatrix[1].x, modelMatrix[1].y, modelMatrix[1].z)),
+		glm::length(glm::vec3(modelMatrix[2].x, modelMatrix[2].y, modelMatrix[2].z)) });
+	float distance = glm::length(glm::vec3(center.x, center.y, center.z)) - mesh.boundsRadius * scale;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+
+	float pixelsPerUnit = getPixelsPerUnit(view);
+
+	uint32_t lod = 0;
+	while (lod + 1 < mesh.lodCount && mesh.lods[lod + 1].error * scale * pixelsPerUnit < LOD_ERROR_THRESHOLD * distance) {
+		++lod;
+	}
+	return lod;
 }
 
-void Renderer::addModelCommand(const Model *model, const glm::mat4 &matrix) {
+// Pixels covered by one unit at distance one
+float Renderer::getPixelsPerUnit(const ViewUniformData &view) const {
+	return std::abs(view.proj[1][1]) * 0.5f * m_swapChain.getExtent().height;
+}
+
+void Renderer::addModelCommand(const Model *model, const glm::mat4 &matrix, const uint8_t *meshVisibility) {
+	// GPU driven models cost one instance record regardless of their mesh count, their meshes are culled again there
+	if (m_gpuDriven && m_instanceCuller.addInstance(*model, matrix)) {
+		return;
+	}
+
+	const ViewUniformData &view = *m_viewUniformBuffers[m_currentFrame].getData();
+
 	for (const auto &[nodeIndex, meshCollection] : model->getMeshes()) {
-		for (int meshIndex = 0; meshIndex < meshCollection.size(); ++meshIndex) {
-			const auto &mesh = meshCollection[meshIndex];
+		// Meshes of a node share its matrix, their dequantization is applied when the objects are written
+		glm::mat4 meshMatrix = matrix * model->getMeshMatricies().at(nodeIndex);
+		uint32_t transform = m_renderQueue.addTransform(meshMatrix);
+
+		for (const Mesh &mesh : meshCollection) {
+			if (meshVisibility && !*meshVisibility++) {
+				continue;
+			}
+
+			const Material &material = model->getMaterials()[mesh.materialIndex];
+			uint32_t lod = selectLod(mesh, meshMatrix, view);
+
+			DrawPacket packet{};
+			packet.mesh = &mesh;
+			packet.material = &material;
+			packet.transform = transform;
+			packet.lod = lod;
+
+			// Draws of the same index range end up adjacent, so repeated meshes form instanced runs. Bindless
+			// materials bind nothing, so they are left out of the key and runs span materials.
+			uint32_t geometry = mesh.getFirstIndex(lod);
+			float depth = -(view.view * meshMatrix * glm::vec4(mesh.boundsCenter, 1.0f)).z;
+			uint64_t key = RenderQueue::makeKey(RENDER_QUEUE_PASS_OPAQUE, static_cast<uint32_t>(mesh.vertexFormat),
+				m_bindless ? 0 : material.id, geometry, RenderQueue::quantizeDepth(depth));
+			m_renderQueue.add(key, packet);
+		}
+	}
+}
+
+// One linear pass in draw order. The dequantization of a mesh is a uniform scale and an offset, so it is folded
+// into the node matrix without a full matrix product.
+void Renderer::writeObjects() {
+	ObjectData *objects = m_objectBuffer.getObjects();
+	for (size_t i = 0; i < m_renderQueue.size(); ++i) {
+		const DrawPacket &packet = m_renderQueue.getPacket(i);
+		const glm::mat4 &matrix = m_renderQueue.getTransform(packet.transform);
+		const Mesh &mesh = *packet.mesh;
+
+		ObjectData &object = objects[i];
+		object.matrix[0] = matrix[0] * mesh.positionScale;
+		object.matrix[1] = matrix[1] * mesh.positionScale;
+		object.matrix[2] = matrix[2] * mesh.positionScale;
+		object.matrix[3] = matrix * glm::vec4(mesh.positionOffset, 1.0f);
+		object.materialIndex = packet.material->id;
+	}
+
+	// Meshlets cover the full detail level and a culled draw has a single instance, so only single draws of
+	// the full level are culled per cluster
+	for (DrawRun &run : m_renderQueue.getRuns()) {
+		const DrawPacket &packet = m_renderQueue.getPacket(run.firstPacket);
+		const Mesh &mesh = *packet.mesh;
+		if (m_clusterCulling && run.packetCount == 1 && packet.lod == 0 && mesh.meshletCount && m_clusterCuller.canAddDraw(mesh)) {
+			run.clusterDraw = m_clusterCuller.addDraw(mesh, m_renderQueue.getTransform(packet.transform));
+			m_clusterCuller.setFirstInstance(run.clusterDraw, run.firstPacket);
+		}
+	}
+}
+
+// Safe to call from several threads on different command buffers
+void Renderer::recordRuns(CommandState &state, size_t firstRun, size_t lastRun) {
+	VkCommandBuffer commandBuffer = state.commandBuffer;
+	const std::vector<DrawRun> &runs = m_renderQueue.getRuns();
+
+	for (size_t i = firstRun; i < lastRun; ++i) {
+		const DrawRun &run = runs[i];
+		const DrawPacket &packet = m_renderQueue.getPacket(run.firstPacket);
+		const Mesh &mesh = *packet.mesh;
+		++state.stats.draws;
+		state.stats.instances += run.packetCount;
+
+		// Both pipeline layouts are identical, so bound descriptor sets stay valid across the switch
+		if (mesh.vertexFormat != state.boundVertexFormat) {
+			const Pipeline &pipeline = mesh.vertexFormat == VertexFormat::PACKED ? m_packedPipeline : m_pipeline;
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.getPipeline());
+			m_geometryArena.bindVertexBuffers(commandBuffer, mesh.vertexFormat);
+			state.boundVertexFormat = mesh.vertexFormat;
+			++state.stats.pipelineBinds;
+			++state.stats.vertexBufferBinds;
+		}
+
+		if (!m_bindless && packet.material != state.boundMaterial) {
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 1, 1,
+				&packet.material->set, 0, nullptr);
+			state.boundMaterial = packet.material;
+			++state.stats.materialBinds;
+		}
+
+		bool culled = run.clusterDraw != RenderQueue::INVALID_DRAW;
+		if (culled != state.culledIndicesBound) {
+			if (culled) {
+				m_clusterCuller.bindIndexBuffer(commandBuffer);
+			}
+			else {
+				m_geometryArena.bindIndexBuffer(commandBuffer);
+			}
+			state.culledIndicesBound = culled;
+			++state.stats.indexBufferBinds;
+		}
+
+		// The object of a packet is at its position in the queue, so the instances of a run are consecutive objects
+		if (culled) {
+			m_clusterCuller.recordDraw(commandBuffer, run.clusterDraw);
+		}
+		else {
+			vkCmdDrawIndexed(commandBuffer, mesh.getIndexCount(packet.lod), run.packetCount, mesh.getFirstIndex(packet.lod),
+				mesh.vertexOffset, run.firstPacket);
+		}
+	}
+}
 
-			addTransformCommand(matrix * model->getMeshMatricies().at(nodeIndex));
+void Renderer::recordInstanceDraws(CommandState &state) {
+	if (!m_instanceCuller.hasWork()) {
+		return;
+	}
 
-			const auto &material = model->getMaterials()[mesh.materialIndex];
-			vkCmdBindDescriptorSets(m_commandBuffers[m_currentFrame],
-				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				m_pipeline.getLayout(), 1, 1,
-				&material.sets[m_currentFrame],
-				0,
-				nullptr);
+	VkCommandBuffer commandBuffer = state.commandBuffer;
+	if (state.culledIndicesBound) {
+		m_geometryArena.bindIndexBuffer(commandBuffer);
+		state.culledIndicesBound = false;
+	}
 
-			vkCmdBindVertexBuffers(m_commandBuffers[m_currentFrame], 0, 3, model->getVertexBufferAsArray().data(), mesh.getVertexOffsets().data());  // TODO: Offset: Add other primitives (normal, texture coordinate etc)
-			vkCmdBindIndexBuffer(m_commandBuffers[m_currentFrame], model->getVertexBuffer(), mesh.getIndexOffset(), VK_INDEX_TYPE_UINT16);
+	// Objects of GPU driven draws are written by instance culling
+	VkDescriptorSet objectSet = m_instanceCuller.getObjectSet();
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 2, 1, &objectSet, 0, nullptr);
+
+	// Recorded commands scale with the batches of the drawn models, not with their instances
+	for (const InstanceDraw &draw : m_instanceCuller.prepareDraws()) {
+		VertexFormat format = draw.batch->vertexFormat;
+		if (format != state.boundVertexFormat) {
+			const Pipeline &pipeline = format == VertexFormat::PACKED ? m_packedPipeline : m_pipeline;
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.getPipeline());
+			m_geometryArena.bindVertexBuffers(commandBuffer, format);
+			state.boundVertexFormat = format;
+		}
 
-			vkCmdDrawIndexed(m_commandBuffers[m_currentFrame], static_cast<uint32_t>(mesh.getIndexCount()), 1, 0, 0, 0);
+		if (!m_bindless) {
+			const auto &material = draw.model->getMaterials()[draw.batch->materialIndex];
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline.getLayout(), 1, 1,
+				&material.set, 0, nullptr);
 		}
+
+		m_instanceCuller.draw(commandBuffer, draw);
+	}
+}
+
+// Slices are contiguous runs of the sorted queue, so the draw order is kept
+void Renderer::recordSecondaryCommandBuffers() {
+	m_executedCommandBuffers.clear();
+
+	size_t runCount = m_renderQueue.getRuns().size();
+	size_t sliceCount = std::min({
+		static_cast<size_t>(RENDERER_MAX_RECORDING_SLICES),
+		m_recordingWorkers->getThreadCount() + 1,
+		(runCount + RENDERER_MIN_MESHES_PER_SLICE - 1) / RENDERER_MIN_MESHES_PER_SLICE });
+
+	std::array<RenderQueueStats, RENDERER_MAX_RECORDING_SLICES> sliceStats{};
+	m_recordingWorkers->parallelFor(sliceCount, [&](size_t slice) {
+		CommandState state;
+		state.commandBuffer = m_sliceCommandBuffers[m_currentFrame][slice];
+		beginSecondaryCommandBuffer(state.commandBuffer);
+		beginDraws(state);
+
+		recordRuns(state, runCount * slice / sliceCount, runCount * (slice + 1) / sliceCount);
+		sliceStats[slice] = state.stats;
+
+		if (vkEndCommandBuffer(state.commandBuffer) != VK_SUCCESS) {
+			LOG_ERROR("Failed to record secondary command buffer");
+			throw std::runtime_error("Failed to record secondary command buffer");
+		}
+	});
+
+	m_renderQueueStats = RenderQueueStats{};
+	for (size_t slice = 0; slice < sliceCount; ++slice) {
+		m_renderQueueStats += sliceStats[slice];
+	}
+	m_executedCommandBuffers.assign(m_sliceCommandBuffers[m_currentFrame].begin(), m_sliceCommandBuffers[m_currentFrame].begin() + sliceCount);
+
+	if (m_instanceCuller.hasWork()) {
+		CommandState state;
+		state.commandBuffer = m_instanceCommandBuffers[m_currentFrame];
+		beginSecondaryCommandBuffer(state.commandBuffer);
+		beginDraws(state);
+		recordInstanceDraws(state);
+
+		if (vkEndCommandBuffer(state.commandBuffer) != VK_SUCCESS) {
+			LOG_ERROR("Failed to record secondary command buffer");
+			throw std::runtime_error("Failed to record secondary command buffer");
+		}
+		m_executedCommandBuffers.push_back(state.commandBuffer);
+	}
+
+	if (!m_executedCommandBuffers.empty()) {
+		vkCmdExecuteCommands(m_commandBuffers[m_currentFrame], static_cast<uint32_t>(m_executedCommandBuffers.size()), m_executedCommandBuffers.data());
+	}
+}
+
+void Renderer::beginSecondaryCommandBuffer(VkCommandBuffer commandBuffer) {
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = m_renderPass.getRenderPass();
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = m_swapChain.getFramebuffers()[m_imageIndex];
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		LOG_ERROR("Failed to begin recording secondary command buffer");
+		throw std::runtime_error("Failed to begin recording secondary command buffer");
 	}
 }
 
 void Renderer::initializeMaterials(Material& material) {
-	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-		VkDescriptorImageInfo colorImageInfo{};
-		colorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		colorImageInfo.imageView = material.colorTexture.getView();
-		colorImageInfo.sampler = material.colorTexture.getSampler();
-
-		VkDescriptorImageInfo metallicRoughnessImageInfo{};
-		metallicRoughnessImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		metallicRoughnessImageInfo.imageView = material.metallicRoughnessTexture.getView();
-		metallicRoughnessImageInfo.sampler = material.metallicRoughnessTexture.getSampler();
-
-		VkDescriptorImageInfo normalImageInfo{};
-		normalImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		normalImageInfo.imageView = material.normalTexture.getView();
-		normalImageInfo.sampler = material.normalTexture.getSampler();
-
-		VkDescriptorImageInfo occlusionImageInfo{};
-		occlusionImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		occlusionImageInfo.imageView = material.occlusionTexture.getView();
-		occlusionImageInfo.sampler = material.occlusionTexture.getSampler();
-
-		VkDescriptorImageInfo emissiveImageInfo{};
-		emissiveImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		emissiveImageInfo.imageView = material.emissiveTexture.getView();
-		emissiveImageInfo.sampler = material.emissiveTexture.getSampler();
-
-		VkDescriptorBufferInfo materialBufferInfo{};
-		materialBufferInfo.buffer = material.propertiesBuffers[i].getBuffer();
-		materialBufferInfo.offset = 0;
-		materialBufferInfo.range = material.propertiesBuffers[i].getSize();
-
-		VkDescriptorSet materialSet;
-		DescriptorBuilder::begin(&m_descriptorLayoutCache, &m_descriptorAllocator)
-			.bindImage(1, &colorImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-			.bindImage(2, &metallicRoughnessImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-			.bindImage(3, &normalImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-			.bindImage(4, &occlusionImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-			.bindImage(5, &emissiveImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
-			.bindBuffer(6, &materialBufferInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT)
-			.build(materialSet);
-		material.sets.push_back(materialSet);
+	m_materialTable.add(material);
+
+	// Bindless materials need no set of their own. Otherwise the set is shared by all frames in flight, since
+	// textures do not change and the parameters live in the material table.
+	if (m_bindless) {
+		return;
 	}
+
+	VkDescriptorImageInfo colorImageInfo{};
+	colorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	colorImageInfo.imageView = material.colorTexture.getView();
+	colorImageInfo.sampler = material.colorTexture.getSampler();
+
+	VkDescriptorImageInfo metallicRoughnessImageInfo{};
+	metallicRoughnessImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	metallicRoughnessImageInfo.imageView = material.metallicRoughnessTexture.getView();
+	metallicRoughnessImageInfo.sampler = material.metallicRoughnessTexture.getSampler();
+
+	VkDescriptorImageInfo normalImageInfo{};
+	normalImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	normalImageInfo.imageView = material.normalTexture.getView();
+	normalImageInfo.sampler = material.normalTexture.getSampler();
+
+	VkDescriptorImageInfo occlusionImageInfo{};
+	occlusionImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	occlusionImageInfo.imageView = material.occlusionTexture.getView();
+	occlusionImageInfo.sampler = material.occlusionTexture.getSampler();
+
+	VkDescriptorImageInfo emissiveImageInfo{};
+	emissiveImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	emissiveImageInfo.imageView = material.emissiveTexture.getView();
+	emissiveImageInfo.sampler = material.emissiveTexture.getSampler();
+
+	VkDescriptorBufferInfo materialBufferInfo{};
+	materialBufferInfo.buffer = m_materialTable.getBuffer();
+	materialBufferInfo.offset = 0;
+	materialBufferInfo.range = VK_WHOLE_SIZE;
+
+	DescriptorBuilder::begin(&m_descriptorLayoutCache, &m_descriptorAllocator)
+		.bindImage(1, &colorImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.bindImage(2, &metallicRoughnessImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.bindImage(3, &normalImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.bindImage(4, &occlusionImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.bindImage(5, &emissiveImageInfo, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.bindBuffer(6, &materialBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT)
+		.build(material.set);
+}
+
+void Renderer::updateMaterial(const Material &material) {
+	m_materialTable.update(material);
 }
 
 VkCommandBuffer Renderer::prepareSingleCommand() const {
@@ -469,12 +897,31 @@ void Renderer::executeSingleCommand(VkCommandBuffer commandBuffer) const {
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(m_device.getGraphicsQueue());
+	// Wait on a fence rather than the queue so work submitted by other threads is not waited for
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	if (vkCreateFence(m_device.getLogicalDevice(), &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create single command fence");
+		throw std::runtime_error("Failed to create single command fence");
+	}
+
+	submit(submitInfo, fence);
+	vkWaitForFences(m_device.getLogicalDevice(), 1, &fence, VK_TRUE, UINT64_MAX);
 
+	vkDestroyFence(m_device.getLogicalDevice(), fence, nullptr);
 	vkFreeCommandBuffers(m_device.getLogicalDevice(), m_commandPool, 1, &commandBuffer);
 }
 
+void Renderer::submit(const VkSubmitInfo &submitInfo, VkFence fence) const {
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	if (vkQueueSubmit(m_device.getGraphicsQueue(), 1, &submitInfo, fence) != VK_SUCCESS) {
+		LOG_ERROR("Failed to submit command buffer");
+		throw std::runtime_error("Failed to submit command buffer");
+	}
+}
+
 void Renderer::configureDebugCallback(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
 	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
 	createInfo.messageSeverity =
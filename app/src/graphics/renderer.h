@@ -4,8 +4,10 @@
 #include <GLFW/glfw3.h>
 
 #include <memory>
+#include <mutex>
 
 #include "appinfo.h"
+#include "thread_pool.h"
 #include "graphics/device.h"
 #include "graphics/swap_chain.h"
 #include "graphics/render_pass.h"
@@ -15,9 +17,18 @@
 #include "graphics/uniform.h"
 #include "graphics/descriptors.h"
 #include "graphics/material.h"
+#include "graphics/upload_queue.h"
+#include "graphics/cluster_culling.h"
+#include "graphics/geometry_arena.h"
+#include "graphics/instance_culling.h"
+#include "graphics/render_queue.h"
+#include "graphics/object_buffer.h"
+#include "graphics/bindless_materials.h"
+#include "graphics/material_table.h"
 
 #include "data/image.h"
 #include "data/texture.h"
+#include "data/texture_cache.h"
 
 
 struct ViewUniformData {
@@ -27,6 +38,7 @@ struct ViewUniformData {
 
 
 class Model;
+struct Mesh;
 
 class Renderer {
 public:
@@ -38,14 +50,43 @@ public:
 	void execute();
 	void waitForIdle();
 
-	void addTransformCommand(const glm::mat4 &matrix);
-	void addModelCommand(const Model *model, const glm::mat4 &matrix = glm::mat4(1.0f));
+	// Emits a draw packet per visible mesh into the render queue, which is sorted and recorded at execute.
+	// Visibility holds one entry per mesh in the order of Model::getMeshes, hidden meshes are skipped.
+	void addModelCommand(const Model *model, const glm::mat4 &matrix = glm::mat4(1.0f), const uint8_t *meshVisibility = nullptr);
 	void initializeMaterials(Material &material);
+	// Uploads the edited properties of an initialized material before the next frame
+	void updateMaterial(const Material &material);
 	ViewUniformData *getCurrentViewUniformBuffer() { return m_viewUniformBuffers[m_currentFrame].getData(); }
 
+	// Single commands use the renderer command pool and must be recorded on the render thread
 	VkCommandBuffer prepareSingleCommand() const;
 	void executeSingleCommand(VkCommandBuffer commandBuffer) const;
 
+	// Thread safe submission to the graphics queue
+	void submit(const VkSubmitInfo &submitInfo, VkFence fence) const;
+	uint32_t getGraphicsQueueFamily() const { return m_graphicsQueueFamily; }
+
+	UploadQueue &getUploadQueue() { return m_uploadQueue; }
+	TextureCache &getTextureCache() { return m_textureCache; }
+	GeometryArena &getGeometryArena() { return m_geometryArena; }
+	InstanceCuller &getInstanceCuller() { return m_instanceCuller; }
+	MaterialTable &getMaterialTable() { return m_materialTable; }
+
+	// Registered models are culled and drawn by the GPU when the device supports indirect count draws
+	void setGpuDriven(bool enabled) { m_gpuDriven = enabled && m_device.supportsGpuDrivenRendering(); }
+	bool isGpuDriven() const { return m_gpuDriven; }
+
+	// Records the sorted render queue into secondary command buffers, one per slice of the queue, on the
+	// recording workers, which are started the first time. Takes effect with the next prepare.
+	void setParallelRecording(bool enabled) { m_parallelRecording = enabled; }
+	bool isParallelRecording() const { return m_parallelRecording; }
+
+	// Materials are read from one global set when the device supports descriptor indexing, fixed at init
+	bool isBindless() const { return m_bindless; }
+
+	// Of the last executed frame
+	const RenderQueueStats &getRenderQueueStats() const { return m_renderQueueStats; }
+
 	VkInstance getInstance() const { return m_instance; }
 	const Device &getDevice() const { return m_device; }
 	const RenderPass &getRenderPass() const { return m_renderPass; }
@@ -54,7 +95,28 @@ public:
 
 	static const int MAX_FRAMES_IN_FLIGHT = 2;
 private:
+	// A command buffer inside the render pass and the state bound in it
+	struct CommandState {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VertexFormat boundVertexFormat = VertexFormat::SEPARATE;
+		bool culledIndicesBound = false;
+		const Material *boundMaterial = nullptr;
+		RenderQueueStats stats;
+	};
+
 	void configureDebugCallback(VkDebugUtilsMessengerCreateInfoEXT &debugCreateInfo);
+	uint32_t selectLod(const Mesh &mesh, const glm::mat4 &modelMatrix, const ViewUniformData &view) const;
+	float getPixelsPerUnit(const ViewUniformData &view) const;
+
+	// Binds the state shared by all draws, secondary command buffers inherit none of it
+	void beginDraws(CommandState &state);
+	// Fills the object buffer from the sorted queue
+	void writeObjects();
+	// Records the runs in [firstRun, lastRun) as instanced draws, binding only the state that differs from the previous run
+	void recordRuns(CommandState &state, size_t firstRun, size_t lastRun);
+	void recordInstanceDraws(CommandState &state);
+	void recordSecondaryCommandBuffers();
+	void beginSecondaryCommandBuffer(VkCommandBuffer commandBuffer);
 
 	VkInstance m_instance{};
 	VkSurfaceKHR m_surface{};
@@ -63,6 +125,7 @@ private:
 	SwapChain m_swapChain{};
 	RenderPass m_renderPass{};
 	Pipeline m_pipeline{};
+	Pipeline m_packedPipeline{};
 
 	Validator m_validator{};
 	Extensions m_instanceExtensions{};
@@ -73,6 +136,39 @@ private:
 	// Commands
 	VkCommandPool m_commandPool;
 	std::vector<VkCommandBuffer> m_commandBuffers;
+	std::vector<VkCommandBuffer> m_cullCommandBuffers; // Submitted ahead of the frame when culling was queued
+	// The primary command buffer while models are recorded inline
+	CommandState m_inlineState;
+	uint32_t m_graphicsQueueFamily = 0;
+
+	// Draws of the frame taking the CPU path and their objects
+	RenderQueue m_renderQueue;
+	ObjectBuffer m_objectBuffer;
+	RenderQueueStats m_renderQueueStats;
+	MaterialTable m_materialTable;
+	BindlessMaterials m_bindlessMaterials;
+	bool m_bindless = false;
+
+	// Parallel recording
+	bool m_parallelRecording = false;
+	bool m_recordingParallel = false; // Mode of the frame being recorded
+	std::unique_ptr<ThreadPool> m_recordingWorkers; // Created when parallel recording is first used
+	std::vector<VkCommandBuffer> m_executedCommandBuffers;
+	// A pool per slice and frame, so every pool is only used by the thread recording its slice
+	std::vector<std::vector<VkCommandPool>> m_slicePools;
+	std::vector<std::vector<VkCommandBuffer>> m_sliceCommandBuffers;
+	std::vector<VkCommandBuffer> m_instanceCommandBuffers; // Secondary, recorded on the render thread
+
+	// Queues are externally synchronized, asset workers submit alongside the render thread
+	mutable std::mutex m_queueMutex;
+
+	UploadQueue m_uploadQueue;
+	TextureCache m_textureCache;
+	GeometryArena m_geometryArena;
+	ClusterCuller m_clusterCuller;
+	bool m_clusterCulling = false;
+	InstanceCuller m_instanceCuller;
+	bool m_gpuDriven = false;
 
 	// Sync objects
 	std::vector <VkSemaphore> m_imageAvailableSemaphores;
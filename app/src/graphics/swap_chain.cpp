@@ -11,7 +11,7 @@
 
 VkMemoryRequirements createImage(uint32_t width, uint32_t height, VkFormat format,
 	VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties,
-	const Device &device, VkImage &image, VkDeviceMemory &imageMemory) {
+	const Device &device, VkImage &image, MemoryAllocation &imageMemory) {
 
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -36,17 +36,7 @@ VkMemoryRequirements createImage(uint32_t width, uint32_t height, VkFormat forma
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device.getLogicalDevice(), image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties, device.getPhysicalDevice());
-
-	if (vkAllocateMemory(device.getLogicalDevice(), &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		LOG_ERROR("Failed to allocate image memory");
-		throw std::runtime_error("Failed to allocate image memory");
-	}
-
-	vkBindImageMemory(device.getLogicalDevice(), image, imageMemory, 0);
+	imageMemory = device.getAllocator().allocateImage(image, properties);
 
 	return memRequirements;
 }
@@ -58,7 +48,7 @@ void SwapChain::destroy() {
 
 	vkDestroyImageView(m_device.getLogicalDevice(), m_depthImageView, nullptr);
 	vkDestroyImage(m_device.getLogicalDevice(), m_depthImage, nullptr);
-	vkFreeMemory(m_device.getLogicalDevice(), m_depthImageMemory, nullptr);
+	m_device.getAllocator().free(m_depthImageMemory);
 
 	for (auto framebuffer : m_framebuffers) {
 		vkDestroyFramebuffer(m_device.getLogicalDevice(), framebuffer, nullptr);
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "device.h"
+#include "memory.h"
 #include "render_pass.h"
 
 
@@ -48,6 +49,6 @@ private:
 	std::vector<VkFramebuffer> m_framebuffers;
 
 	VkImage m_depthImage;
-	VkDeviceMemory m_depthImageMemory;
+	MemoryAllocation m_depthImageMemory;
 	VkImageView m_depthImageView;
 };
@@ -25,22 +25,9 @@ public:
 			throw std::runtime_error("Failed to create uniform buffer");
 		}
 
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(device.getLogicalDevice(), m_buffer, &memRequirements);
-
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, device.getPhysicalDevice());
-
-		if (vkAllocateMemory(device.getLogicalDevice(), &allocInfo, nullptr, &m_memory) != VK_SUCCESS) {
-			LOG_ERROR("Failed to allocate uniform buffer memory");
-			throw std::runtime_error("Failed to allocate uniform buffer memory");
-		}
-
-		vkBindBufferMemory(device.getLogicalDevice(), m_buffer, m_memory, 0);
-
-		vkMapMemory(device.getLogicalDevice(), m_memory, 0, getSize(), 0, (void **)&m_data);
+		// Uniform buffers share pages of persistently mapped memory
+		m_memory = device.getAllocator().allocateBuffer(m_buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		m_data = static_cast<T *>(m_memory.mapped);
 
 		if (defaultValues) {
 			*m_data = *defaultValues; // TODO: Research if this is a dangerous approach
@@ -49,18 +36,19 @@ public:
 
 	void destroy() {
 		vkDestroyBuffer(m_device, m_buffer, nullptr);
-		vkFreeMemory(m_device, m_memory, nullptr);
+		m_memory.allocator->free(m_memory);
 	}
 
 	VkBuffer getBuffer() const { return m_buffer; }
-	VkDeviceMemory getMemory() const { return m_memory; }
+	const MemoryAllocation &getMemory() const { return m_memory; }
 	size_t getSize() const { return sizeof(T); }
 
 	T *getData() { return m_data; }
+	const T *getData() const { return m_data; }
 
 private:
 	VkBuffer m_buffer;
-	VkDeviceMemory m_memory;
+	MemoryAllocation m_memory;
 
 	T* m_data;
 
@@ -0,0 +1,388 @@
+#include "upload_queue.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#include "graphics/renderer.h"
+#include "log.h"
+
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void UploadQueue::init(const Renderer *renderer, VkDeviceSize ringSize) {
+	m_renderer = renderer;
+	m_device = renderer->getDevice().getLogicalDevice();
+	m_ringSize = ringSize;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = renderer->getGraphicsQueueFamily();
+
+	if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create upload command pool");
+		throw std::runtime_error("Failed to create upload command pool");
+	}
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = ringSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &m_stagingBuffer) != VK_SUCCESS) {
+		LOG_ERROR("Failed to create upload staging buffer");
+		throw std::runtime_error("Failed to create upload staging buffer");
+	}
+
+	m_stagingMemory = renderer->getDevice().getAllocator().allocateBuffer(m_stagingBuffer,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	m_stagingData = static_cast<std::byte *>(m_stagingMemory.mapped);
+}
+
+void UploadQueue::destroy() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_current.empty()) {
+			submitBatch();
+		}
+		while (!m_inFlight.empty()) {
+			retireBatches(true);
+		}
+	}
+
+	for (VkFence fence : m_freeFences) {
+		vkDestroyFence(m_device, fence, nullptr);
+	}
+	m_freeFences.clear();
+	m_freeCommandBuffers.clear();
+
+	vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+
+	vkDestroyBuffer(m_device, m_stagingBuffer, nullptr);
+	m_stagingMemory.allocator->free(m_stagingMemory);
+}
+
+void UploadQueue::uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size, VkPipelineStageFlags readStages) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const std::byte *source = static_cast<const std::byte *>(data);
+	for (VkDeviceSize copied = 0; copied < size;) {
+		VkDeviceSize chunkSize = std::min<VkDeviceSize>(size - copied, UPLOAD_QUEUE_CHUNK_SIZE);
+		VkDeviceSize stagingOffset = allocateStaging(chunkSize);
+		memcpy(m_stagingData + stagingOffset, source + copied, chunkSize);
+
+		VkBufferCopy region{};
+		region.srcOffset = stagingOffset;
+		region.dstOffset = offset + copied;
+		region.size = chunkSize;
+		m_current.bufferCopies.push_back({ buffer, region });
+		m_current.readStages |= readStages;
+
+		copied += chunkSize;
+	}
+}
+
+void UploadQueue::uploadImage(VkImage image, ImageFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, const void *data, VkDeviceSize size) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	const std::byte *source = static_cast<const std::byte *>(data);
+	bool firstChunk = true;
+	for (uint32_t level = 0; level < mipLevels; ++level) {
+		uint32_t levelWidth = std::max(width >> level, 1u);
+		uint32_t levelHeight = std::max(height >> level, 1u);
+		VkDeviceSize levelSize = mipLevels == 1 ? size : imageLevelSize(format, width, height, level);
+
+		// Large levels are copied in bands of rows, each band fitting in a chunk. Compressed
+		// formats are split on block rows, so a row here covers the height of a block.
+		uint32_t blockExtent = imageBlockExtent(format);
+		uint32_t rows = (levelHeight + blockExtent - 1) / blockExtent;
+		VkDeviceSize rowSize = levelSize / rows;
+		uint32_t rowsPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(1, UPLOAD_QUEUE_CHUNK_SIZE / rowSize));
+
+		for (uint32_t row = 0; row < rows; row += rowsPerChunk) {
+			uint32_t rowCount = std::min(rowsPerChunk, rows - row);
+			VkDeviceSize chunkSize = rowCount * rowSize;
+			VkDeviceSize stagingOffset = allocateStaging(chunkSize);
+			memcpy(m_stagingData + stagingOffset, source + row * rowSize, chunkSize);
+
+			// The transition is recorded in the batch holding the first copy, which may have changed during allocation
+			if (firstChunk) {
+				m_current.preBarriers.push_back(barrier);
+				firstChunk = false;
+			}
+
+			VkBufferImageCopy region{};
+			region.bufferOffset = stagingOffset;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = level;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+
+			uint32_t firstTexelRow = row * blockExtent;
+			region.imageOffset = { 0, static_cast<int32_t>(firstTexelRow), 0 };
+			region.imageExtent = { levelWidth, std::min(rowCount * blockExtent, levelHeight - firstTexelRow), 1 };
+
+			m_current.imageCopies.push_back({ image, region });
+		}
+
+		source += levelSize;
+	}
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	m_current.postBarriers.push_back(barrier);
+}
+
+uint64_t UploadQueue::flush() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_current.empty()) {
+		submitBatch();
+	}
+	return m_nextTicket - 1;
+}
+
+bool UploadQueue::isComplete(uint64_t ticket) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	retireBatches(false);
+	return ticket <= m_completedTicket;
+}
+
+void UploadQueue::wait(uint64_t ticket) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (ticket >= m_nextTicket && !m_current.empty()) {
+		submitBatch();
+	}
+	while (ticket > m_completedTicket && !m_inFlight.empty()) {
+		retireBatches(true);
+	}
+}
+
+VkDeviceSize UploadQueue::allocateStaging(VkDeviceSize size) {
+	VkDeviceSize offset;
+	while (!tryAllocateStaging(size, offset)) {
+		// Make room by submitting what has been recorded and waiting for the oldest batch
+		if (!m_current.empty()) {
+			submitBatch();
+		}
+		if (m_inFlight.empty()) {
+			LOG_ERROR("Upload does not fit in the staging ring");
+			throw std::runtime_error("Upload does not fit in the staging ring");
+		}
+		retireBatches(true);
+	}
+	return offset;
+}
+
+bool UploadQueue::tryAllocateStaging(VkDeviceSize size, VkDeviceSize &offset) {
+	if (m_used == 0) {
+		m_head = 0;
+		m_tail = 0;
+	}
+	else if (m_head == m_tail) {
+		return false;
+	}
+
+	VkDeviceSize start = alignUp(m_head, UPLOAD_QUEUE_ALIGNMENT);
+	VkDeviceSize consumed;
+	if (m_head >= m_tail) {
+		if (start + size <= m_ringSize) {
+			consumed = start + size - m_head;
+		}
+		else if (size <= m_tail) {
+			// Wrap around, the skipped end of the ring is accounted to this batch
+			consumed = (m_ringSize - m_head) + size;
+			start = 0;
+		}
+		else {
+			return false;
+		}
+	}
+	else if (start + size <= m_tail) {
+		consumed = start + size - m_head;
+	}
+	else {
+		return false;
+	}
+
+	m_current.ringBytes += consumed;
+	m_used += consumed;
+	m_head = start + size;
+	m_current.ringEnd = m_head;
+
+	offset = start;
+	return true;
+}
+
+void UploadQueue::submitBatch() {
+	Batch batch = std::move(m_current);
+	m_current = Batch{};
+	batch.ticket = m_nextTicket++;
+
+	if (m_freeCommandBuffers.empty()) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = m_commandPool;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(m_device, &allocInfo, &batch.commandBuffer) != VK_SUCCESS) {
+			LOG_ERROR("Failed to allocate upload command buffer");
+			throw std::runtime_error("Failed to allocate upload command buffer");
+		}
+	}
+	else {
+		batch.commandBuffer = m_freeCommandBuffers.back();
+		m_freeCommandBuffers.pop_back();
+	}
+
+	if (m_freeFences.empty()) {
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(m_device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+			LOG_ERROR("Failed to create upload fence");
+			throw std::runtime_error("Failed to create upload fence");
+		}
+	}
+	else {
+		batch.fence = m_freeFences.back();
+		m_freeFences.pop_back();
+	}
+
+	recordBatch(batch);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.commandBuffer;
+	m_renderer->submit(submitInfo, batch.fence);
+
+	m_inFlight.push_back(std::move(batch));
+}
+
+void UploadQueue::recordBatch(const Batch &batch) {
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+
+	if (!batch.preBarriers.empty()) {
+		vkCmdPipelineBarrier(
+			batch.commandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			static_cast<uint32_t>(batch.preBarriers.size()), batch.preBarriers.data());
+	}
+
+	// Ranges still read by earlier submissions are only overwritten once those reads are done
+	if (batch.readStages) {
+		vkCmdPipelineBarrier(
+			batch.commandBuffer,
+			batch.readStages, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			0, nullptr,
+			0, nullptr,
+			0, nullptr);
+	}
+
+	// Consecutive copies to the same resource are recorded as one command
+	std::vector<VkBufferCopy> bufferRegions;
+	for (size_t i = 0; i < batch.bufferCopies.size(); ++i) {
+		bufferRegions.push_back(batch.bufferCopies[i].region);
+		if (i + 1 == batch.bufferCopies.size() || batch.bufferCopies[i + 1].buffer != batch.bufferCopies[i].buffer) {
+			vkCmdCopyBuffer(batch.commandBuffer, m_stagingBuffer, batch.bufferCopies[i].buffer,
+				static_cast<uint32_t>(bufferRegions.size()), bufferRegions.data());
+			bufferRegions.clear();
+		}
+	}
+
+	std::vector<VkBufferImageCopy> imageRegions;
+	for (size_t i = 0; i < batch.imageCopies.size(); ++i) {
+		imageRegions.push_back(batch.imageCopies[i].region);
+		if (i + 1 == batch.imageCopies.size() || batch.imageCopies[i + 1].image != batch.imageCopies[i].image) {
+			vkCmdCopyBufferToImage(batch.commandBuffer, m_stagingBuffer, batch.imageCopies[i].image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(imageRegions.size()), imageRegions.data());
+			imageRegions.clear();
+		}
+	}
+
+	// Make the written buffers visible to vertex input, culling compute shaders, indirect draws and shaders in later
+	// submissions
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+		VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	uint32_t memoryBarrierCount = batch.bufferCopies.empty() ? 0 : 1;
+	if (memoryBarrierCount || !batch.postBarriers.empty()) {
+		vkCmdPipelineBarrier(
+			batch.commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			memoryBarrierCount, &memoryBarrier,
+			0, nullptr,
+			static_cast<uint32_t>(batch.postBarriers.size()), batch.postBarriers.data());
+	}
+
+	if (vkEndCommandBuffer(batch.commandBuffer) != VK_SUCCESS) {
+		LOG_ERROR("Failed to record upload command buffer");
+		throw std::runtime_error("Failed to record upload command buffer");
+	}
+}
+
+void UploadQueue::retireBatches(bool wait) {
+	if (wait && !m_inFlight.empty()) {
+		vkWaitForFences(m_device, 1, &m_inFlight.front().fence, VK_TRUE, UINT64_MAX);
+	}
+
+	// Batches share one queue, so they are retired in submission order
+	while (!m_inFlight.empty() && vkGetFenceStatus(m_device, m_inFlight.front().fence) == VK_SUCCESS) {
+		Batch &batch = m_inFlight.front();
+
+		vkResetFences(m_device, 1, &batch.fence);
+		vkResetCommandBuffer(batch.commandBuffer, 0);
+		m_freeFences.push_back(batch.fence);
+		m_freeCommandBuffers.push_back(batch.commandBuffer);
+
+		m_tail = batch.ringEnd;
+		m_used -= batch.ringBytes;
+		m_completedTicket = batch.ticket;
+
+		m_inFlight.pop_front();
+	}
+}
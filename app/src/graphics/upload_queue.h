@@ -0,0 +1,97 @@
+#pragma once
+
+#include <glad/vulkan.h>
+
+#include <vector>
+#include <deque>
+#include <mutex>
+
+#include "graphics/memory.h"
+#include "data/image.h"
+
+
+#define UPLOAD_QUEUE_RING_SIZE (64ull * 1024 * 1024)
+// Largest piece of a resource staged at once, bigger resources are split into several copies
+#define UPLOAD_QUEUE_CHUNK_SIZE (UPLOAD_QUEUE_RING_SIZE / 4)
+#define UPLOAD_QUEUE_ALIGNMENT 16
+
+class Renderer;
+
+// Uploads data to device local resources through a fixed size, persistently mapped staging ring.
+// Copies and barriers are batched into one command buffer which is submitted with a fence on flush,
+// or earlier when the ring runs out of space. All functions are safe to call from multiple threads.
+class UploadQueue {
+public:
+	void init(const Renderer *renderer, VkDeviceSize ringSize = UPLOAD_QUEUE_RING_SIZE);
+	void destroy();
+
+	// Read stages are those of earlier submissions that may still read the range, the copy waits for them
+	void uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data, VkDeviceSize size, VkPipelineStageFlags readStages = 0);
+	// Uploads tightly packed texels and leaves the image in the shader read only layout.
+	// Mip levels follow each other in data, largest first. Size is only used for single level images.
+	void uploadImage(VkImage image, ImageFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, const void *data, VkDeviceSize size);
+
+	// Submits everything recorded so far. The returned ticket completes once the copies have executed.
+	uint64_t flush();
+	bool isComplete(uint64_t ticket);
+	void wait(uint64_t ticket);
+
+private:
+	struct BufferCopy {
+		VkBuffer buffer;
+		VkBufferCopy region;
+	};
+
+	struct ImageCopy {
+		VkImage image;
+		VkBufferImageCopy region;
+	};
+
+	struct Batch {
+		uint64_t ticket = 0;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+
+		// Ring bytes used by the batch, including alignment and wrap around padding
+		VkDeviceSize ringBytes = 0;
+		VkDeviceSize ringEnd = 0;
+
+		std::vector<VkImageMemoryBarrier> preBarriers;
+		std::vector<BufferCopy> bufferCopies;
+		std::vector<ImageCopy> imageCopies;
+		std::vector<VkImageMemoryBarrier> postBarriers;
+		VkPipelineStageFlags readStages = 0;
+
+		bool empty() const { return bufferCopies.empty() && imageCopies.empty(); }
+	};
+
+	VkDeviceSize allocateStaging(VkDeviceSize size);
+	bool tryAllocateStaging(VkDeviceSize size, VkDeviceSize &offset);
+
+	void submitBatch();
+	void recordBatch(const Batch &batch);
+	void retireBatches(bool wait);
+
+	const Renderer *m_renderer = nullptr;
+	VkDevice m_device = VK_NULL_HANDLE;
+
+	VkCommandPool m_commandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> m_freeCommandBuffers;
+	std::vector<VkFence> m_freeFences;
+
+	// Staging ring
+	VkBuffer m_stagingBuffer = VK_NULL_HANDLE;
+	MemoryAllocation m_stagingMemory;
+	std::byte *m_stagingData = nullptr;
+	VkDeviceSize m_ringSize = 0;
+	VkDeviceSize m_head = 0;
+	VkDeviceSize m_tail = 0;
+	VkDeviceSize m_used = 0;
+
+	Batch m_current;
+	std::deque<Batch> m_inFlight;
+	uint64_t m_nextTicket = 1;
+	uint64_t m_completedTicket = 0;
+
+	std::mutex m_mutex;
+};
@@ -0,0 +1,53 @@
+#include "hash.h"
+
+#include <cstring>
+
+
+static uint64_t mix(uint64_t value) {
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDull;
+	value ^= value >> 33;
+	value *= 0xC4CEB9FE1A85EC53ull;
+	value ^= value >> 33;
+	return value;
+}
+
+static uint64_t rotateLeft(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed) {
+	const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+	// Four independent lanes keep the multiplies from serializing on large inputs
+	uint64_t lanes[4] = {
+		seed + 0x9E3779B97F4A7C15ull,
+		seed + 0xC2B2AE3D27D4EB4Full,
+		seed + 0x165667B19E3779F9ull,
+		seed + 0x85EBCA77C2B2AE63ull
+	};
+
+	size_t offset = 0;
+	for (; offset + 32 <= size; offset += 32) {
+		for (int lane = 0; lane < 4; ++lane) {
+			uint64_t word;
+			memcpy(&word, bytes + offset + lane * 8, sizeof(word));
+			lanes[lane] = rotateLeft(lanes[lane] + word * 0xC2B2AE3D27D4EB4Full, 31) * 0x9E3779B97F4A7C15ull;
+		}
+	}
+
+	uint64_t hash = size;
+	for (uint64_t lane : lanes) {
+		hash = hashCombine(hash, mix(lane));
+	}
+
+	for (; offset + 8 <= size; offset += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + offset, sizeof(word));
+		hash = hashCombine(hash, mix(word));
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, bytes + offset, size - offset);
+	return mix(hashCombine(hash, tail));
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+
+// Fast non-cryptographic 64 bit hash, used to identify content such as image data
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+inline uint64_t hashCombine(uint64_t seed, uint64_t value) {
+	return seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+}
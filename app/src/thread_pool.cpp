@@ -0,0 +1,109 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <algorithm>
+
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	m_threads.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; ++i) {
+		m_threads.emplace_back(&ThreadPool::work, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+
+	for (auto &thread : m_threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::work() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+			if (m_stopping && m_tasks.empty()) {
+				return;
+			}
+
+			task = std::move(m_tasks.front());
+			m_tasks.pop();
+		}
+		task();
+	}
+}
+
+struct ParallelForState {
+	std::function<void(size_t)> task;
+	size_t count = 0;
+	std::atomic<size_t> next{ 0 };
+
+	std::mutex mutex;
+	std::condition_variable finished;
+	size_t active = 0;
+	std::exception_ptr error;
+
+	void run() {
+		for (size_t i = next++; i < count; i = next++) {
+			try {
+				task(i);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+				next = count;
+			}
+		}
+	}
+};
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &task) {
+	if (count == 0) {
+		return;
+	}
+
+	auto state = std::make_shared<ParallelForState>();
+	state->task = task;
+	state->count = count;
+
+	// Helpers that start after all indices are claimed return immediately,
+	// so the caller never waits on tasks queued behind other work
+	size_t helperCount = std::min(count - 1, m_threads.size());
+	for (size_t i = 0; i < helperCount; ++i) {
+		submit([state]() {
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				++state->active;
+			}
+			state->run();
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				--state->active;
+			}
+			state->finished.notify_all();
+		});
+	}
+
+	state->run();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&state]() { return state->active == 0; });
+
+	if (state->error) {
+		std::rethrow_exception(state->error);
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+
+class ThreadPool {
+public:
+	// A thread count of 0 uses the hardware concurrency
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	template<typename F>
+	auto submit(F &&task) -> std::future<decltype(task())> {
+		using Result = decltype(task());
+		auto packagedTask = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+		std::future<Result> future = packagedTask->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.emplace([packagedTask]() { (*packagedTask)(); });
+		}
+		m_condition.notify_one();
+		return future;
+	}
+
+	// Runs task(i) for every i in [0, count). The calling thread takes part in the work,
+	// which makes it safe to call from inside a pool task.
+	void parallelFor(size_t count, const std::function<void(size_t)> &task);
+
+	size_t getThreadCount() const { return m_threads.size(); }
+
+private:
+	void work();
+
+	std::vector<std::thread> m_threads;
+	std::queue<std::function<void()>> m_tasks;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_stopping = false;
+};
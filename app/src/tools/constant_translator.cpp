@@ -12,24 +12,45 @@ VkFilter convertGLFilterToVulkan(int value) {
 	case 9729: // GL_LINEAR
 		return VK_FILTER_LINEAR;
 
-	case 9986: // GL_NEAREST_MIPMAP_LINEAR
-		LOG_WARN("Unssuported filter 'GL_NEAREST_MIPMAP_LINEAR' used. Using GL_LINEAR instead.");
+	case 9984: // GL_NEAREST_MIPMAP_NEAREST
+		return VK_FILTER_NEAREST;
+	case 9985: // GL_LINEAR_MIPMAP_NEAREST
 		return VK_FILTER_LINEAR;
+	case 9986: // GL_NEAREST_MIPMAP_LINEAR
+		return VK_FILTER_NEAREST;
 	case 9987: // GL_LINEAR_MIPMAP_LINEAR
-		LOG_WARN("Unssuported filter 'GL_LINEAR_MIPMAP_LINEAR' used. Using GL_LINEAR instead.");
 		return VK_FILTER_LINEAR;
 
 	case -1:
 		LOG_DEBUG("OpenGL filter constant -1 was converted to VK_FILTER_LINEAR");
 		return VK_FILTER_LINEAR;
 
-	// TODO: Implement remaining possible values
 	default:
 		LOG_ERROR("Failed to convert OpenGL filter value to vulkan. Value: {}", value);
 		throw std::runtime_error("Failed to convert OpenGL filter value to vulkan");
 	}
 }
 
+VkSamplerMipmapMode convertGLFilterToVulkanMipmapMode(int value) {
+	switch (value) {
+	case 9984: // GL_NEAREST_MIPMAP_NEAREST
+	case 9985: // GL_LINEAR_MIPMAP_NEAREST
+		return VK_SAMPLER_MIPMAP_MODE_NEAREST;
+
+	// Filters without a mipmap part only sample the base level, see getModelTextures
+	case 9728: // GL_NEAREST
+	case 9729: // GL_LINEAR
+	case 9986: // GL_NEAREST_MIPMAP_LINEAR
+	case 9987: // GL_LINEAR_MIPMAP_LINEAR
+	case -1:
+		return VK_SAMPLER_MIPMAP_MODE_LINEAR;
+
+	default:
+		LOG_ERROR("Failed to convert OpenGL filter value to vulkan mipmap mode. Value: {}", value);
+		throw std::runtime_error("Failed to convert OpenGL filter value to vulkan mipmap mode");
+	}
+}
+
 VkSamplerAddressMode convertGLWrapModeToVulkan(int value) {
 	switch (value) {
 	case 10497: // GL_REPEAT
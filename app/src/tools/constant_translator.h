@@ -3,6 +3,7 @@
 #include <glad/vulkan.h>
 
 VkFilter convertGLFilterToVulkan(int value);
+VkSamplerMipmapMode convertGLFilterToVulkanMipmapMode(int value);
 VkSamplerAddressMode convertGLWrapModeToVulkan(int value);
 
 size_t componentByteSize(int value);
@@ -1,92 +1,472 @@
 #include "convert_model.h"
 
 #include <tiny_gltf.h>
+#include <stb_image.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cmath>
 
 #include "data/image.h"
 #include "data/texture.h"
+#include "data/vertex_layout.h"
+#include "data/geometry.h"
 #include "tools/constant_translator.h"
 #include "tools/convert_vector.h"
+#include "tools/mipmaps.h"
+#include "tools/texture_compression.h"
+#include "tools/mesh_optimization.h"
+#include "tools/mesh_simplification.h"
+#include "tools/meshlets.h"
+#include "thread_pool.h"
+#include "hash.h"
 #include "log.h"
 
-std::vector<std::byte> extractData(const tinygltf::Buffer &buffer, const tinygltf::BufferView &bufferView, size_t bufferViewOffset, size_t size) {
-	const std::byte *base = reinterpret_cast<const std::byte *>(buffer.data.data()) + bufferViewOffset + bufferView.byteOffset;
-	return std::vector<std::byte>(base, base + size);
+
+size_t accessorElementSize(const tinygltf::Accessor &accessor) {
+	return componentByteSize(accessor.componentType) * componentTypeComponents(accessor.type);
 }
 
-size_t accessorByteSize(const tinygltf::Accessor &accessor) {
-	size_t componentSize = componentByteSize(accessor.componentType);
-	size_t componentTypeCount = componentTypeComponents(accessor.type);
-	return componentSize * componentTypeCount * accessor.count;
+const std::byte *accessorData(const tinygltf::Accessor &accessor, const tinygltf::Model &model) {
+	const auto &bufferView = model.bufferViews[accessor.bufferView];
+	const auto &buffer = model.buffers[bufferView.buffer];
+	return reinterpret_cast<const std::byte *>(buffer.data.data()) + accessor.byteOffset + bufferView.byteOffset;
 }
 
-std::vector<Mesh> convertToModelSourceMeshes(const tinygltf::Mesh &mesh, const tinygltf::Model &model, std::vector<std::byte> &vertexData) {
-	std::vector<Mesh> meshes;
+// Every LOD is at least this much smaller than the previous one, otherwise the chain ends
+#define LOD_MIN_REDUCTION 0.8f
+
+// Vertex cache efficiency of one primitive before and after optimization
+struct PrimitiveStatistics {
+	VertexCacheStatistics before;
+	VertexCacheStatistics after;
+};
+
+struct PlannedLod {
+	size_t firstIndex;
+	size_t indexCount;
+	float error;
+};
+
+// Location of one primitive in the geometry streams, computed before any data is copied
+struct PrimitivePlan {
+	const tinygltf::Primitive *primitive;
+	VertexFormat vertexFormat = VertexFormat::SEPARATE;
+
+	int positionAccessor = -1;
+	int textureCoordinateAccessor = -1;
+	int normalAccessor = -1;
+
+	size_t vertexCount = 0;
+	size_t vertexOffset = 0; // In the vertex streams of the format
+	// Source vertex of every vertex when a primitive too large for 16 bit indices was split, empty otherwise
+	std::vector<uint32_t> sourceVertices;
+	size_t firstIndex = 0;
+
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+
+	// Quantization of packed positions, center and half extent of the bounds
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	float positionScale = 1.0f;
+
+	// Processed indices of all LODs back to back, and the vertex order picked by the optimizer (empty keeps the source order)
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> vertexOrder;
+	std::vector<PlannedLod> lods;
+	std::vector<Meshlet> meshlets;
+	size_t meshletStart = 0; // In the meshlet table of the model
+	PrimitiveStatistics statistics;
+};
+
+// A mesh reached while walking the node tree. Meshes are converted once per visit.
+struct MeshVisit {
+	int mesh;
+	glm::mat4 transform;
+
+	size_t firstPrimitive;
+	size_t primitiveCount;
+};
+
+// Bounds from the accessor limits, which glTF requires for positions. Falls back to scanning the data.
+void getPositionBounds(const tinygltf::Accessor &accessor, const tinygltf::Model &model, glm::vec3 &min, glm::vec3 &max) {
+	if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+		min = glm::vec3(float(accessor.minValues[0]), float(accessor.minValues[1]), float(accessor.minValues[2]));
+		max = glm::vec3(float(accessor.maxValues[0]), float(accessor.maxValues[1]), float(accessor.maxValues[2]));
+		return;
+	}
 
-	for (const auto &primitive : mesh.primitives) {
-		std::vector<std::byte> positionData;
-		std::vector<std::byte> textureCoordinateData;
-		std::vector<std::byte> normalData;
-		std::vector<std::byte> indexData;
+	const float *positions = reinterpret_cast<const float *>(accessorData(accessor, model));
+	min = glm::vec3(0.0f);
+	max = glm::vec3(0.0f);
+	for (size_t i = 0; i < accessor.count; ++i) {
+		glm::vec3 position(positions[i * 3 + 0], positions[i * 3 + 1], positions[i * 3 + 2]);
+		min = i ? glm::min(min, position) : position;
+		max = i ? glm::max(max, position) : position;
+	}
+}
 
-		for (const auto &[key, value] : primitive.attributes) {
-			const auto &accessor = model.accessors[value];
-			const auto &bufferView = model.bufferViews[accessor.bufferView];
-			const auto &buffer = model.buffers[bufferView.buffer];
-			// TODO: Check for if accessor is sparse, if its tightly packed (stride = 0) and if buffer view is targeted for indexed rendering
+// Picks the quantization of packed positions from the bounds
+void planQuantization(PrimitivePlan &plan, const ConvertOptions &options) {
+	if (options.packVertices && plan.positionAccessor != -1) {
+		// A uniform scale keeps normals valid under the dequantization transform
+		glm::vec3 extent = (plan.boundsMax - plan.boundsMin) * 0.5f;
+		float scale = std::max(extent.x, std::max(extent.y, extent.z));
 
-			if (key == "POSITION")
-				positionData = extractData(buffer, bufferView, accessor.byteOffset, accessorByteSize(accessor));
-			else if (key == "TEXCOORD_0")
-				textureCoordinateData = extractData(buffer, bufferView, accessor.byteOffset, accessorByteSize(accessor));
-			else if (key == "NORMAL")
-				normalData = extractData(buffer, bufferView, accessor.byteOffset, accessorByteSize(accessor));
+		plan.vertexFormat = VertexFormat::PACKED;
+		plan.positionOffset = (plan.boundsMin + plan.boundsMax) * 0.5f;
+		plan.positionScale = scale > 0.0f ? scale : 1.0f;
+	}
+}
+
+PrimitivePlan planPrimitive(const tinygltf::Primitive &primitive, const tinygltf::Model &model, const ConvertOptions &options) {
+	PrimitivePlan plan{};
+	plan.primitive = &primitive;
+
+	for (const auto &[key, value] : primitive.attributes) {
+		// TODO: Check for if accessor is sparse, if its tightly packed (stride = 0) and if buffer view is targeted for indexed rendering
+		if (key == "POSITION") {
+			plan.positionAccessor = value;
+			plan.vertexCount = model.accessors[value].count;
+		}
+		else if (key == "TEXCOORD_0") {
+			plan.textureCoordinateAccessor = value;
 		}
+		else if (key == "NORMAL") {
+			plan.normalAccessor = value;
+		}
+	}
+
+	if (plan.positionAccessor != -1) {
+		getPositionBounds(model.accessors[plan.positionAccessor], model, plan.boundsMin, plan.boundsMax);
+	}
+	planQuantization(plan, options);
+
+	return plan;
+}
+
+int16_t quantizeSnorm16(float value) {
+	return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+// Projects the unit sphere onto an octahedron and unfolds it onto the [-1, 1] square
+glm::vec2 encodeOctahedral(glm::vec3 normal) {
+	float length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+	if (length == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+	normal = normal / length;
+
+	if (normal.z >= 0.0f) {
+		return glm::vec2(normal.x, normal.y);
+	}
+	return glm::vec2(
+		(1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f),
+		(1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f));
+}
 
-		const auto &indicesAccessor = model.accessors[primitive.indices];
-		const auto &indicesBufferView = model.bufferViews[indicesAccessor.bufferView];
-		indexData = extractData(model.buffers[indicesBufferView.buffer], indicesBufferView, indicesAccessor.byteOffset, accessorByteSize(indicesAccessor));
+void packVertices(const PrimitivePlan &plan, const tinygltf::Model &model, const std::vector<uint32_t> &vertexOrder, std::byte *target) {
+	using Vertex = VertexLayout<VertexFormat::PACKED>::Vertex;
 
-		// TODO: Make sure indicesAccessor.componentType is properly used
+	const tinygltf::Accessor &positionAccessor = model.accessors[plan.positionAccessor];
+	const float *positions = reinterpret_cast<const float *>(accessorData(positionAccessor, model));
+	const float *textureCoordinates = plan.textureCoordinateAccessor != -1
+		? reinterpret_cast<const float *>(accessorData(model.accessors[plan.textureCoordinateAccessor], model)) : nullptr;
+	const float *normals = plan.normalAccessor != -1
+		? reinterpret_cast<const float *>(accessorData(model.accessors[plan.normalAccessor], model)) : nullptr;
 
-		// TODO: Extract image data
+	float inverseScale = 1.0f / plan.positionScale;
 
-		// Make sure data is aligned
-		for (size_t i = vertexData.size(); i % 4 != 0; ++i) {
-			vertexData.push_back(std::byte{0});
+	for (size_t i = 0; i < plan.vertexCount; ++i) {
+		size_t source = vertexOrder.empty() ? i : vertexOrder[i];
+		Vertex vertex{};
+
+		for (int c = 0; c < 3; ++c) {
+			vertex.position[c] = quantizeSnorm16((positions[source * 3 + c] - plan.positionOffset[c]) * inverseScale);
+		}
+		if (textureCoordinates) {
+			vertex.textureCoordinate[0] = glm::packHalf1x16(textureCoordinates[source * 2 + 0]);
+			vertex.textureCoordinate[1] = glm::packHalf1x16(textureCoordinates[source * 2 + 1]);
+		}
+		if (normals) {
+			glm::vec2 encoded = encodeOctahedral(glm::vec3(normals[source * 3 + 0], normals[source * 3 + 1], normals[source * 3 + 2]));
+			vertex.normal[0] = quantizeSnorm16(encoded.x);
+			vertex.normal[1] = quantizeSnorm16(encoded.y);
 		}
 
-		size_t baseOffset = vertexData.size();
+		memcpy(target + i * sizeof(Vertex), &vertex, sizeof(Vertex));
+	}
+}
 
-		// Order is normalized
-		vertexData.insert(vertexData.end(), positionData.begin(), positionData.end());
-		vertexData.insert(vertexData.end(), textureCoordinateData.begin(), textureCoordinateData.end());
-		vertexData.insert(vertexData.end(), normalData.begin(), normalData.end());
-		vertexData.insert(vertexData.end(), indexData.begin(), indexData.end());
+// Copies a stream of count elements, in vertexOrder when the optimizer reordered the vertices
+void gatherVertices(const std::byte *source, size_t elementSize, size_t count, const std::vector<uint32_t> &vertexOrder, std::byte *target) {
+	if (vertexOrder.empty()) {
+		memcpy(target, source, elementSize * count);
+		return;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		memcpy(target + i * elementSize, source + vertexOrder[i] * elementSize, elementSize);
+	}
+}
 
-		meshes.push_back({
-			baseOffset,
-			positionData.size(),
+// Indices are widened to 32 bit for processing and written back as geometry indices, whatever their source type,
+// which is the only width the index stream and cluster culling read
+std::vector<uint32_t> readIndices(const tinygltf::Accessor &accessor, const tinygltf::Model &model) {
+	const std::byte *data = accessorData(accessor, model);
+	std::vector<uint32_t> indices(accessor.count);
+
+	for (size_t i = 0; i < accessor.count; ++i) {
+		switch (accessor.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			indices[i] = reinterpret_cast<const uint8_t *>(data)[i];
+			break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+			indices[i] = reinterpret_cast<const uint16_t *>(data)[i];
+			break;
+		default:
+			indices[i] = reinterpret_cast<const uint32_t *>(data)[i];
+			break;
+		}
+	}
+	return indices;
+}
 
-			baseOffset + positionData.size(),
-			textureCoordinateData.size(),
+void writeIndices(const std::vector<uint32_t> &indices, std::byte *target) {
+	for (size_t i = 0; i < indices.size(); ++i) {
+		reinterpret_cast<GeometryIndex *>(target)[i] = static_cast<GeometryIndex>(indices[i]);
+	}
+}
 
-			baseOffset + positionData.size() + textureCoordinateData.size(),
-			normalData.size(),
+// Builds the LOD chain from the first LOD, each level simplified from the previous one
+void generateLods(PrimitivePlan &plan, const float *positions, size_t vertexCount, bool optimize) {
+	std::vector<uint32_t> level(plan.indices);
+	float error = 0.0f;
 
-			baseOffset + positionData.size() + textureCoordinateData.size() + normalData.size(),
-			indexData.size(),
+	while (plan.lods.size() < MAX_MESH_LODS) {
+		float levelError;
+		std::vector<uint32_t> simplified = simplifyMesh(level.data(), level.size(), positions, vertexCount, level.size() / 6 * 3, levelError);
+		if (simplified.empty() || simplified.size() > level.size() * LOD_MIN_REDUCTION) {
+			break;
+		}
 
-			indicesAccessor.count,
+		if (optimize) {
+			std::vector<uint32_t> cacheOrdered(simplified.size());
+			optimizeVertexCache(cacheOrdered.data(), simplified.data(), simplified.size(), vertexCount);
+			simplified.swap(cacheOrdered);
+		}
 
-			primitive.material
-		});
+		// Errors are measured against the previous level, they add up at worst
+		error += levelError;
+		plan.lods.push_back({ plan.indices.size(), simplified.size(), error });
+		plan.indices.insert(plan.indices.end(), simplified.begin(), simplified.end());
+		level.swap(simplified);
 	}
+}
+
+// Splits an indexed triangle list into chunks whose vertices fit 16 bit indices, keeping triangles in order.
+// Other topologies can't be split on triangle boundaries and are returned as is.
+std::vector<PrimitivePlan> splitPrimitive(const PrimitivePlan &plan, const tinygltf::Model &model, const ConvertOptions &options) {
+	bool triangleList = plan.primitive->mode == -1 || plan.primitive->mode == TINYGLTF_MODE_TRIANGLES;
+	if (!triangleList || plan.positionAccessor == -1) {
+		return { plan };
+	}
+
+	std::vector<uint32_t> indices = readIndices(model.accessors[plan.primitive->indices], model);
+	const float *positions = reinterpret_cast<const float *>(accessorData(model.accessors[plan.positionAccessor], model));
+
+	std::vector<PrimitivePlan> chunks;
+	std::vector<uint32_t> localVertices(plan.vertexCount, UINT32_MAX);
+	PrimitivePlan chunk;
 
-	return meshes;
+	auto finishChunk = [&]() {
+		for (size_t i = 0; i < chunk.sourceVertices.size(); ++i) {
+			uint32_t source = chunk.sourceVertices[i];
+			glm::vec3 position(positions[source * 3 + 0], positions[source * 3 + 1], positions[source * 3 + 2]);
+			chunk.boundsMin = i ? glm::min(chunk.boundsMin, position) : position;
+			chunk.boundsMax = i ? glm::max(chunk.boundsMax, position) : position;
+			localVertices[source] = UINT32_MAX;
+		}
+		chunk.vertexCount = chunk.sourceVertices.size();
+		planQuantization(chunk, options);
+		chunks.push_back(std::move(chunk));
+		chunk = PrimitivePlan{};
+	};
+
+	for (size_t triangle = 0; triangle + 2 < indices.size(); triangle += 3) {
+		if (std::any_of(&indices[triangle], &indices[triangle] + 3, [&](uint32_t index) { return index >= plan.vertexCount; })) {
+			continue;
+		}
+
+		size_t newVertices = 0;
+		for (size_t corner = 0; corner < 3; ++corner) {
+			newVertices += localVertices[indices[triangle + corner]] == UINT32_MAX;
+		}
+		if (chunk.sourceVertices.size() + newVertices > GEOMETRY_MAX_MESH_VERTICES) {
+			finishChunk();
+		}
+		if (chunk.sourceVertices.empty()) {
+			chunk = PrimitivePlan{};
+			chunk.primitive = plan.primitive;
+			chunk.positionAccessor = plan.positionAccessor;
+			chunk.textureCoordinateAccessor = plan.textureCoordinateAccessor;
+			chunk.normalAccessor = plan.normalAccessor;
+		}
+
+		for (size_t corner = 0; corner < 3; ++corner) {
+			uint32_t &local = localVertices[indices[triangle + corner]];
+			if (local == UINT32_MAX) {
+				local = static_cast<uint32_t>(chunk.sourceVertices.size());
+				chunk.sourceVertices.push_back(indices[triangle + corner]);
+			}
+			chunk.indices.push_back(local);
+		}
+	}
+	if (!chunk.sourceVertices.empty()) {
+		finishChunk();
+	}
+
+	LOG_INFO("Split primitive with {} vertices into {} meshes for 16 bit indices", plan.vertexCount, chunks.size());
+	return chunks;
+}
+
+// Runs before the layout, as simplification decides the final index size. Reorders triangles for the vertex cache
+// and clusters for overdraw, generates the LODs and finally reorders vertices for fetch locality.
+void processPrimitive(PrimitivePlan &plan, const tinygltf::Model &model, const ConvertOptions &options) {
+	const tinygltf::Accessor &indexAccessor = model.accessors[plan.primitive->indices];
+
+	// Triangle lists were split into chunks that fit, so only other topologies are left too large
+	if (plan.vertexCount > GEOMETRY_MAX_MESH_VERTICES) {
+		LOG_ERROR("Skipping primitive with {} vertices, more than 16 bit indices can address and not a triangle list", plan.vertexCount);
+		plan.vertexCount = 0;
+		plan.lods = { { 0, 0, 0.0f } };
+		return;
+	}
+
+	// Chunks of split primitives already hold their renumbered indices
+	if (plan.sourceVertices.empty()) {
+		plan.indices = readIndices(indexAccessor, model);
+	}
+	plan.lods = { { 0, plan.indices.size(), 0.0f } };
+
+	if (plan.positionAccessor != -1 && (options.optimizeMeshes || options.generateLods)) {
+		const tinygltf::Accessor &positionAccessor = model.accessors[plan.positionAccessor];
+		const float *positions = reinterpret_cast<const float *>(accessorData(positionAccessor, model));
+		size_t vertexCount = positionAccessor.count;
+
+		std::vector<float> chunkPositions;
+		if (!plan.sourceVertices.empty()) {
+			chunkPositions.resize(plan.vertexCount * 3);
+			for (size_t i = 0; i < plan.vertexCount; ++i) {
+				memcpy(&chunkPositions[i * 3], positions + plan.sourceVertices[i] * 3, sizeof(float) * 3);
+			}
+			positions = chunkPositions.data();
+			vertexCount = plan.vertexCount;
+		}
+
+		std::vector<uint32_t> &indices = plan.indices;
+		bool triangleList = plan.primitive->mode == -1 || plan.primitive->mode == TINYGLTF_MODE_TRIANGLES;
+		bool validIndices = std::all_of(indices.begin(), indices.end(), [vertexCount](uint32_t index) { return index < vertexCount; });
+
+		if (triangleList && validIndices && indices.size() % 3 == 0) {
+			if (options.optimizeMeshes) {
+				plan.statistics.before = analyzeVertexCache(indices.data(), indices.size(), vertexCount);
+
+				std::vector<uint32_t> clusters;
+				std::vector<uint32_t> cacheOrdered(indices.size());
+				optimizeVertexCache(cacheOrdered.data(), indices.data(), indices.size(), vertexCount, &clusters);
+				optimizeOverdraw(indices.data(), cacheOrdered.data(), cacheOrdered.size(), positions, vertexCount, clusters);
+			}
+
+			// Meshlets split the first LOD in its final triangle order, vertex renumbering below keeps the ranges valid
+			if (options.buildMeshlets) {
+				int material = plan.primitive->material;
+				bool backfaceCulling = material < 0 || material >= static_cast<int>(model.materials.size()) || !model.materials[material].doubleSided;
+				plan.meshlets = buildMeshlets(indices.data(), indices.size(), positions, vertexCount, backfaceCulling);
+			}
+
+			if (options.generateLods) {
+				generateLods(plan, positions, vertexCount, options.optimizeMeshes);
+			}
+
+			// All LODs are remapped together, the first one decides the vertex order
+			if (options.optimizeMeshes) {
+				plan.vertexOrder = optimizeVertexFetch(indices.data(), indices.size(), vertexCount);
+				plan.statistics.after = analyzeVertexCache(indices.data(), plan.lods[0].indexCount, vertexCount);
+			}
+		}
+	}
+
+	// Vertices of chunks are read from the source through their vertex order
+	if (!plan.sourceVertices.empty()) {
+		if (plan.vertexOrder.empty()) {
+			plan.vertexOrder = plan.sourceVertices;
+		}
+		else {
+			for (uint32_t &vertex : plan.vertexOrder) {
+				vertex = plan.sourceVertices[vertex];
+			}
+		}
+	}
+}
+
+void fillPrimitive(const PrimitivePlan &plan, const tinygltf::Model &model, const GeometryLayout &layout, std::byte *vertexData) {
+	auto streamData = [&](GeometryStream stream, size_t element) {
+		return vertexData + layout.getStreamOffset(stream) + element * geometryStreamStride(stream);
+	};
+
+	if (plan.vertexFormat == VertexFormat::PACKED) {
+		packVertices(plan, model, plan.vertexOrder, streamData(GeometryStream::PACKED, plan.vertexOffset));
+	}
+	else {
+		// Missing attributes are left zero, the streams share one vertex numbering
+		const std::pair<int, GeometryStream> attributes[] = {
+			{ plan.positionAccessor, GeometryStream::POSITION },
+			{ plan.textureCoordinateAccessor, GeometryStream::TEXTURE_COORDINATE },
+			{ plan.normalAccessor, GeometryStream::NORMAL }
+		};
+		for (const auto &[accessorIndex, stream] : attributes) {
+			if (accessorIndex != -1) {
+				const tinygltf::Accessor &accessor = model.accessors[accessorIndex];
+				gatherVertices(accessorData(accessor, model), accessorElementSize(accessor), std::min(accessor.count, plan.vertexCount),
+					plan.vertexOrder, streamData(stream, plan.vertexOffset));
+			}
+		}
+	}
+
+	writeIndices(plan.indices, streamData(GeometryStream::INDEX, plan.firstIndex));
+}
+
+Mesh toMesh(const PrimitivePlan &plan) {
+	Mesh mesh{};
+	mesh.vertexOffset = static_cast<int32_t>(plan.vertexOffset);
+	mesh.firstIndex = static_cast<uint32_t>(plan.firstIndex);
+	mesh.indexCount = static_cast<uint32_t>(plan.lods[0].indexCount);
+	mesh.materialIndex = plan.primitive->material;
+
+	mesh.vertexFormat = plan.vertexFormat;
+	mesh.positionOffset = plan.positionOffset;
+	mesh.positionScale = plan.positionScale;
+
+	mesh.boundsMin = plan.boundsMin;
+	mesh.boundsMax = plan.boundsMax;
+	mesh.boundsCenter = (plan.boundsMin + plan.boundsMax) * 0.5f;
+	mesh.boundsRadius = glm::length(plan.boundsMax - plan.boundsMin) * 0.5f;
+
+	mesh.meshletStart = static_cast<uint32_t>(plan.meshletStart);
+	mesh.meshletCount = static_cast<uint32_t>(plan.meshlets.size());
+
+	mesh.lodCount = static_cast<uint32_t>(plan.lods.size());
+	for (size_t i = 0; i < plan.lods.size(); ++i) {
+		const PlannedLod &lod = plan.lods[i];
+		mesh.lods[i] = { static_cast<uint32_t>(plan.firstIndex + lod.firstIndex), static_cast<uint32_t>(lod.indexCount), lod.error };
+	}
+
+	return mesh;
 }
 
 glm::mat4 getNodeTransformationMatrix(const tinygltf::Node &node) {
@@ -107,9 +487,8 @@ glm::mat4 getNodeTransformationMatrix(const tinygltf::Node &node) {
 	return matrix;
 }
 
-void processNode(int nodeIndex, const tinygltf::Model &model, std::vector<std::byte> &vertexData,
-	std::unordered_map<int, std::vector<Mesh>> &modelMeshes, std::unordered_map<int, glm::mat4> &meshMatricies,
-	const glm::mat4& parentMatrix = glm::mat4(1.0f)) {
+void collectMeshVisits(int nodeIndex, const tinygltf::Model &model, const ConvertOptions &options, std::vector<MeshVisit> &visits,
+	std::vector<PrimitivePlan> &primitives, const glm::mat4 &parentMatrix = glm::mat4(1.0f)) {
 
 	const tinygltf::Node &node = model.nodes[nodeIndex];
 
@@ -117,38 +496,178 @@ void processNode(int nodeIndex, const tinygltf::Model &model, std::vector<std::b
 
 	if ((node.mesh >= 0) && (node.mesh < model.meshes.size())) {
 		const auto &mesh = model.meshes[node.mesh];
-		modelMeshes[node.mesh] = convertToModelSourceMeshes(mesh, model, vertexData);
-		meshMatricies[node.mesh] = transform;
+		size_t firstPrimitive = primitives.size();
+
+		for (const auto &primitive : mesh.primitives) {
+			PrimitivePlan plan = planPrimitive(primitive, model, options);
+			if (plan.vertexCount > GEOMETRY_MAX_MESH_VERTICES) {
+				for (PrimitivePlan &chunk : splitPrimitive(plan, model, options)) {
+					primitives.push_back(std::move(chunk));
+				}
+			}
+			else {
+				primitives.push_back(std::move(plan));
+			}
+		}
+		visits.push_back({ node.mesh, transform, firstPrimitive, primitives.size() - firstPrimitive });
 	}
 
 	for (int child : node.children) {
-		processNode(child, model, vertexData, modelMeshes, meshMatricies, transform);
+		collectMeshVisits(child, model, options, visits, primitives, transform);
+	}
+}
+
+// Assigns stream ranges in visit order
+GeometryLayout layoutPrimitives(std::vector<PrimitivePlan> &primitives) {
+	GeometryLayout layout;
+	for (auto &plan : primitives) {
+		uint32_t &vertexCount = plan.vertexFormat == VertexFormat::PACKED ? layout.packedVertexCount : layout.separateVertexCount;
+		plan.vertexOffset = vertexCount;
+		vertexCount += static_cast<uint32_t>(plan.vertexCount);
+
+		plan.firstIndex = layout.indexCount;
+		layout.indexCount += static_cast<uint32_t>(plan.indices.size());
+	}
+	return layout;
+}
+
+// How the materials sample an image, decides the format it is stored in
+enum ImageUsage : uint32_t {
+	IMAGE_USAGE_COLOR = 1 << 0,
+	IMAGE_USAGE_DATA = 1 << 1,
+	IMAGE_USAGE_NORMAL = 1 << 2,
+	IMAGE_USAGE_OCCLUSION = 1 << 3
+};
+
+std::vector<uint32_t> getImageUsages(const tinygltf::Model &model, const std::vector<ModelTextureData> &textures,
+	const std::vector<ModelMaterialData> &materials) {
+
+	std::vector<uint32_t> usages(model.images.size(), 0);
+	auto use = [&](int texture, uint32_t usage) {
+		if (texture != -1 && textures[texture].image >= 0) {
+			usages[textures[texture].image] |= usage;
+		}
+	};
+
+	for (const auto &material : materials) {
+		use(material.colorTexture, IMAGE_USAGE_COLOR);
+		use(material.emissiveTexture, IMAGE_USAGE_COLOR);
+		use(material.metallicRoughnessTexture, IMAGE_USAGE_DATA);
+		use(material.normalTexture, IMAGE_USAGE_NORMAL);
+		use(material.occlusionTexture, IMAGE_USAGE_OCCLUSION);
+	}
+	return usages;
+}
+
+ImageFormat selectImageFormat(uint32_t usage, const ConvertOptions &options) {
+	// Images no material references keep the sRGB default of their textures
+	bool color = usage == 0 || (usage & IMAGE_USAGE_COLOR);
+
+	if (!options.compressTextures) {
+		return color ? ImageFormat::SRGB : ImageFormat::LINEAR;
+	}
+	if (color) {
+		return options.preferBC1 ? ImageFormat::BC1_SRGB : ImageFormat::BC7_SRGB;
 	}
+	if (usage == IMAGE_USAGE_NORMAL) {
+		return ImageFormat::BC5_LINEAR;
+	}
+	if (usage == IMAGE_USAGE_OCCLUSION) {
+		return ImageFormat::BC4_LINEAR;
+	}
+	return options.preferBC1 ? ImageFormat::BC1_LINEAR : ImageFormat::BC7_LINEAR;
 }
 
-std::vector<ModelImageData> getModelImages(const tinygltf::Model& model, std::vector<std::byte>& imageData) {
+std::vector<ModelImageData> layoutModelImages(const tinygltf::Model &model, const std::vector<uint32_t> &usages,
+	const ConvertOptions &options, size_t &imageDataSize) {
+
 	std::vector<ModelImageData> images;
 	images.reserve(model.images.size());
 
-	for (const auto &image : model.images) {
-		// TODO: Check if image uses URI or buffer view (does "image" always resolve?)
-		size_t baseOffset = imageData.size();
+	imageDataSize = 0;
+	for (size_t i = 0; i < model.images.size(); ++i) {
+		const auto &image = model.images[i];
 
-		const std::byte *data = reinterpret_cast<const std::byte *>(image.image.data());
-		imageData.insert(imageData.end(), data, data + image.image.size());
+		// Sizes come from the image header, deferImageDecode guarantees 8 bit RGBA texels
+		uint32_t width = static_cast<uint32_t>(image.width);
+		uint32_t height = static_cast<uint32_t>(image.height);
+
+		ImageFormat format = selectImageFormat(usages[i], options);
+		uint32_t mipLevels = options.generateMips ? mipLevelCount(width, height) : 1;
+		size_t size = imageChainSize(format, width, height, mipLevels);
 
 		images.push_back({
 			image.width,
 			image.height,
 			image.bits,
-			baseOffset,
-			image.image.size()
+			format,
+			mipLevels,
+			imageDataSize,
+			size,
+			0 // Hashed once the data has been filled
 		});
+		imageDataSize += size;
 	}
 
 	return images;
 }
 
+// A band of block rows in one mip level, the unit compression is spread across threads in
+struct CompressionJob {
+	uint32_t level;
+	uint32_t firstRow;
+	uint32_t rowCount;
+
+	size_t sourceOffset;      // Level offset in the uncompressed chain
+	size_t destinationOffset; // Level offset in the image blob
+};
+
+#define COMPRESSION_JOB_ROWS 16
+
+std::vector<CompressionJob> planCompressionJobs(const ModelImageData &image) {
+	std::vector<CompressionJob> jobs;
+
+	uint32_t width = static_cast<uint32_t>(image.width);
+	uint32_t height = static_cast<uint32_t>(image.height);
+
+	size_t sourceOffset = 0;
+	size_t destinationOffset = image.offset;
+	for (uint32_t level = 0; level < image.mipLevels; ++level) {
+		uint32_t rows = (std::max(height >> level, 1u) + imageBlockExtent(image.format) - 1) / imageBlockExtent(image.format);
+		for (uint32_t row = 0; row < rows; row += COMPRESSION_JOB_ROWS) {
+			jobs.push_back({ level, row, std::min<uint32_t>(COMPRESSION_JOB_ROWS, rows - row), sourceOffset, destinationOffset });
+		}
+
+		sourceOffset += imageLevelSize(ImageFormat::LINEAR, width, height, level);
+		destinationOffset += imageLevelSize(image.format, width, height, level);
+	}
+
+	return jobs;
+}
+
+// Image loader for tinygltf that only reads the header and keeps the encoded bytes.
+// Decoding happens later on the conversion thread pool, one image at a time per thread.
+bool deferImageDecode(tinygltf::Image *image, const int imageIndex, std::string *err, std::string *warn,
+	int requestedWidth, int requestedHeight, const unsigned char *bytes, int size, void *userData) {
+
+	int width, height, components;
+	if (!stbi_info_from_memory(bytes, size, &width, &height, &components)) {
+		if (err) {
+			*err += "Unable to read header of image " + std::to_string(imageIndex) + ": " + stbi_failure_reason() + "\n";
+		}
+		return false;
+	}
+
+	// Every image is decoded to 8 bit RGBA
+	image->width = width;
+	image->height = height;
+	image->component = 4;
+	image->bits = 8;
+	image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+	image->image.assign(bytes, bytes + size);
+	return true;
+}
+
 std::vector<ModelTextureData> getModelTextures(const tinygltf::Model &model) {
 	std::vector<ModelTextureData> textures;
 	textures.reserve(model.textures.size());
@@ -158,6 +677,9 @@ std::vector<ModelTextureData> getModelTextures(const tinygltf::Model &model) {
 
 		const auto &sampler = model.samplers[texture.sampler];
 
+		// A min filter without a mipmap part samples the base level only
+		bool baseLevelOnly = sampler.minFilter == 9728 || sampler.minFilter == 9729;
+
 		textures.push_back({
 			texture.source,
 			ImageFormat::SRGB, // Needs to be corrected by material
@@ -166,7 +688,9 @@ std::vector<ModelTextureData> getModelTextures(const tinygltf::Model &model) {
 				convertGLFilterToVulkan(sampler.minFilter),
 				convertGLWrapModeToVulkan(sampler.wrapS),
 				convertGLWrapModeToVulkan(sampler.wrapT),
-				VK_SAMPLER_ADDRESS_MODE_REPEAT
+				VK_SAMPLER_ADDRESS_MODE_REPEAT,
+				convertGLFilterToVulkanMipmapMode(sampler.minFilter),
+				baseLevelOnly ? 0.0f : VK_LOD_CLAMP_NONE
 			}
 		});
 	}
@@ -199,8 +723,9 @@ std::vector<ModelMaterialData> getModelMaterials(const tinygltf::Model &model) {
 	return materials;
 }
 
-std::unique_ptr<ModelSource> convertToModelSource(const std::string &path) {
+std::unique_ptr<ModelSource> convertToModelSource(const std::string &path, const ConvertOptions &options) {
 	tinygltf::TinyGLTF loader;
+	loader.SetImageLoader(deferImageDecode, nullptr);
 
 	tinygltf::Model model;
 	std::string err;
@@ -219,18 +744,32 @@ std::unique_ptr<ModelSource> convertToModelSource(const std::string &path) {
 		return nullptr;
 	}
 
-	std::vector<std::byte> vertexData;
-	std::unordered_map<int, std::vector<Mesh>> modelMeshes;
-	std::unordered_map<int, glm::mat4> meshMatricies;
+	std::unique_ptr<ThreadPool> pool;
+	if (options.parallel) {
+		pool = std::make_unique<ThreadPool>(options.threadCount);
+	}
+	auto forEach = [&pool](size_t count, const std::function<void(size_t)> &task) {
+		if (pool) {
+			pool->parallelFor(count, task);
+		}
+		else {
+			for (size_t i = 0; i < count; ++i) {
+				task(i);
+			}
+		}
+	};
+
+	// Sizing pass: walk the scene and lay out every primitive and image in the output blobs
+	std::vector<MeshVisit> visits;
+	std::vector<PrimitivePlan> primitives;
 
 	const auto &scene = model.scenes[model.defaultScene];
 
 	for (size_t nodeIndex = 0; nodeIndex < scene.nodes.size(); ++nodeIndex) {
-		processNode(scene.nodes[nodeIndex], model, vertexData, modelMeshes, meshMatricies);
+		collectMeshVisits(scene.nodes[nodeIndex], model, options, visits, primitives);
 	}
 
-	std::vector<std::byte> imageData;
-	std::vector<ModelImageData> images = getModelImages(model, imageData);
+	forEach(primitives.size(), [&](size_t i) { processPrimitive(primitives[i], model, options); });
 
 	std::vector<ModelTextureData> textures = getModelTextures(model);
 	std::vector<ModelMaterialData> materials = getModelMaterials(model);
@@ -244,5 +783,135 @@ std::unique_ptr<ModelSource> convertToModelSource(const std::string &path) {
 			textures[material.occlusionTexture].format = ImageFormat::LINEAR;
 	}
 
-	return std::make_unique<ModelSource>(vertexData, imageData, modelMeshes, meshMatricies, images, textures, materials);
+	size_t imageDataSize;
+	std::vector<ModelImageData> images = layoutModelImages(model, getImageUsages(model, textures, materials), options, imageDataSize);
+
+	// Fill pass: every primitive and image owns a disjoint range of the preallocated blobs
+	GeometryLayout geometry = layoutPrimitives(primitives);
+	std::vector<std::byte> vertexData(geometry.getSize());
+	std::vector<std::byte> imageData(imageDataSize);
+
+	// Spreads the block rows of an image across the pool
+	auto compressImage = [&](const ModelImageData &image, uint32_t width, uint32_t height, const std::vector<std::byte> &uncompressedChain) {
+		std::vector<CompressionJob> jobs = planCompressionJobs(image);
+		forEach(jobs.size(), [&](size_t j) {
+			const CompressionJob &job = jobs[j];
+			compressBlockRows(
+				uncompressedChain.data() + job.sourceOffset,
+				std::max(width >> job.level, 1u),
+				std::max(height >> job.level, 1u),
+				image.format,
+				job.firstRow,
+				job.rowCount,
+				imageData.data() + job.destinationOffset);
+		});
+	};
+
+	// Each image is decoded, filtered and compressed within one task, so only as many decoded
+	// images are alive as there are threads. Compression of the image is spread over the pool as well.
+	auto fillImage = [&](size_t i) {
+		const ModelImageData &image = images[i];
+		std::vector<unsigned char> &encoded = model.images[i].image;
+
+		int width, height, components;
+		std::unique_ptr<stbi_uc, void (*)(void *)> texels(
+			stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &components, 4),
+			stbi_image_free);
+
+		if (!texels || width != image.width || height != image.height) {
+			LOG_ERROR("Failed to decode image {} of model: {}", i, path);
+			throw std::runtime_error("Failed to decode image");
+		}
+		std::vector<unsigned char>().swap(encoded);
+
+		std::vector<std::byte> uncompressedChain;
+		std::byte *target = imageData.data() + image.offset;
+		if (isBlockCompressed(image.format)) {
+			uncompressedChain.resize(imageChainSize(ImageFormat::LINEAR, width, height, image.mipLevels));
+			target = uncompressedChain.data();
+		}
+
+		// Mips of color images are filtered in linear space
+		const std::byte *source = reinterpret_cast<const std::byte *>(texels.get());
+		if (image.mipLevels > 1) {
+			generateMipChain(source, width, height, image.mipLevels, isSrgb(image.format), target);
+		}
+		else {
+			memcpy(target, source, static_cast<size_t>(width) * height * 4);
+		}
+		texels.reset();
+
+		if (!uncompressedChain.empty()) {
+			compressImage(image, width, height, uncompressedChain);
+		}
+
+		images[i].hash = hashBytes(imageData.data() + image.offset, image.size, static_cast<uint64_t>(image.format));
+	};
+
+	forEach(primitives.size(), [&](size_t i) { fillPrimitive(primitives[i], model, geometry, vertexData.data()); });
+	forEach(images.size(), fillImage);
+
+	size_t uncompressedSize = 0;
+	size_t compressedSize = 0;
+	for (const auto &image : images) {
+		if (isBlockCompressed(image.format)) {
+			uncompressedSize += imageChainSize(ImageFormat::LINEAR, image.width, image.height, image.mipLevels);
+			compressedSize += image.size;
+		}
+	}
+	if (compressedSize) {
+		LOG_INFO("Compressed images from {:.1f} MiB to {:.1f} MiB", uncompressedSize / (1024.0 * 1024.0), compressedSize / (1024.0 * 1024.0));
+	}
+
+	if (options.optimizeMeshes) {
+		PrimitiveStatistics total;
+		for (const auto &plan : primitives) {
+			total.before += plan.statistics.before;
+			total.after += plan.statistics.after;
+		}
+		LOG_INFO("Optimized {} triangles, ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}", total.after.triangles,
+			total.before.getAcmr(), total.after.getAcmr(), total.before.getAtvr(), total.after.getAtvr());
+	}
+	if (options.generateLods) {
+		size_t lodCount = 0;
+		for (const auto &plan : primitives) {
+			lodCount += plan.lods.size() - 1;
+		}
+		LOG_INFO("Generated {} LODs for {} primitives", lodCount, primitives.size());
+	}
+
+	std::vector<Meshlet> meshlets;
+	for (auto &plan : primitives) {
+		plan.meshletStart = meshlets.size();
+		meshlets.insert(meshlets.end(), plan.meshlets.begin(), plan.meshlets.end());
+	}
+	if (options.buildMeshlets) {
+		LOG_INFO("Built {} meshlets for {} primitives", meshlets.size(), primitives.size());
+	}
+
+	// Merge pass: build the mesh tables in visit order so later visits of a mesh win, as before
+	std::unordered_map<int, std::vector<Mesh>> modelMeshes;
+	std::unordered_map<int, glm::mat4> meshMatricies;
+
+	for (const auto &visit : visits) {
+		std::vector<Mesh> meshes;
+		meshes.reserve(visit.primitiveCount);
+		for (size_t i = 0; i < visit.primitiveCount; ++i) {
+			meshes.push_back(toMesh(primitives[visit.firstPrimitive + i]));
+		}
+
+		modelMeshes[visit.mesh] = std::move(meshes);
+		meshMatricies[visit.mesh] = visit.transform;
+	}
+
+	return std::make_unique<ModelSource>(
+		std::move(vertexData),
+		std::move(imageData),
+		geometry,
+		std::move(modelMeshes),
+		std::move(meshMatricies),
+		std::move(meshlets),
+		std::move(images),
+		std::move(textures),
+		std::move(materials));
 }
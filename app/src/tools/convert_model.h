@@ -6,4 +6,24 @@
 #include "data/model_source.h"
 
 
-std::unique_ptr<ModelSource> convertToModelSource(const std::string &path);
+struct ConvertOptions {
+	// Fill the vertex and image blobs and decode images on a thread pool. The output is identical to the serial conversion.
+	bool parallel = true;
+	unsigned int threadCount = 0; // 0 uses the hardware concurrency
+	// Store full mip chains, filtered in linear space
+	bool generateMips = true;
+	// Block compress images: BC5 for normal maps, BC4 for occlusion and BC7 for everything else
+	bool compressTextures = true;
+	// Use BC1 instead of BC7, half the size at a visibly lower quality
+	bool preferBC1 = false;
+	// Store interleaved PackedVertex records: quantized positions, half float texture coordinates and octahedral normals
+	bool packVertices = true;
+	// Reorder triangles and vertices of every primitive for the post-transform cache, overdraw and vertex fetch
+	bool optimizeMeshes = true;
+	// Simplify every primitive into a chain of up to MAX_MESH_LODS index ranges, selected at runtime by screen space error
+	bool generateLods = true;
+	// Split the first LOD into meshlets with bounds and normal cones for per cluster culling
+	bool buildMeshlets = true;
+};
+
+std::unique_ptr<ModelSource> convertToModelSource(const std::string &path, const ConvertOptions &options = {});
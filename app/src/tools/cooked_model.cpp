@@ -0,0 +1,337 @@
+#include "cooked_model.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#include "log.h"
+
+
+static_assert(std::is_trivially_copyable_v<CookedMeshRecord>, "Cooked mesh records must be trivially copyable");
+static_assert(std::is_trivially_copyable_v<CookedMeshMatrixRecord>, "Cooked mesh matrix records must be trivially copyable");
+static_assert(std::is_trivially_copyable_v<ModelImageData>, "Cooked image records must be trivially copyable");
+static_assert(std::is_trivially_copyable_v<ModelTextureData>, "Cooked texture records must be trivially copyable");
+static_assert(std::is_trivially_copyable_v<ModelMaterialData>, "Cooked material records must be trivially copyable");
+static_assert(std::is_trivially_copyable_v<Meshlet>, "Cooked meshlet records must be trivially copyable");
+static_assert(std::is_trivially_copyable_v<GeometryLayout>, "Cooked geometry records must be trivially copyable");
+
+struct SectionPayload {
+	CookedSection type;
+	uint32_t stride;
+	const void *data;
+	size_t size;
+};
+
+template<typename T>
+SectionPayload recordSection(CookedSection type, const std::vector<T> &records) {
+	return { type, static_cast<uint32_t>(sizeof(T)), records.data(), records.size() * sizeof(T) };
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+	return (offset + COOKED_MODEL_ALIGNMENT - 1) & ~static_cast<uint64_t>(COOKED_MODEL_ALIGNMENT - 1);
+}
+
+bool writeCookedModel(const ModelSource &modelSource, const std::string &path) {
+	// Maps are flattened in key order so cooking the same source is deterministic
+	std::vector<int> nodes;
+	nodes.reserve(modelSource.getMeshes().size());
+	for (const auto &[node, meshes] : modelSource.getMeshes()) {
+		nodes.push_back(node);
+	}
+	std::sort(nodes.begin(), nodes.end());
+
+	std::vector<CookedMeshRecord> meshRecords;
+	std::vector<CookedMeshMatrixRecord> matrixRecords;
+	for (int node : nodes) {
+		for (const Mesh &mesh : modelSource.getMeshes().at(node)) {
+			CookedMeshRecord record{};
+			record.node = node;
+			record.mesh = mesh;
+			meshRecords.push_back(record);
+		}
+
+		auto matrix = modelSource.getMeshMatricies().find(node);
+		if (matrix != modelSource.getMeshMatricies().end()) {
+			matrixRecords.push_back({ node, matrix->second });
+		}
+	}
+
+	ByteView vertexData = modelSource.getVertexData();
+	ByteView imageData = modelSource.getImageData();
+	std::vector<GeometryLayout> geometryRecords = { modelSource.getGeometry() };
+
+	std::vector<SectionPayload> sections = {
+		{ CookedSection::VERTEX_DATA, 1, vertexData.data(), vertexData.size() },
+		{ CookedSection::IMAGE_DATA, 1, imageData.data(), imageData.size() },
+		recordSection(CookedSection::MESHES, meshRecords),
+		recordSection(CookedSection::MESH_MATRICES, matrixRecords),
+		recordSection(CookedSection::IMAGES, modelSource.getImages()),
+		recordSection(CookedSection::TEXTURES, modelSource.getTextures()),
+		recordSection(CookedSection::MATERIALS, modelSource.getMaterials()),
+		recordSection(CookedSection::MESHLETS, modelSource.getMeshlets()),
+		recordSection(CookedSection::GEOMETRY, geometryRecords)
+	};
+
+	CookedModelHeader header{};
+	memcpy(header.magic, COOKED_MODEL_MAGIC, sizeof(header.magic));
+	header.version = COOKED_MODEL_VERSION;
+	header.sectionCount = static_cast<uint32_t>(sections.size());
+
+	std::vector<CookedModelSection> table;
+	uint64_t offset = alignOffset(sizeof(CookedModelHeader) + sizeof(CookedModelSection) * sections.size());
+	for (const auto &section : sections) {
+		table.push_back({ section.type, section.stride, offset, section.size });
+		offset = alignOffset(offset + section.size);
+	}
+
+	// Write to a temporary file first so a failed cook never leaves a truncated model behind
+	std::string temporaryPath = path + ".tmp";
+	std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		LOG_ERROR("Failed to open cooked model for writing: {}", path);
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char *>(table.data()), sizeof(CookedModelSection) * table.size());
+
+	static const char padding[COOKED_MODEL_ALIGNMENT] = {};
+	for (size_t i = 0; i < sections.size(); ++i) {
+		uint64_t position = static_cast<uint64_t>(file.tellp());
+		file.write(padding, static_cast<std::streamsize>(table[i].offset - position));
+		if (sections[i].size) {
+			file.write(reinterpret_cast<const char *>(sections[i].data), static_cast<std::streamsize>(sections[i].size));
+		}
+	}
+
+	file.close();
+	if (!file) {
+		LOG_ERROR("Failed to write cooked model: {}", path);
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	std::remove(path.c_str());
+	if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+		LOG_ERROR("Failed to move cooked model into place: {}", path);
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	LOG_DEBUG("Cooked model written to: {} ({} bytes)", path, offset);
+	return true;
+}
+
+template<typename T>
+std::vector<T> readRecords(const MappedFile &file, const CookedModelSection &section) {
+	std::vector<T> records(section.size / sizeof(T));
+	if (!records.empty()) {
+		memcpy(records.data(), file.data() + section.offset, records.size() * sizeof(T));
+	}
+	return records;
+}
+
+static uint32_t expectedStride(CookedSection type) {
+	switch (type) {
+	case CookedSection::VERTEX_DATA:
+	case CookedSection::IMAGE_DATA: return 1;
+	case CookedSection::MESHES: return sizeof(CookedMeshRecord);
+	case CookedSection::MESH_MATRICES: return sizeof(CookedMeshMatrixRecord);
+	case CookedSection::IMAGES: return sizeof(ModelImageData);
+	case CookedSection::TEXTURES: return sizeof(ModelTextureData);
+	case CookedSection::MATERIALS: return sizeof(ModelMaterialData);
+	case CookedSection::MESHLETS: return sizeof(Meshlet);
+	case CookedSection::GEOMETRY: return sizeof(GeometryLayout);
+	default: return 0;
+	}
+}
+
+// True when [first, first + count) lies within [0, size), without overflowing
+static bool isRangeInside(uint64_t first, uint64_t count, uint64_t size) {
+	return first <= size && count <= size - first;
+}
+
+static bool isImageFormat(ImageFormat format) {
+	switch (format) {
+	case ImageFormat::SRGB:
+	case ImageFormat::LINEAR:
+	case ImageFormat::BC1_SRGB:
+	case ImageFormat::BC1_LINEAR:
+	case ImageFormat::BC4_LINEAR:
+	case ImageFormat::BC5_LINEAR:
+	case ImageFormat::BC7_SRGB:
+	case ImageFormat::BC7_LINEAR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Every range of a mesh has to stay within the streams of the model and its meshlet table
+static bool isMeshValid(const Mesh &mesh, const GeometryLayout &geometry, const std::vector<Meshlet> &meshlets) {
+	if (mesh.vertexFormat != VertexFormat::SEPARATE && mesh.vertexFormat != VertexFormat::PACKED) {
+		return false;
+	}
+	uint32_t vertexCount = mesh.vertexFormat == VertexFormat::PACKED ? geometry.packedVertexCount : geometry.separateVertexCount;
+	if (mesh.vertexOffset < 0 || static_cast<uint32_t>(mesh.vertexOffset) > vertexCount) {
+		return false;
+	}
+
+	if (!isRangeInside(mesh.firstIndex, mesh.indexCount, geometry.indexCount)
+		|| mesh.lodCount < 1 || mesh.lodCount > MAX_MESH_LODS) {
+		return false;
+	}
+	for (uint32_t lod = 1; lod < mesh.lodCount; ++lod) {
+		if (!isRangeInside(mesh.lods[lod].firstIndex, mesh.lods[lod].indexCount, geometry.indexCount)) {
+			return false;
+		}
+	}
+
+	if (!isRangeInside(mesh.meshletStart, mesh.meshletCount, meshlets.size())) {
+		return false;
+	}
+	for (uint32_t i = 0; i < mesh.meshletCount; ++i) {
+		const Meshlet &meshlet = meshlets[mesh.meshletStart + i];
+		if (!isRangeInside(meshlet.firstIndex, meshlet.indexCount, mesh.indexCount)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The whole mip chain has to lie within the image data
+static bool isImageValid(const ModelImageData &image, uint64_t imageDataSize) {
+	if (!isImageFormat(image.format) || image.width <= 0 || image.height <= 0) {
+		return false;
+	}
+	uint32_t width = static_cast<uint32_t>(image.width);
+	uint32_t height = static_cast<uint32_t>(image.height);
+	return image.mipLevels >= 1 && image.mipLevels <= mipLevelCount(width, height)
+		&& image.size == imageChainSize(image.format, width, height, image.mipLevels)
+		&& isRangeInside(image.offset, image.size, imageDataSize);
+}
+
+std::unique_ptr<ModelSource> loadCookedModel(const std::string &path) {
+	std::shared_ptr<MappedFile> file = MappedFile::open(path);
+	if (!file) {
+		LOG_ERROR("Failed to open cooked model: {}", path);
+		return nullptr;
+	}
+
+	if (file->size() < sizeof(CookedModelHeader)) {
+		LOG_ERROR("Cooked model is truncated: {}", path);
+		return nullptr;
+	}
+
+	CookedModelHeader header;
+	memcpy(&header, file->data(), sizeof(header));
+
+	if (memcmp(header.magic, COOKED_MODEL_MAGIC, sizeof(header.magic)) != 0) {
+		LOG_ERROR("File is not a cooked model: {}", path);
+		return nullptr;
+	}
+	if (header.version != COOKED_MODEL_VERSION) {
+		LOG_WARN("Cooked model version mismatch (file: {}, expected: {}): {}", header.version, COOKED_MODEL_VERSION, path);
+		return nullptr;
+	}
+	if (header.sectionCount != static_cast<uint32_t>(CookedSection::COUNT)
+		|| file->size() < sizeof(CookedModelHeader) + sizeof(CookedModelSection) * header.sectionCount) {
+		LOG_ERROR("Cooked model has an invalid section table: {}", path);
+		return nullptr;
+	}
+
+	std::vector<CookedModelSection> table(header.sectionCount);
+	memcpy(table.data(), file->data() + sizeof(CookedModelHeader), sizeof(CookedModelSection) * table.size());
+
+	for (uint32_t i = 0; i < header.sectionCount; ++i) {
+		const CookedModelSection &section = table[i];
+		uint32_t stride = expectedStride(static_cast<CookedSection>(i));
+
+		if (section.type != static_cast<CookedSection>(i)
+			|| section.stride != stride
+			|| section.size % stride != 0
+			|| section.offset > file->size()
+			|| section.size > file->size() - section.offset) {
+
+			LOG_ERROR("Cooked model section {} is invalid or was written with an incompatible layout: {}", i, path);
+			return nullptr;
+		}
+	}
+
+	auto sectionOf = [&table](CookedSection type) -> const CookedModelSection & {
+		return table[static_cast<uint32_t>(type)];
+	};
+
+	const CookedModelSection &vertexSection = sectionOf(CookedSection::VERTEX_DATA);
+	const CookedModelSection &imageSection = sectionOf(CookedSection::IMAGE_DATA);
+
+	std::vector<GeometryLayout> geometry = readRecords<GeometryLayout>(*file, sectionOf(CookedSection::GEOMETRY));
+	if (geometry.size() != 1 || geometry[0].getSize() != vertexSection.size) {
+		LOG_ERROR("Cooked model geometry does not match its vertex data: {}", path);
+		return nullptr;
+	}
+
+	// Records are checked against the data they point into, a damaged file would otherwise be read past its end
+	std::vector<Meshlet> meshlets = readRecords<Meshlet>(*file, sectionOf(CookedSection::MESHLETS));
+	std::unordered_map<int, std::vector<Mesh>> meshes;
+	for (const auto &record : readRecords<CookedMeshRecord>(*file, sectionOf(CookedSection::MESHES))) {
+		if (!isMeshValid(record.mesh, geometry[0], meshlets)) {
+			LOG_ERROR("Cooked model has a mesh outside of its geometry: {}", path);
+			return nullptr;
+		}
+		meshes[record.node].push_back(record.mesh);
+	}
+
+	std::unordered_map<int, glm::mat4> meshMatricies;
+	for (const auto &record : readRecords<CookedMeshMatrixRecord>(*file, sectionOf(CookedSection::MESH_MATRICES))) {
+		meshMatricies[record.node] = record.matrix;
+	}
+
+	std::vector<ModelImageData> images = readRecords<ModelImageData>(*file, sectionOf(CookedSection::IMAGES));
+	for (const auto &image : images) {
+		if (!isImageValid(image, imageSection.size)) {
+			LOG_ERROR("Cooked model has an image outside of its image data: {}", path);
+			return nullptr;
+		}
+	}
+
+	std::vector<ModelTextureData> textures = readRecords<ModelTextureData>(*file, sectionOf(CookedSection::TEXTURES));
+	for (const auto &texture : textures) {
+		if (texture.image < -1 || texture.image >= static_cast<int>(images.size())) {
+			LOG_ERROR("Cooked model has a texture without an image: {}", path);
+			return nullptr;
+		}
+	}
+
+	std::vector<ModelMaterialData> materials = readRecords<ModelMaterialData>(*file, sectionOf(CookedSection::MATERIALS));
+	for (const auto &material : materials) {
+		for (int texture : { material.colorTexture, material.metallicRoughnessTexture, material.normalTexture,
+			material.occlusionTexture, material.emissiveTexture }) {
+
+			if (texture < -1 || texture >= static_cast<int>(textures.size())) {
+				LOG_ERROR("Cooked model has a material with a missing texture: {}", path);
+				return nullptr;
+			}
+		}
+	}
+
+	return std::make_unique<ModelSource>(
+		file,
+		ByteView(file->data() + vertexSection.offset, vertexSection.size),
+		ByteView(file->data() + imageSection.offset, imageSection.size),
+		geometry[0],
+		std::move(meshes),
+		std::move(meshMatricies),
+		std::move(meshlets),
+		std::move(images),
+		std::move(textures),
+		std::move(materials));
+}
+
+bool isCookedModelPath(const std::string &path) {
+	const std::string extension = COOKED_MODEL_EXTENSION;
+	return path.size() >= extension.size()
+		&& path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
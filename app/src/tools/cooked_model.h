@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "data/model_source.h"
+
+
+// Cooked models store the contents of a ModelSource in a layout that can be
+// used directly from a memory mapping. Bump the version whenever any of the
+// stored record types change.
+#define COOKED_MODEL_MAGIC "VRMC"
+#define COOKED_MODEL_VERSION 10
+#define COOKED_MODEL_EXTENSION ".vrmc"
+#define COOKED_MODEL_ALIGNMENT 64
+
+enum class CookedSection : uint32_t {
+	VERTEX_DATA,
+	IMAGE_DATA,
+	MESHES,
+	MESH_MATRICES,
+	IMAGES,
+	TEXTURES,
+	MATERIALS,
+	MESHLETS,
+	GEOMETRY,
+	COUNT
+};
+
+struct CookedModelHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t sectionCount;
+	uint32_t reserved;
+};
+
+struct CookedModelSection {
+	CookedSection type;
+	uint32_t stride; // Size of a single record, used to reject incompatible layouts
+	uint64_t offset;
+	uint64_t size;
+};
+
+struct CookedMeshRecord {
+	int32_t node;
+	Mesh mesh;
+};
+
+struct CookedMeshMatrixRecord {
+	int32_t node;
+	glm::mat4 matrix;
+};
+
+bool writeCookedModel(const ModelSource &modelSource, const std::string &path);
+std::unique_ptr<ModelSource> loadCookedModel(const std::string &path);
+
+bool isCookedModelPath(const std::string &path);
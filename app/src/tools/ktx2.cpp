@@ -0,0 +1,125 @@
+#include "ktx2.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "data/mapped_file.h"
+#include "log.h"
+
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct Ktx2Header {
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header must match the file layout");
+
+static std::optional<ImageFormat> toImageFormat(uint32_t vkFormat) {
+	switch (static_cast<ImageFormat>(vkFormat)) {
+	case ImageFormat::SRGB:
+	case ImageFormat::LINEAR:
+	case ImageFormat::BC1_SRGB:
+	case ImageFormat::BC1_LINEAR:
+	case ImageFormat::BC4_LINEAR:
+	case ImageFormat::BC5_LINEAR:
+	case ImageFormat::BC7_SRGB:
+	case ImageFormat::BC7_LINEAR:
+		return static_cast<ImageFormat>(vkFormat);
+	default:
+		return std::nullopt;
+	}
+}
+
+std::optional<Ktx2Image> loadKtx2Image(const std::string &path) {
+	std::shared_ptr<MappedFile> file = MappedFile::open(path);
+	if (!file) {
+		LOG_ERROR("Failed to open KTX2 image: {}", path);
+		return std::nullopt;
+	}
+
+	if (file->size() < sizeof(Ktx2Header)) {
+		LOG_ERROR("KTX2 image is truncated: {}", path);
+		return std::nullopt;
+	}
+
+	Ktx2Header header;
+	memcpy(&header, file->data(), sizeof(header));
+
+	if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+		LOG_ERROR("File is not a KTX2 image: {}", path);
+		return std::nullopt;
+	}
+	if (header.pixelDepth > 1 || header.pixelHeight == 0 || header.layerCount > 1 || header.faceCount != 1) {
+		LOG_ERROR("Only 2D KTX2 images with a single layer are supported: {}", path);
+		return std::nullopt;
+	}
+	if (header.supercompressionScheme != 0) {
+		LOG_ERROR("Supercompressed KTX2 images are not supported (scheme: {}): {}", header.supercompressionScheme, path);
+		return std::nullopt;
+	}
+
+	std::optional<ImageFormat> format = toImageFormat(header.vkFormat);
+	if (!format) {
+		LOG_ERROR("Unsupported KTX2 image format (VkFormat: {}): {}", header.vkFormat, path);
+		return std::nullopt;
+	}
+
+	// A level count of 0 asks the loader to generate mips, the base level is used as is
+	uint32_t levelCount = std::max(header.levelCount, 1u);
+	if (file->size() < sizeof(Ktx2Header) + sizeof(Ktx2LevelIndex) * levelCount) {
+		LOG_ERROR("KTX2 image has an invalid level index: {}", path);
+		return std::nullopt;
+	}
+
+	std::vector<Ktx2LevelIndex> levels(levelCount);
+	memcpy(levels.data(), file->data() + sizeof(Ktx2Header), sizeof(Ktx2LevelIndex) * levels.size());
+
+	Ktx2Image image{ *format, header.pixelWidth, header.pixelHeight, levelCount };
+	image.data.reserve(imageChainSize(*format, image.width, image.height, levelCount));
+
+	// Levels are indexed largest first, although the file stores the smallest first
+	for (uint32_t level = 0; level < levelCount; ++level) {
+		const Ktx2LevelIndex &index = levels[level];
+		if (index.byteLength != imageLevelSize(*format, image.width, image.height, level)
+			|| index.byteOffset > file->size()
+			|| index.byteLength > file->size() - index.byteOffset) {
+
+			LOG_ERROR("KTX2 image level {} is invalid: {}", level, path);
+			return std::nullopt;
+		}
+
+		const std::byte *levelData = file->data() + index.byteOffset;
+		image.data.insert(image.data.end(), levelData, levelData + index.byteLength);
+	}
+
+	return image;
+}
+
+bool isKtx2Path(const std::string &path) {
+	const std::string extension = KTX2_EXTENSION;
+	return path.size() >= extension.size()
+		&& path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+
+#include "data/image.h"
+
+
+#define KTX2_EXTENSION ".ktx2"
+
+struct Ktx2Image {
+	ImageFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+
+	// Levels are stored consecutively starting with the largest, as the upload queue expects
+	std::vector<std::byte> data;
+};
+
+// Reads a 2D, single layer KTX2 texture without supercompression whose format is one of ImageFormat
+std::optional<Ktx2Image> loadKtx2Image(const std::string &path);
+
+bool isKtx2Path(const std::string &path);
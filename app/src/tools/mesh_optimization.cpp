@@ -0,0 +1,285 @@
+#include "mesh_optimization.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+
+// The cache is emulated with timestamps: a vertex is cached while fewer than VERTEX_CACHE_SIZE misses happened since its own
+static bool isCached(uint32_t timestamp, uint32_t cacheTime) {
+	return timestamp - cacheTime <= VERTEX_CACHE_SIZE;
+}
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t *indices, size_t indexCount, size_t vertexCount) {
+	VertexCacheStatistics statistics;
+	statistics.triangles = indexCount / 3;
+
+	std::vector<uint32_t> cacheTimes(vertexCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	uint32_t timestamp = VERTEX_CACHE_SIZE + 1;
+
+	for (size_t i = 0; i < indexCount; ++i) {
+		uint32_t vertex = indices[i];
+		if (!isCached(timestamp, cacheTimes[vertex])) {
+			cacheTimes[vertex] = timestamp++;
+			statistics.transformedVertices++;
+		}
+		if (!referenced[vertex]) {
+			referenced[vertex] = true;
+			statistics.vertices++;
+		}
+	}
+
+	return statistics;
+}
+
+void optimizeVertexCache(uint32_t *destination, const uint32_t *indices, size_t indexCount, size_t vertexCount,
+	std::vector<uint32_t> *clusters) {
+
+	const size_t triangleCount = indexCount / 3;
+	const uint32_t invalid = std::numeric_limits<uint32_t>::max();
+
+	// Vertex to triangle adjacency
+	std::vector<uint32_t> liveTriangles(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; ++i) {
+		liveTriangles[indices[i]]++;
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	std::partial_sum(liveTriangles.begin(), liveTriangles.end(), adjacencyOffsets.begin() + 1);
+
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; ++i) {
+		adjacency[adjacencyFill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<uint32_t> cacheTimes(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+	uint32_t timestamp = VERTEX_CACHE_SIZE + 1;
+	size_t cursor = 0;
+	size_t outputTriangle = 0;
+
+	auto nextDisconnectedVertex = [&]() {
+		while (!deadEnds.empty()) {
+			uint32_t vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[vertex] > 0) {
+				return vertex;
+			}
+		}
+		for (; cursor < vertexCount; ++cursor) {
+			if (liveTriangles[cursor] > 0) {
+				return static_cast<uint32_t>(cursor);
+			}
+		}
+		return invalid;
+	};
+
+	uint32_t fanningVertex = nextDisconnectedVertex();
+	if (clusters && fanningVertex != invalid) {
+		clusters->push_back(0);
+	}
+
+	while (fanningVertex != invalid) {
+		// Emit all remaining triangles around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; ++a) {
+			uint32_t triangle = adjacency[a];
+			if (emitted[triangle]) {
+				continue;
+			}
+			emitted[triangle] = true;
+
+			for (int corner = 0; corner < 3; ++corner) {
+				uint32_t vertex = indices[triangle * 3 + corner];
+				destination[outputTriangle * 3 + corner] = vertex;
+
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+
+				if (!isCached(timestamp, cacheTimes[vertex])) {
+					cacheTimes[vertex] = timestamp++;
+				}
+			}
+			outputTriangle++;
+		}
+
+		// Prefer the neighbour that stays in cache longest while its remaining fan is emitted
+		uint32_t nextVertex = invalid;
+		int bestPriority = -1;
+		for (uint32_t vertex : candidates) {
+			if (liveTriangles[vertex] == 0) {
+				continue;
+			}
+			int priority = 0;
+			uint32_t age = timestamp - cacheTimes[vertex];
+			if (age + 2 * liveTriangles[vertex] <= VERTEX_CACHE_SIZE) {
+				priority = static_cast<int>(age);
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				nextVertex = vertex;
+			}
+		}
+
+		if (nextVertex == invalid) {
+			nextVertex = nextDisconnectedVertex();
+			if (clusters && nextVertex != invalid) {
+				clusters->push_back(static_cast<uint32_t>(outputTriangle));
+			}
+		}
+		fanningVertex = nextVertex;
+	}
+}
+
+// Splits hard clusters further wherever the cache efficiency of the part so far is close to that of the whole cluster
+static std::vector<uint32_t> splitClusters(const uint32_t *indices, size_t triangleCount, size_t vertexCount,
+	const std::vector<uint32_t> &clusters) {
+
+	std::vector<uint32_t> result;
+	std::vector<uint32_t> cacheTimes(vertexCount, 0);
+	uint32_t timestamp = VERTEX_CACHE_SIZE + 1;
+
+	auto countMisses = [&](uint32_t triangle) {
+		uint32_t misses = 0;
+		for (int corner = 0; corner < 3; ++corner) {
+			uint32_t vertex = indices[triangle * 3 + corner];
+			if (!isCached(timestamp, cacheTimes[vertex])) {
+				cacheTimes[vertex] = timestamp++;
+				misses++;
+			}
+		}
+		return misses;
+	};
+
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		uint32_t start = clusters[c];
+		uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(triangleCount);
+
+		// A timestamp jump flushes the emulated cache
+		timestamp += VERTEX_CACHE_SIZE + 1;
+		uint32_t clusterMisses = 0;
+		for (uint32_t t = start; t < end; ++t) {
+			clusterMisses += countMisses(t);
+		}
+		float threshold = OVERDRAW_THRESHOLD * clusterMisses / (end - start);
+
+		result.push_back(start);
+		timestamp += VERTEX_CACHE_SIZE + 1;
+
+		uint32_t runningMisses = 0;
+		uint32_t runningTriangles = 0;
+		for (uint32_t t = start; t < end; ++t) {
+			runningMisses += countMisses(t);
+			runningTriangles++;
+
+			if (t + 1 < end && runningMisses <= threshold * runningTriangles) {
+				result.push_back(t + 1);
+				timestamp += VERTEX_CACHE_SIZE + 1;
+				runningMisses = 0;
+				runningTriangles = 0;
+			}
+		}
+	}
+
+	return result;
+}
+
+void optimizeOverdraw(uint32_t *destination, const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount,
+	const std::vector<uint32_t> &clusters) {
+
+	const size_t triangleCount = indexCount / 3;
+	if (clusters.empty()) {
+		std::copy(indices, indices + triangleCount * 3, destination);
+		return;
+	}
+
+	std::vector<uint32_t> splitStarts = splitClusters(indices, triangleCount, vertexCount, clusters);
+
+	auto position = [positions](uint32_t vertex) {
+		return glm::vec3(positions[vertex * 3 + 0], positions[vertex * 3 + 1], positions[vertex * 3 + 2]);
+	};
+
+	// Area weighted centroid and normal of every cluster
+	std::vector<glm::vec3> clusterCentroids(splitStarts.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(splitStarts.size(), glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	for (size_t c = 0; c < splitStarts.size(); ++c) {
+		uint32_t end = c + 1 < splitStarts.size() ? splitStarts[c + 1] : static_cast<uint32_t>(triangleCount);
+		float clusterArea = 0.0f;
+
+		for (uint32_t t = splitStarts[c]; t < end; ++t) {
+			glm::vec3 p0 = position(indices[t * 3 + 0]);
+			glm::vec3 p1 = position(indices[t * 3 + 1]);
+			glm::vec3 p2 = position(indices[t * 3 + 2]);
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 centroid = (p0 + p1 + p2) * (1.0f / 3.0f);
+
+			clusterCentroids[c] += centroid * area;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+		}
+
+		meshCentroid += clusterCentroids[c];
+		meshArea += clusterArea;
+
+		clusterCentroids[c] = clusterArea > 0.0f ? clusterCentroids[c] / clusterArea : position(indices[splitStarts[c] * 3]);
+		float normalLength = glm::length(clusterNormals[c]);
+		clusterNormals[c] = normalLength > 0.0f ? clusterNormals[c] / normalLength : glm::vec3(0.0f);
+	}
+
+	if (meshArea > 0.0f) {
+		meshCentroid = meshCentroid / meshArea;
+	}
+
+	// Clusters far out along their own normal tend to occlude the rest, draw them first
+	std::vector<float> sortKeys(splitStarts.size());
+	for (size_t c = 0; c < splitStarts.size(); ++c) {
+		sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+	}
+
+	std::vector<uint32_t> order(splitStarts.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	uint32_t *target = destination;
+	for (uint32_t c : order) {
+		uint32_t end = c + 1 < splitStarts.size() ? splitStarts[c + 1] : static_cast<uint32_t>(triangleCount);
+		target = std::copy(indices + splitStarts[c] * 3, indices + end * 3, target);
+	}
+}
+
+std::vector<uint32_t> optimizeVertexFetch(uint32_t *indices, size_t indexCount, size_t vertexCount) {
+	const uint32_t invalid = std::numeric_limits<uint32_t>::max();
+
+	std::vector<uint32_t> remap(vertexCount, invalid);
+	std::vector<uint32_t> order;
+	order.reserve(vertexCount);
+
+	for (size_t i = 0; i < indexCount; ++i) {
+		uint32_t &vertex = remap[indices[i]];
+		if (vertex == invalid) {
+			vertex = static_cast<uint32_t>(order.size());
+			order.push_back(indices[i]);
+		}
+		indices[i] = vertex;
+	}
+
+	for (uint32_t vertex = 0; vertex < vertexCount; ++vertex) {
+		if (remap[vertex] == invalid) {
+			order.push_back(vertex);
+		}
+	}
+
+	return order;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+
+// Size of the simulated post-transform cache, a conservative FIFO model of current GPUs
+#define VERTEX_CACHE_SIZE 16
+// Clusters may be split as long as their cache efficiency stays within this factor
+#define OVERDRAW_THRESHOLD 1.05f
+
+struct VertexCacheStatistics {
+	size_t transformedVertices = 0;
+	size_t triangles = 0;
+	size_t vertices = 0; // Referenced vertices
+
+	// Average cache miss ratio: transformed vertices per triangle, 0.5 at best
+	float getAcmr() const { return triangles ? static_cast<float>(transformedVertices) / triangles : 0.0f; }
+	// Average transform to vertex ratio: 1.0 at best
+	float getAtvr() const { return vertices ? static_cast<float>(transformedVertices) / vertices : 0.0f; }
+
+	VertexCacheStatistics &operator+=(const VertexCacheStatistics &other) {
+		transformedVertices += other.transformedVertices;
+		triangles += other.triangles;
+		vertices += other.vertices;
+		return *this;
+	}
+};
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t *indices, size_t indexCount, size_t vertexCount);
+
+// Reorders triangles for the post-transform cache (Tipsify). Writes the triangle offsets where the
+// traversal had to jump to a disconnected vertex to clusters, these split the mesh for overdraw ordering.
+void optimizeVertexCache(uint32_t *destination, const uint32_t *indices, size_t indexCount, size_t vertexCount,
+	std::vector<uint32_t> *clusters = nullptr);
+
+// Orders clusters of a cache optimized index buffer so outward facing clusters are drawn first.
+// Positions are tightly packed float triples.
+void optimizeOverdraw(uint32_t *destination, const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount,
+	const std::vector<uint32_t> &clusters);
+
+// Renumbers vertices in the order the indices first reference them and remaps the indices in place.
+// Returns the source vertex of every destination vertex, unreferenced vertices are kept at the end.
+std::vector<uint32_t> optimizeVertexFetch(uint32_t *indices, size_t indexCount, size_t vertexCount);
@@ -0,0 +1,254 @@
+#include "mesh_simplification.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <cmath>
+
+
+// Sum of squared distances to a set of planes, weighted by triangle area
+struct Quadric {
+	double a2 = 0, ab = 0, ac = 0, ad = 0;
+	double b2 = 0, bc = 0, bd = 0;
+	double c2 = 0, cd = 0;
+	double d2 = 0;
+	double weight = 0;
+
+	static Quadric fromPlane(const glm::vec3 &normal, float distance, double weight) {
+		double a = normal.x, b = normal.y, c = normal.z, d = distance;
+		Quadric quadric;
+		quadric.a2 = a * a * weight; quadric.ab = a * b * weight; quadric.ac = a * c * weight; quadric.ad = a * d * weight;
+		quadric.b2 = b * b * weight; quadric.bc = b * c * weight; quadric.bd = b * d * weight;
+		quadric.c2 = c * c * weight; quadric.cd = c * d * weight;
+		quadric.d2 = d * d * weight;
+		quadric.weight = weight;
+		return quadric;
+	}
+
+	Quadric &operator+=(const Quadric &other) {
+		a2 += other.a2; ab += other.ab; ac += other.ac; ad += other.ad;
+		b2 += other.b2; bc += other.bc; bd += other.bd;
+		c2 += other.c2; cd += other.cd;
+		d2 += other.d2;
+		weight += other.weight;
+		return *this;
+	}
+
+	double evaluate(const glm::vec3 &point) const {
+		double x = point.x, y = point.y, z = point.z;
+		double result = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z
+			+ d2;
+		return std::max(result, 0.0);
+	}
+};
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	double cost; // Mean squared distance
+};
+
+// Locks every vertex that would tear the mesh when moved: vertices sharing a position with another
+// vertex (attribute seams) and vertices on edges that do not have exactly two triangles.
+static std::vector<bool> findLockedVertices(const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount) {
+	std::vector<bool> locked(vertexCount, false);
+
+	std::vector<uint32_t> sorted(vertexCount);
+	std::iota(sorted.begin(), sorted.end(), 0);
+	auto positionLess = [positions](uint32_t a, uint32_t b) {
+		return std::lexicographical_compare(positions + a * 3, positions + a * 3 + 3, positions + b * 3, positions + b * 3 + 3);
+	};
+	std::sort(sorted.begin(), sorted.end(), positionLess);
+
+	std::vector<uint32_t> positionIds(vertexCount);
+	uint32_t positionId = 0;
+	for (size_t i = 0; i < vertexCount; ++i) {
+		if (i > 0 && positionLess(sorted[i - 1], sorted[i])) {
+			positionId++;
+		}
+		else if (i > 0) {
+			locked[sorted[i - 1]] = true;
+			locked[sorted[i]] = true;
+		}
+		positionIds[sorted[i]] = positionId;
+	}
+
+	std::unordered_map<uint64_t, uint32_t> edgeTriangles;
+	auto edgeKey = [&](uint32_t a, uint32_t b) {
+		uint64_t idA = positionIds[a], idB = positionIds[b];
+		return idA < idB ? (idA << 32) | idB : (idB << 32) | idA;
+	};
+	for (size_t i = 0; i < indexCount; i += 3) {
+		for (int edge = 0; edge < 3; ++edge) {
+			edgeTriangles[edgeKey(indices[i + edge], indices[i + (edge + 1) % 3])]++;
+		}
+	}
+	for (size_t i = 0; i < indexCount; i += 3) {
+		for (int edge = 0; edge < 3; ++edge) {
+			uint32_t a = indices[i + edge], b = indices[i + (edge + 1) % 3];
+			if (edgeTriangles[edgeKey(a, b)] != 2) {
+				locked[a] = true;
+				locked[b] = true;
+			}
+		}
+	}
+
+	return locked;
+}
+
+std::vector<uint32_t> simplifyMesh(const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount,
+	size_t targetIndexCount, float &error) {
+
+	std::vector<uint32_t> result(indices, indices + indexCount - indexCount % 3);
+	error = 0.0f;
+
+	auto position = [positions](uint32_t vertex) {
+		return glm::vec3(positions[vertex * 3 + 0], positions[vertex * 3 + 1], positions[vertex * 3 + 2]);
+	};
+
+	std::vector<bool> locked = findLockedVertices(result.data(), result.size(), positions, vertexCount);
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < result.size(); i += 3) {
+		glm::vec3 p0 = position(result[i + 0]);
+		glm::vec3 normal = glm::cross(position(result[i + 1]) - p0, position(result[i + 2]) - p0);
+		float length = glm::length(normal);
+		if (length == 0.0f) {
+			continue;
+		}
+		normal = normal / length;
+
+		Quadric quadric = Quadric::fromPlane(normal, -glm::dot(normal, p0), length * 0.5);
+		for (int corner = 0; corner < 3; ++corner) {
+			quadrics[result[i + corner]] += quadric;
+		}
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<std::pair<uint32_t, uint32_t>> edges;
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+
+	// Every pass collapses a batch of independent edges, cheapest first
+	while (result.size() > targetIndexCount) {
+		const size_t triangleCount = result.size() / 3;
+
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (uint32_t vertex : result) {
+			adjacencyOffsets[vertex + 1]++;
+		}
+		std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+		adjacency.resize(result.size());
+		std::vector<uint32_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); ++i) {
+			adjacency[adjacencyFill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		edges.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int edge = 0; edge < 3; ++edge) {
+				uint32_t a = result[i + edge], b = result[i + (edge + 1) % 3];
+				edges.emplace_back(std::min(a, b), std::max(a, b));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		collapses.clear();
+		for (const auto &[a, b] : edges) {
+			if (locked[a] && locked[b]) {
+				continue;
+			}
+			Quadric quadric = quadrics[a];
+			quadric += quadrics[b];
+			double weight = std::max(quadric.weight, 1e-12);
+
+			double costToB = locked[a] ? INFINITY : quadric.evaluate(position(b)) / weight;
+			double costToA = locked[b] ? INFINITY : quadric.evaluate(position(a)) / weight;
+			collapses.push_back(costToB <= costToA ? Collapse{ a, b, costToB } : Collapse{ b, a, costToA });
+		}
+		if (collapses.empty()) {
+			break;
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+		// Each collapse removes about two triangles. Costs are only accurate at the start of a pass, so
+		// collapses much more expensive than needed for the goal wait for the next pass.
+		size_t removeGoal = (result.size() - targetIndexCount + 2) / 3;
+		double costLimit = collapses[std::min(collapses.size() - 1, removeGoal / 2)].cost * 1.5;
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), false);
+		size_t removed = 0;
+
+		for (const Collapse &collapse : collapses) {
+			if (collapse.cost > costLimit || removed >= removeGoal) {
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to]) {
+				continue;
+			}
+
+			// Reject collapses that flip a remaining triangle
+			bool flips = false;
+			size_t collapsedTriangles = 0;
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; ++a) {
+				const uint32_t *triangle = &result[adjacency[a] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+					collapsedTriangles++;
+					continue;
+				}
+
+				glm::vec3 before[3], after[3];
+				for (int corner = 0; corner < 3; ++corner) {
+					before[corner] = position(triangle[corner]);
+					after[corner] = triangle[corner] == collapse.from ? position(collapse.to) : before[corner];
+				}
+				glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				flips = glm::dot(normalBefore, normalAfter) <= 0.0f;
+			}
+			if (flips) {
+				continue;
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+
+			// Triangles around the collapsed vertex changed, their vertices wait for the next pass
+			for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; ++a) {
+				for (int corner = 0; corner < 3; ++corner) {
+					touched[result[adjacency[a] * 3 + corner]] = true;
+				}
+			}
+
+			error = std::max(error, static_cast<float>(std::sqrt(collapse.cost)));
+			removed += collapsedTriangles;
+		}
+
+		if (removed == 0) {
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t t = 0; t < triangleCount; ++t) {
+			uint32_t a = remap[result[t * 3 + 0]];
+			uint32_t b = remap[result[t * 3 + 1]];
+			uint32_t c = remap[result[t * 3 + 2]];
+			if (a != b && b != c && a != c) {
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	return result;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+
+// Collapses edges in order of their quadric error until at most targetIndexCount indices remain or no collapse is
+// possible. Borders, attribute seams and non-manifold edges are kept in place. Positions are tightly packed float triples.
+// Error receives the largest collapse error, as an approximate distance to the source surface in position units.
+std::vector<uint32_t> simplifyMesh(const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount,
+	size_t targetIndexCount, float &error);
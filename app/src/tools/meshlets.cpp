@@ -0,0 +1,120 @@
+#include "meshlets.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+
+// Cones wider than this can not be culled from any useful direction
+#define MESHLET_MIN_CONE_DOT 0.1f
+
+static glm::vec3 position(const float *positions, uint32_t vertex) {
+	return glm::vec3(positions[vertex * 3 + 0], positions[vertex * 3 + 1], positions[vertex * 3 + 2]);
+}
+
+static void computeBounds(Meshlet &meshlet, const uint32_t *indices, const float *positions, bool backfaceCulling) {
+	const uint32_t *triangles = indices + meshlet.firstIndex;
+
+	glm::vec3 min = position(positions, triangles[0]);
+	glm::vec3 max = min;
+	for (uint32_t i = 1; i < meshlet.indexCount; ++i) {
+		glm::vec3 point = position(positions, triangles[i]);
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	meshlet.center = (min + max) * 0.5f;
+	meshlet.radius = 0.0f;
+	for (uint32_t i = 0; i < meshlet.indexCount; ++i) {
+		meshlet.radius = std::max(meshlet.radius, glm::length(position(positions, triangles[i]) - meshlet.center));
+	}
+
+	meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneCutoff = 1.0f;
+	if (!backfaceCulling) {
+		return;
+	}
+
+	// The cone axis is the average triangle normal, its spread the smallest agreement with it
+	std::vector<glm::vec3> normals;
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i < meshlet.indexCount; i += 3) {
+		glm::vec3 p0 = position(positions, triangles[i + 0]);
+		glm::vec3 normal = glm::cross(position(positions, triangles[i + 1]) - p0, position(positions, triangles[i + 2]) - p0);
+		float length = glm::length(normal);
+		if (length > 0.0f) {
+			normals.push_back(normal / length);
+			axis += normals.back();
+		}
+	}
+
+	float axisLength = glm::length(axis);
+	if (normals.empty() || axisLength == 0.0f) {
+		return;
+	}
+	axis = axis / axisLength;
+
+	float minDot = 1.0f;
+	for (const glm::vec3 &normal : normals) {
+		minDot = std::min(minDot, glm::dot(normal, axis));
+	}
+	if (minDot <= MESHLET_MIN_CONE_DOT) {
+		return;
+	}
+
+	meshlet.coneAxis = axis;
+	meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+
+std::vector<Meshlet> buildMeshlets(const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount,
+	bool backfaceCulling) {
+
+	std::vector<Meshlet> meshlets;
+
+	// Vertices are marked with the meshlet that last used them
+	std::vector<uint32_t> vertexMeshlet(vertexCount, std::numeric_limits<uint32_t>::max());
+	uint32_t vertexCountInMeshlet = 0;
+
+	Meshlet current{};
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		uint32_t meshletIndex = static_cast<uint32_t>(meshlets.size());
+		uint32_t newVertices = 0;
+		for (int corner = 0; corner < 3; ++corner) {
+			uint32_t vertex = indices[i + corner];
+			bool seenInTriangle = (corner > 0 && indices[i] == vertex) || (corner > 1 && indices[i + 1] == vertex);
+			if (vertexMeshlet[vertex] != meshletIndex && !seenInTriangle) {
+				newVertices++;
+			}
+		}
+
+		if (current.indexCount && (vertexCountInMeshlet + newVertices > MESHLET_MAX_VERTICES
+			|| current.indexCount / 3 + 1 > MESHLET_MAX_TRIANGLES)) {
+
+			computeBounds(current, indices, positions, backfaceCulling);
+			meshlets.push_back(current);
+
+			meshletIndex++;
+			current = Meshlet{};
+			current.firstIndex = static_cast<uint32_t>(i);
+			vertexCountInMeshlet = 0;
+		}
+
+		for (int corner = 0; corner < 3; ++corner) {
+			uint32_t vertex = indices[i + corner];
+			if (vertexMeshlet[vertex] != meshletIndex) {
+				vertexMeshlet[vertex] = meshletIndex;
+				vertexCountInMeshlet++;
+			}
+		}
+		current.indexCount += 3;
+	}
+
+	if (current.indexCount) {
+		computeBounds(current, indices, positions, backfaceCulling);
+		meshlets.push_back(current);
+	}
+
+	return meshlets;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "data/mesh.h"
+
+
+// Splits consecutive triangles into meshlets of at most MESHLET_MAX_VERTICES unique vertices and MESHLET_MAX_TRIANGLES
+// triangles. Triangle order is kept, so cache optimized input gives compact meshlets. Positions are tightly packed
+// float triples. Without backface culling the normal cones are disabled.
+std::vector<Meshlet> buildMeshlets(const uint32_t *indices, size_t indexCount, const float *positions, size_t vertexCount,
+	bool backfaceCulling);
@@ -0,0 +1,178 @@
+#include "mipmaps.h"
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPMAPS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MIPMAPS_NEON
+#include <arm_neon.h>
+#endif
+
+
+// Linear values are quantized finely enough that every 8 bit sRGB value keeps its own entry
+#define SRGB_ENCODE_TABLE_SIZE 16384
+
+struct ColorTables {
+	float srgbToLinear[256];
+	float unormToLinear[256];
+	uint8_t linearToSrgb[SRGB_ENCODE_TABLE_SIZE];
+};
+
+static const ColorTables &colorTables() {
+	static const ColorTables tables = []() {
+		ColorTables tables;
+		for (int i = 0; i < 256; ++i) {
+			float value = i / 255.0f;
+			tables.srgbToLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+			tables.unormToLinear[i] = value;
+		}
+		for (int i = 0; i < SRGB_ENCODE_TABLE_SIZE; ++i) {
+			float value = i / static_cast<float>(SRGB_ENCODE_TABLE_SIZE - 1);
+			float encoded = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+			tables.linearToSrgb[i] = static_cast<uint8_t>(std::lround(std::clamp(encoded, 0.0f, 1.0f) * 255.0f));
+		}
+		return tables;
+	}();
+	return tables;
+}
+
+static void decodeRow(const uint8_t *source, uint32_t width, bool srgb, float *destination) {
+	const ColorTables &tables = colorTables();
+	const float *colorTable = srgb ? tables.srgbToLinear : tables.unormToLinear;
+
+	for (uint32_t i = 0; i < width * 4; i += 4) {
+		destination[i + 0] = colorTable[source[i + 0]];
+		destination[i + 1] = colorTable[source[i + 1]];
+		destination[i + 2] = colorTable[source[i + 2]];
+		destination[i + 3] = tables.unormToLinear[source[i + 3]];
+	}
+}
+
+// 2x2 box filter of two source rows, odd edges repeat the last texel
+static void downsampleRows(const float *row0, const float *row1, uint32_t sourceWidth, float *destination, uint32_t width) {
+	for (uint32_t x = 0; x < width; ++x) {
+		uint32_t x0 = std::min(x * 2, sourceWidth - 1) * 4;
+		uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1) * 4;
+
+#if defined(MIPMAPS_SSE2)
+		__m128 sum = _mm_add_ps(
+			_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+			_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+		_mm_storeu_ps(destination + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#elif defined(MIPMAPS_NEON)
+		float32x4_t sum = vaddq_f32(
+			vaddq_f32(vld1q_f32(row0 + x0), vld1q_f32(row0 + x1)),
+			vaddq_f32(vld1q_f32(row1 + x0), vld1q_f32(row1 + x1)));
+		vst1q_f32(destination + x * 4, vmulq_n_f32(sum, 0.25f));
+#else
+		for (uint32_t c = 0; c < 4; ++c) {
+			destination[x * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+		}
+#endif
+	}
+}
+
+static void encodeRow(const float *source, uint32_t width, bool srgb, uint8_t *destination) {
+	uint32_t i = 0;
+
+	if (srgb) {
+		const ColorTables &tables = colorTables();
+		for (; i < width * 4; i += 4) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				float value = std::clamp(source[i + c], 0.0f, 1.0f);
+				destination[i + c] = tables.linearToSrgb[static_cast<uint32_t>(value * (SRGB_ENCODE_TABLE_SIZE - 1) + 0.5f)];
+			}
+			destination[i + 3] = static_cast<uint8_t>(std::clamp(source[i + 3], 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+		return;
+	}
+
+#if defined(MIPMAPS_SSE2)
+	// Four texels per iteration, packed down to 16 bytes with saturation
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(255.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+
+	auto quantize = [&](const float *texel) {
+		__m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(texel), zero), one);
+		return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half));
+	};
+
+	for (; i + 16 <= width * 4; i += 16) {
+		__m128i low = _mm_packs_epi32(quantize(source + i), quantize(source + i + 4));
+		__m128i high = _mm_packs_epi32(quantize(source + i + 8), quantize(source + i + 12));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(destination + i), _mm_packus_epi16(low, high));
+	}
+#elif defined(MIPMAPS_NEON)
+	for (; i + 4 <= width * 4; i += 4) {
+		float32x4_t value = vminq_f32(vmaxq_f32(vld1q_f32(source + i), vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+		uint32x4_t quantized = vcvtq_u32_f32(vaddq_f32(vmulq_n_f32(value, 255.0f), vdupq_n_f32(0.5f)));
+		uint16x4_t narrow = vmovn_u32(quantized);
+		uint8x8_t bytes = vmovn_u16(vcombine_u16(narrow, narrow));
+		vst1_lane_u32(reinterpret_cast<uint32_t *>(destination + i), vreinterpret_u32_u8(bytes), 0);
+	}
+#endif
+
+	for (; i < width * 4; ++i) {
+		destination[i] = static_cast<uint8_t>(std::clamp(source[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+void generateMipChain(const std::byte *source, uint32_t width, uint32_t height, uint32_t levels, bool srgb, std::byte *destination) {
+	const uint8_t *sourceTexels = reinterpret_cast<const uint8_t *>(source);
+	uint8_t *output = reinterpret_cast<uint8_t *>(destination);
+
+	memcpy(output, sourceTexels, static_cast<size_t>(width) * height * 4);
+	output += static_cast<size_t>(width) * height * 4;
+
+	if (levels < 2) {
+		return;
+	}
+
+	// Filtering happens on linear floats, each level is built from the unquantized previous one
+	uint32_t levelWidth = std::max(width / 2, 1u);
+	uint32_t levelHeight = std::max(height / 2, 1u);
+
+	std::vector<float> level(static_cast<size_t>(levelWidth) * levelHeight * 4);
+	std::vector<float> nextLevel(level.size());
+	std::vector<float> row0(static_cast<size_t>(width) * 4);
+	std::vector<float> row1(row0.size());
+
+	for (uint32_t y = 0; y < levelHeight; ++y) {
+		decodeRow(sourceTexels + static_cast<size_t>(std::min(y * 2, height - 1)) * width * 4, width, srgb, row0.data());
+		decodeRow(sourceTexels + static_cast<size_t>(std::min(y * 2 + 1, height - 1)) * width * 4, width, srgb, row1.data());
+		downsampleRows(row0.data(), row1.data(), width, level.data() + static_cast<size_t>(y) * levelWidth * 4, levelWidth);
+	}
+
+	for (uint32_t i = 1; i < levels; ++i) {
+		for (uint32_t y = 0; y < levelHeight; ++y) {
+			encodeRow(level.data() + static_cast<size_t>(y) * levelWidth * 4, levelWidth, srgb, output + static_cast<size_t>(y) * levelWidth * 4);
+		}
+		output += static_cast<size_t>(levelWidth) * levelHeight * 4;
+
+		if (i + 1 == levels) {
+			break;
+		}
+
+		uint32_t nextWidth = std::max(levelWidth / 2, 1u);
+		uint32_t nextHeight = std::max(levelHeight / 2, 1u);
+		for (uint32_t y = 0; y < nextHeight; ++y) {
+			downsampleRows(
+				level.data() + static_cast<size_t>(std::min(y * 2, levelHeight - 1)) * levelWidth * 4,
+				level.data() + static_cast<size_t>(std::min(y * 2 + 1, levelHeight - 1)) * levelWidth * 4,
+				levelWidth,
+				nextLevel.data() + static_cast<size_t>(y) * nextWidth * 4,
+				nextWidth);
+		}
+
+		std::swap(level, nextLevel);
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+	}
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+
+// Writes a mip chain for an 8 bit RGBA image to destination, the first level being a copy of source.
+// Levels are box filtered in linear space, sRGB images are decoded before and encoded after filtering.
+void generateMipChain(const std::byte *source, uint32_t width, uint32_t height, uint32_t levels, bool srgb, std::byte *destination);
@@ -0,0 +1,741 @@
+#include "texture_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "log.h"
+
+
+// 4x4 texels, edge blocks repeat the last row and column
+struct TexelBlock {
+	uint8_t texels[16][4];
+};
+
+static void loadBlock(const uint8_t *source, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, TexelBlock &block) {
+	for (uint32_t y = 0; y < 4; ++y) {
+		uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+		for (uint32_t x = 0; x < 4; ++x) {
+			uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+			memcpy(block.texels[y * 4 + x], source + (static_cast<size_t>(sourceY) * width + sourceX) * 4, 4);
+		}
+	}
+}
+
+// Writes bits least significant first, the order every BC format uses
+class BlockWriter {
+public:
+	explicit BlockWriter(uint8_t *destination, size_t size) : m_destination(destination) {
+		memset(destination, 0, size);
+	}
+
+	void write(uint32_t value, uint32_t bitCount) {
+		for (uint32_t i = 0; i < bitCount; ++i, ++m_position) {
+			m_destination[m_position >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (m_position & 7));
+		}
+	}
+
+private:
+	uint8_t *m_destination;
+	uint32_t m_position = 0;
+};
+
+// Endpoints are fitted along the principal axis of the block's colors, found by power iteration on the covariance
+template<int Channels>
+static bool principalAxis(const TexelBlock &block, float mean[4], float axis[4]) {
+	for (int c = 0; c < Channels; ++c) {
+		mean[c] = 0.0f;
+		for (int i = 0; i < 16; ++i) {
+			mean[c] += block.texels[i][c];
+		}
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[Channels][Channels] = {};
+	for (int i = 0; i < 16; ++i) {
+		float delta[Channels];
+		for (int c = 0; c < Channels; ++c) {
+			delta[c] = block.texels[i][c] - mean[c];
+		}
+		for (int a = 0; a < Channels; ++a) {
+			for (int b = 0; b < Channels; ++b) {
+				covariance[a][b] += delta[a] * delta[b];
+			}
+		}
+	}
+
+	// Starting from the column with the largest variance avoids a start orthogonal to the axis
+	int start = 0;
+	for (int c = 1; c < Channels; ++c) {
+		if (covariance[c][c] > covariance[start][start]) {
+			start = c;
+		}
+	}
+	if (covariance[start][start] < 1e-3f) {
+		return false;
+	}
+
+	for (int c = 0; c < Channels; ++c) {
+		axis[c] = covariance[c][start];
+	}
+	for (int iteration = 0; iteration < 8; ++iteration) {
+		float next[Channels] = {};
+		float length = 0.0f;
+		for (int a = 0; a < Channels; ++a) {
+			for (int b = 0; b < Channels; ++b) {
+				next[a] += covariance[a][b] * axis[b];
+			}
+			length += next[a] * next[a];
+		}
+		if (length < 1e-12f) {
+			return false;
+		}
+		length = 1.0f / std::sqrt(length);
+		for (int c = 0; c < Channels; ++c) {
+			axis[c] = next[c] * length;
+		}
+	}
+	return true;
+}
+
+template<int Channels>
+static void fitEndpoints(const TexelBlock &block, float low[4], float high[4]) {
+	float mean[4];
+	float axis[4];
+	if (!principalAxis<Channels>(block, mean, axis)) {
+		for (int c = 0; c < Channels; ++c) {
+			low[c] = high[c] = mean[c];
+		}
+		return;
+	}
+
+	float minimum = 0.0f;
+	float maximum = 0.0f;
+	for (int i = 0; i < 16; ++i) {
+		float projection = 0.0f;
+		for (int c = 0; c < Channels; ++c) {
+			projection += (block.texels[i][c] - mean[c]) * axis[c];
+		}
+		minimum = std::min(minimum, projection);
+		maximum = std::max(maximum, projection);
+	}
+
+	for (int c = 0; c < Channels; ++c) {
+		low[c] = std::clamp(mean[c] + axis[c] * minimum, 0.0f, 255.0f);
+		high[c] = std::clamp(mean[c] + axis[c] * maximum, 0.0f, 255.0f);
+	}
+}
+
+
+// BC1
+
+static uint16_t packColor565(const float color[4]) {
+	uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+	uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+	uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor565(uint16_t color, int rgb[3]) {
+	int r = (color >> 11) & 31;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+static void encodeBC1(const TexelBlock &block, uint8_t *destination) {
+	float low[4];
+	float high[4];
+	fitEndpoints<3>(block, low, high);
+
+	uint16_t color0 = packColor565(high);
+	uint16_t color1 = packColor565(low);
+
+	// Texels below half alpha use the punch-through mode, which needs color0 <= color1
+	bool transparent = false;
+	for (int i = 0; i < 16; ++i) {
+		transparent |= block.texels[i][3] < 128;
+	}
+	if (transparent ? color0 > color1 : color0 < color1) {
+		std::swap(color0, color1);
+	}
+
+	int palette[4][3];
+	unpackColor565(color0, palette[0]);
+	unpackColor565(color1, palette[1]);
+	for (int c = 0; c < 3; ++c) {
+		if (transparent) {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+		else {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+	}
+
+	uint32_t indices = 0;
+	if (color0 != color1 || transparent) {
+		int colorCount = transparent ? 3 : 4;
+		for (int i = 0; i < 16; ++i) {
+			uint32_t best = 3;
+			if (!transparent || block.texels[i][3] >= 128) {
+				int bestError = INT32_MAX;
+				for (int p = 0; p < colorCount; ++p) {
+					int error = 0;
+					for (int c = 0; c < 3; ++c) {
+						int delta = block.texels[i][c] - palette[p][c];
+						error += delta * delta;
+					}
+					if (error < bestError) {
+						bestError = error;
+						best = p;
+					}
+				}
+			}
+			indices |= best << (i * 2);
+		}
+	}
+
+	BlockWriter writer(destination, 8);
+	writer.write(color0, 16);
+	writer.write(color1, 16);
+	writer.write(indices, 32);
+}
+
+
+// BC4 and BC5
+
+static void encodeBC4(const TexelBlock &block, int channel, uint8_t *destination) {
+	int low = 255;
+	int high = 0;
+	for (int i = 0; i < 16; ++i) {
+		low = std::min<int>(low, block.texels[i][channel]);
+		high = std::max<int>(high, block.texels[i][channel]);
+	}
+
+	BlockWriter writer(destination, 8);
+	writer.write(high, 8);
+	writer.write(low, 8);
+	if (high == low) {
+		return;
+	}
+
+	// Eight value mode, red0 > red1
+	int palette[8] = { high, low };
+	for (int p = 2; p < 8; ++p) {
+		palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+	}
+
+	for (int i = 0; i < 16; ++i) {
+		uint32_t best = 0;
+		int bestError = INT32_MAX;
+		for (int p = 0; p < 8; ++p) {
+			int error = std::abs(block.texels[i][channel] - palette[p]);
+			if (error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		writer.write(best, 3);
+	}
+}
+
+
+// BC7, mode 6 only: one subset, 7 bit RGBA endpoints with a p-bit each and 4 bit indices
+
+static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Bc7Endpoint {
+	int color[4]; // 7 bit
+	int pbit;
+
+	int unquantized(int channel) const { return (color[channel] << 1) | pbit; }
+};
+
+static Bc7Endpoint quantizeBc7Endpoint(const float value[4]) {
+	Bc7Endpoint best{};
+	float bestError = INFINITY;
+	for (int pbit = 0; pbit < 2; ++pbit) {
+		Bc7Endpoint endpoint{};
+		endpoint.pbit = pbit;
+
+		float error = 0.0f;
+		for (int c = 0; c < 4; ++c) {
+			endpoint.color[c] = std::clamp(static_cast<int>(std::lround((value[c] - pbit) * 0.5f)), 0, 127);
+			float delta = endpoint.unquantized(c) - value[c];
+			error += delta * delta;
+		}
+		if (error < bestError) {
+			bestError = error;
+			best = endpoint;
+		}
+	}
+	return best;
+}
+
+static int selectBc7Indices(const TexelBlock &block, const Bc7Endpoint &endpoint0, const Bc7Endpoint &endpoint1, uint8_t indices[16]) {
+	int palette[16][4];
+	for (int p = 0; p < 16; ++p) {
+		for (int c = 0; c < 4; ++c) {
+			palette[p][c] = ((64 - BC7_WEIGHTS[p]) * endpoint0.unquantized(c) + BC7_WEIGHTS[p] * endpoint1.unquantized(c) + 32) >> 6;
+		}
+	}
+
+	int totalError = 0;
+	for (int i = 0; i < 16; ++i) {
+		int bestError = INT32_MAX;
+		for (int p = 0; p < 16; ++p) {
+			int error = 0;
+			for (int c = 0; c < 4; ++c) {
+				int delta = block.texels[i][c] - palette[p][c];
+				error += delta * delta;
+			}
+			if (error < bestError) {
+				bestError = error;
+				indices[i] = static_cast<uint8_t>(p);
+			}
+		}
+		totalError += bestError;
+	}
+	return totalError;
+}
+
+// Least squares endpoints for a fixed set of indices
+static bool refineBc7Endpoints(const TexelBlock &block, const uint8_t indices[16], float low[4], float high[4]) {
+	float a = 0.0f, b = 0.0f, c = 0.0f;
+	float right0[4] = {};
+	float right1[4] = {};
+	for (int i = 0; i < 16; ++i) {
+		float t = BC7_WEIGHTS[indices[i]] / 64.0f;
+		a += (1.0f - t) * (1.0f - t);
+		b += (1.0f - t) * t;
+		c += t * t;
+		for (int channel = 0; channel < 4; ++channel) {
+			right0[channel] += (1.0f - t) * block.texels[i][channel];
+			right1[channel] += t * block.texels[i][channel];
+		}
+	}
+
+	float determinant = a * c - b * b;
+	if (std::abs(determinant) < 1e-6f) {
+		return false;
+	}
+	for (int channel = 0; channel < 4; ++channel) {
+		low[channel] = std::clamp((c * right0[channel] - b * right1[channel]) / determinant, 0.0f, 255.0f);
+		high[channel] = std::clamp((a * right1[channel] - b * right0[channel]) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+static void encodeBC7(const TexelBlock &block, uint8_t *destination) {
+	float low[4];
+	float high[4];
+	fitEndpoints<4>(block, low, high);
+
+	Bc7Endpoint endpoint0 = quantizeBc7Endpoint(low);
+	Bc7Endpoint endpoint1 = quantizeBc7Endpoint(high);
+	uint8_t indices[16];
+	int error = selectBc7Indices(block, endpoint0, endpoint1, indices);
+
+	for (int iteration = 0; iteration < 2 && error > 0; ++iteration) {
+		if (!refineBc7Endpoints(block, indices, low, high)) {
+			break;
+		}
+
+		Bc7Endpoint refined0 = quantizeBc7Endpoint(low);
+		Bc7Endpoint refined1 = quantizeBc7Endpoint(high);
+		uint8_t refinedIndices[16];
+		int refinedError = selectBc7Indices(block, refined0, refined1, refinedIndices);
+		if (refinedError >= error) {
+			break;
+		}
+
+		endpoint0 = refined0;
+		endpoint1 = refined1;
+		memcpy(indices, refinedIndices, sizeof(indices));
+		error = refinedError;
+	}
+
+	// The anchor index is stored without its top bit, so it has to be below 8
+	if (indices[0] & 8) {
+		std::swap(endpoint0, endpoint1);
+		for (uint8_t &index : indices) {
+			index = 15 - index;
+		}
+	}
+
+	BlockWriter writer(destination, 16);
+	writer.write(1 << 6, 7);
+	for (int c = 0; c < 4; ++c) {
+		writer.write(endpoint0.color[c], 7);
+		writer.write(endpoint1.color[c], 7);
+	}
+	writer.write(endpoint0.pbit, 1);
+	writer.write(endpoint1.pbit, 1);
+	writer.write(indices[0], 3);
+	for (int i = 1; i < 16; ++i) {
+		writer.write(indices[i], 4);
+	}
+}
+
+
+void compressBlockRows(const std::byte *source, uint32_t width, uint32_t height, ImageFormat format,
+	uint32_t firstRow, uint32_t rowCount, std::byte *destination) {
+
+	const uint8_t *texels = reinterpret_cast<const uint8_t *>(source);
+	uint32_t blocksWide = (width + 3) / 4;
+	size_t blockSize = imageBlockSize(format);
+
+	for (uint32_t blockY = firstRow; blockY < firstRow + rowCount; ++blockY) {
+		for (uint32_t blockX = 0; blockX < blocksWide; ++blockX) {
+			TexelBlock block;
+			loadBlock(texels, width, height, blockX, blockY, block);
+
+			uint8_t *target = reinterpret_cast<uint8_t *>(destination) + (static_cast<size_t>(blockY) * blocksWide + blockX) * blockSize;
+			switch (format) {
+			case ImageFormat::BC1_SRGB:
+			case ImageFormat::BC1_LINEAR:
+				encodeBC1(block, target);
+				break;
+			case ImageFormat::BC4_LINEAR:
+				encodeBC4(block, 0, target);
+				break;
+			case ImageFormat::BC5_LINEAR:
+				encodeBC4(block, 0, target);
+				encodeBC4(block, 1, target + 8);
+				break;
+			case ImageFormat::BC7_SRGB:
+			case ImageFormat::BC7_LINEAR:
+				encodeBC7(block, target);
+				break;
+			default:
+				LOG_ERROR("Image format {} is not block compressed", static_cast<int>(format));
+				throw std::runtime_error("Image format is not block compressed");
+			}
+		}
+	}
+}
+
+
+// Decoding, for devices without BC support
+
+// Reads bits least significant first, the counterpart of BlockWriter
+class BlockReader {
+public:
+	explicit BlockReader(const uint8_t *source) : m_source(source) {}
+
+	uint32_t read(uint32_t bitCount) {
+		uint32_t value = 0;
+		for (uint32_t i = 0; i < bitCount; ++i, ++m_position) {
+			value |= static_cast<uint32_t>((m_source[m_position >> 3] >> (m_position & 7)) & 1) << i;
+		}
+		return value;
+	}
+
+private:
+	const uint8_t *m_source;
+	uint32_t m_position = 0;
+};
+
+static void decodeBC1(const uint8_t *source, TexelBlock &block) {
+	BlockReader reader(source);
+	uint16_t color0 = static_cast<uint16_t>(reader.read(16));
+	uint16_t color1 = static_cast<uint16_t>(reader.read(16));
+
+	int palette[4][4];
+	unpackColor565(color0, palette[0]);
+	unpackColor565(color1, palette[1]);
+	for (int c = 0; c < 3; ++c) {
+		if (color0 > color1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = color0 > color1 ? 255 : 0;
+
+	for (int i = 0; i < 16; ++i) {
+		const int *color = palette[reader.read(2)];
+		for (int c = 0; c < 4; ++c) {
+			block.texels[i][c] = static_cast<uint8_t>(color[c]);
+		}
+	}
+}
+
+static void decodeBC4(const uint8_t *source, int channel, TexelBlock &block) {
+	BlockReader reader(source);
+	int high = reader.read(8);
+	int low = reader.read(8);
+
+	int palette[8] = { high, low };
+	if (high > low) {
+		for (int p = 2; p < 8; ++p) {
+			palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+		}
+	}
+	else {
+		for (int p = 2; p < 6; ++p) {
+			palette[p] = ((6 - p) * high + (p - 1) * low) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	for (int i = 0; i < 16; ++i) {
+		block.texels[i][channel] = static_cast<uint8_t>(palette[reader.read(3)]);
+	}
+}
+
+
+// BC7, every mode since KTX2 images may come from other encoders
+
+struct Bc7Mode {
+	int subsets;
+	int partitionBits;
+	int rotationBits;
+	int selectionBits;
+	int colorBits;
+	int alphaBits;
+	int endpointPbits; // One per endpoint
+	int sharedPbits; // One per subset
+	int indexBits;
+	int secondaryIndexBits;
+};
+
+static const Bc7Mode BC7_MODES[8] = {
+	{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+	{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 }
+};
+
+static const int BC7_WEIGHTS2[4] = { 0, 21, 43, 64 };
+static const int BC7_WEIGHTS3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+
+// Subset of each texel, one bit per texel for two subsets and two bits for three
+static const uint16_t BC7_PARTITIONS2[64] = {
+	0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+	0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+	0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+	0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+	0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+	0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+	0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+	0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+};
+
+static const uint32_t BC7_PARTITIONS3[64] = {
+	0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+	0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+	0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+	0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+	0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+	0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+	0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+	0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254
+};
+
+// Texels whose index is stored without its top bit, besides texel 0
+static const uint8_t BC7_ANCHORS2[64] = {
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+	15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+	6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15
+};
+
+static const uint8_t BC7_ANCHORS3_SECOND[64] = {
+	3, 3, 15, 15, 8, 3, 15, 15, 8, 8, 6, 6, 6, 5, 3, 3,
+	3, 3, 8, 15, 3, 3, 6, 10, 5, 8, 8, 6, 8, 5, 15, 15,
+	8, 15, 3, 5, 6, 10, 8, 15, 15, 3, 15, 5, 15, 15, 15, 15,
+	3, 15, 5, 5, 5, 8, 5, 10, 5, 10, 8, 13, 15, 12, 3, 3
+};
+
+static const uint8_t BC7_ANCHORS3_THIRD[64] = {
+	15, 8, 8, 3, 15, 15, 3, 8, 15, 15, 15, 15, 15, 15, 15, 8,
+	15, 8, 15, 3, 15, 8, 15, 8, 3, 15, 6, 10, 15, 15, 10, 8,
+	15, 3, 15, 10, 10, 8, 9, 10, 6, 15, 8, 15, 3, 6, 6, 8,
+	15, 3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 15, 15, 8
+};
+
+static int bc7Interpolate(int endpoint0, int endpoint1, int index, int indexBits) {
+	const int *weights = indexBits == 2 ? BC7_WEIGHTS2 : indexBits == 3 ? BC7_WEIGHTS3 : BC7_WEIGHTS;
+	return ((64 - weights[index]) * endpoint0 + weights[index] * endpoint1 + 32) >> 6;
+}
+
+static void decodeBC7(const uint8_t *source, TexelBlock &block) {
+	BlockReader reader(source);
+
+	int modeIndex = 0;
+	while (modeIndex < 8 && reader.read(1) == 0) {
+		++modeIndex;
+	}
+	if (modeIndex == 8) {
+		// Reserved, decoders return transparent black
+		memset(block.texels, 0, sizeof(block.texels));
+		return;
+	}
+	const Bc7Mode &mode = BC7_MODES[modeIndex];
+
+	uint32_t partition = reader.read(mode.partitionBits);
+	uint32_t rotation = reader.read(mode.rotationBits);
+	uint32_t selection = reader.read(mode.selectionBits);
+
+	// Endpoints by subset, channels are stored one after the other
+	int endpoints[3][2][4] = {};
+	for (int c = 0; c < 3; ++c) {
+		for (int s = 0; s < mode.subsets; ++s) {
+			endpoints[s][0][c] = reader.read(mode.colorBits);
+			endpoints[s][1][c] = reader.read(mode.colorBits);
+		}
+	}
+	for (int s = 0; s < mode.subsets; ++s) {
+		endpoints[s][0][3] = mode.alphaBits ? reader.read(mode.alphaBits) : 255;
+		endpoints[s][1][3] = mode.alphaBits ? reader.read(mode.alphaBits) : 255;
+	}
+
+	int pbits[3][2] = {};
+	bool hasPbits = mode.endpointPbits || mode.sharedPbits;
+	for (int s = 0; s < mode.subsets; ++s) {
+		if (mode.endpointPbits) {
+			pbits[s][0] = reader.read(1);
+			pbits[s][1] = reader.read(1);
+		}
+		else if (mode.sharedPbits) {
+			pbits[s][0] = pbits[s][1] = reader.read(1);
+		}
+	}
+
+	// Expand to 8 bits by repeating the top bits
+	for (int s = 0; s < mode.subsets; ++s) {
+		for (int e = 0; e < 2; ++e) {
+			for (int c = 0; c < 4; ++c) {
+				int bits = c < 3 ? mode.colorBits : mode.alphaBits;
+				if (bits == 0) {
+					continue;
+				}
+				int value = endpoints[s][e][c];
+				if (hasPbits) {
+					value = (value << 1) | pbits[s][e];
+					++bits;
+				}
+				value <<= 8 - bits;
+				endpoints[s][e][c] = value | (value >> bits);
+			}
+		}
+	}
+
+	int subsets[16] = {};
+	bool anchors[16] = { true };
+	if (mode.subsets == 2) {
+		for (int i = 0; i < 16; ++i) {
+			subsets[i] = (BC7_PARTITIONS2[partition] >> i) & 1;
+		}
+		anchors[BC7_ANCHORS2[partition]] = true;
+	}
+	else if (mode.subsets == 3) {
+		for (int i = 0; i < 16; ++i) {
+			subsets[i] = (BC7_PARTITIONS3[partition] >> (i * 2)) & 3;
+		}
+		anchors[BC7_ANCHORS3_SECOND[partition]] = true;
+		anchors[BC7_ANCHORS3_THIRD[partition]] = true;
+	}
+
+	int indices[16];
+	for (int i = 0; i < 16; ++i) {
+		indices[i] = reader.read(anchors[i] ? mode.indexBits - 1 : mode.indexBits);
+	}
+	int secondaryIndices[16] = {};
+	if (mode.secondaryIndexBits) {
+		for (int i = 0; i < 16; ++i) {
+			secondaryIndices[i] = reader.read(i == 0 ? mode.secondaryIndexBits - 1 : mode.secondaryIndexBits);
+		}
+	}
+
+	for (int i = 0; i < 16; ++i) {
+		const int (&endpoint)[2][4] = endpoints[subsets[i]];
+		int texel[4];
+		if (mode.secondaryIndexBits) {
+			// Colors and alpha have separate indices, the selection bit swaps which set each uses
+			int colorIndex = selection ? secondaryIndices[i] : indices[i];
+			int colorBits = selection ? mode.secondaryIndexBits : mode.indexBits;
+			int alphaIndex = selection ? indices[i] : secondaryIndices[i];
+			int alphaBits = selection ? mode.indexBits : mode.secondaryIndexBits;
+			for (int c = 0; c < 3; ++c) {
+				texel[c] = bc7Interpolate(endpoint[0][c], endpoint[1][c], colorIndex, colorBits);
+			}
+			texel[3] = bc7Interpolate(endpoint[0][3], endpoint[1][3], alphaIndex, alphaBits);
+		}
+		else {
+			for (int c = 0; c < 4; ++c) {
+				texel[c] = bc7Interpolate(endpoint[0][c], endpoint[1][c], indices[i], mode.indexBits);
+			}
+		}
+		if (rotation) {
+			std::swap(texel[3], texel[rotation - 1]);
+		}
+		for (int c = 0; c < 4; ++c) {
+			block.texels[i][c] = static_cast<uint8_t>(texel[c]);
+		}
+	}
+}
+
+
+void decompressImage(const std::byte *source, uint32_t width, uint32_t height, ImageFormat format, std::byte *destination) {
+	uint32_t blocksWide = (width + 3) / 4;
+	uint32_t blocksHigh = (height + 3) / 4;
+	size_t blockSize = imageBlockSize(format);
+	uint8_t *texels = reinterpret_cast<uint8_t *>(destination);
+
+	for (uint32_t blockY = 0; blockY < blocksHigh; ++blockY) {
+		for (uint32_t blockX = 0; blockX < blocksWide; ++blockX) {
+			const uint8_t *blockData = reinterpret_cast<const uint8_t *>(source) + (static_cast<size_t>(blockY) * blocksWide + blockX) * blockSize;
+
+			// Channels missing from the format read as 0, alpha as 1, matching how the device samples them
+			TexelBlock block;
+			for (auto &texel : block.texels) {
+				texel[0] = texel[1] = texel[2] = 0;
+				texel[3] = 255;
+			}
+
+			switch (format) {
+			case ImageFormat::BC1_SRGB:
+			case ImageFormat::BC1_LINEAR:
+				decodeBC1(blockData, block);
+				break;
+			case ImageFormat::BC4_LINEAR:
+				decodeBC4(blockData, 0, block);
+				break;
+			case ImageFormat::BC5_LINEAR:
+				decodeBC4(blockData, 0, block);
+				decodeBC4(blockData + 8, 1, block);
+				break;
+			case ImageFormat::BC7_SRGB:
+			case ImageFormat::BC7_LINEAR:
+				decodeBC7(blockData, block);
+				break;
+			default:
+				LOG_ERROR("Image format {} is not block compressed", static_cast<int>(format));
+				throw std::runtime_error("Image format is not block compressed");
+			}
+
+			// Edge blocks cover texels past the image
+			for (uint32_t y = 0; y < 4 && blockY * 4 + y < height; ++y) {
+				for (uint32_t x = 0; x < 4 && blockX * 4 + x < width; ++x) {
+					memcpy(texels + ((static_cast<size_t>(blockY) * 4 + y) * width + blockX * 4 + x) * 4, block.texels[y * 4 + x], 4);
+				}
+			}
+		}
+	}
+}
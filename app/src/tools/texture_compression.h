@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "data/image.h"
+
+
+// Encodes the block rows [firstRow, firstRow + rowCount) of an 8 bit RGBA image to a block compressed format.
+// Destination points at the first block of the image. Block rows are independent, so callers can split
+// large images across threads. BC4 stores the red channel and BC5 red and green.
+void compressBlockRows(const std::byte *source, uint32_t width, uint32_t height, ImageFormat format,
+	uint32_t firstRow, uint32_t rowCount, std::byte *destination);
+
+// Decodes one level of a block compressed image to 8 bit RGBA, for devices that cannot sample the format.
+// Destination holds width * height texels.
+void decompressImage(const std::byte *source, uint32_t width, uint32_t height, ImageFormat format, std::byte *destination);